@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "gc/gc.h"
+#include "gc/ptst.h"
+#include "bucket_prioq.h"
+#include "common.h"
+
+extern __thread ptst_t *ptst;
+
+static int gc_id = -1;
+
+bucket_prioq_t *bucket_priq_init(long nbuckets) {
+    bucket_prioq_t *q;
+    long n;
+
+    if (nbuckets < 1) nbuckets = 1;
+    assert(nbuckets <= 1L << (6 * BUCKET_LEVELS));
+
+    E_en(posix_memalign((void **)&q, CACHE_LINE_SIZE, sizeof(bucket_prioq_t)));
+    memset(q, 0, sizeof(bucket_prioq_t));
+    q->nbuckets = nbuckets;
+    E_NULL(q->tops = (bucket_node_t * volatile *)calloc(nbuckets, sizeof(bucket_node_t *)));
+
+    /* one bit per bucket, then per word, up to a single word */
+    n = nbuckets;
+    do {
+        n = (n + 63) / 64;
+        q->words[q->levels] = n;
+        E_en(posix_memalign((void **)&q->bits[q->levels], CACHE_LINE_SIZE,
+                            n * sizeof(unsigned long)));
+        memset((void *)q->bits[q->levels], 0, n * sizeof(unsigned long));
+        q->levels++;
+    } while (n > 1);
+
+    /* Only register the GC allocator once */
+    if (gc_id < 0)
+        gc_id = gc_add_allocator(sizeof(bucket_node_t));
+
+    return q;
+}
+
+void bucket_priq_destroy(bucket_prioq_t *q) {
+    bucket_node_t *n, *next;
+
+    if (q == NULL) return;
+
+    critical_enter();
+    for (long b = 0; b < q->nbuckets; b++) {
+        for (n = q->tops[b]; n != NULL; n = next) {
+            next = n->next;
+            gc_free(ptst, n, gc_id);
+        }
+    }
+    critical_exit();
+    for (int l = 0; l < q->levels; l++)
+        free((void *)q->bits[l]);
+    free((void *)q->tops);
+    free(q);
+}
+
+/* Mark index i of level l and the words above it non-empty. */
+static void set_bits(bucket_prioq_t *q, int l, long i) {
+    for (; l < q->levels; l++, i /= 64) {
+        unsigned long m = 1UL << (i % 64);
+        if (q->bits[l][i / 64] & m) return;
+        __sync_fetch_and_or(&q->bits[l][i / 64], m);
+    }
+}
+
+void bucket_priq_insert(bucket_prioq_t *q, pkey_t key, pval_t value) {
+    long b = (key - 1) % q->nbuckets;
+    bucket_node_t *n, *top;
+
+    assert(SENTINEL_KEYMIN < key && key < SENTINEL_KEYMAX);
+    critical_enter();
+    n = gc_alloc(ptst, gc_id);
+    n->k = key;
+    n->v = value;
+    do {
+        top = q->tops[b];
+        n->next = top;
+    } while (!__sync_bool_compare_and_swap(&q->tops[b], top, n));
+    critical_exit();
+    set_bits(q, 0, b);
+}
+
+/* Bucket b was seen empty: clear its bit, and those of the words that
+ * become zero, unless an insert makes them non-empty meanwhile. */
+static void clear_bits(bucket_prioq_t *q, long b) {
+    long i = b;
+
+    __sync_fetch_and_and(&q->bits[0][i / 64], ~(1UL << (i % 64)));
+    if (q->tops[b] != NULL) {
+        set_bits(q, 0, b);
+        return;
+    }
+    for (int l = 1; l < q->levels; l++) {
+        long w = i / 64;
+        i = w;
+        if (q->bits[l - 1][w] != 0) return;
+        __sync_fetch_and_and(&q->bits[l][i / 64], ~(1UL << (i % 64)));
+        if (q->bits[l - 1][w] != 0) {
+            set_bits(q, l, i);
+            return;
+        }
+    }
+}
+
+/* Lowest bucket whose bit is set, -1 if none. Bits of an upper level
+ * may be stale; a zero word found on the way down is cleared above. */
+static long find_first(bucket_prioq_t *q) {
+    long i;
+    int l;
+
+ retry:
+    i = 0;
+    for (l = q->levels - 1; l >= 0; l--) {
+        unsigned long w = q->bits[l][i];
+        if (w == 0) {
+            if (l == q->levels - 1) return -1;
+            /* word i of level l is empty: clear its bit above */
+            __sync_fetch_and_and(&q->bits[l + 1][i / 64], ~(1UL << (i % 64)));
+            if (q->bits[l][i] != 0) set_bits(q, l + 1, i);
+            goto retry;
+        }
+        i = i * 64 + __builtin_ctzll(w);
+    }
+    return i;
+}
+
+pval_t bucket_priq_delete_min_key(bucket_prioq_t *q, pkey_t *key) {
+    bucket_node_t *top;
+    pval_t v = NULL;
+    long b;
+
+    critical_enter();
+    while ((b = find_first(q)) >= 0) {
+        do {
+            top = q->tops[b];
+        } while (top != NULL &&
+                 !__sync_bool_compare_and_swap(&q->tops[b], top, top->next));
+        if (top != NULL) {
+            v = top->v;
+            if (key) *key = top->k;
+            /* took the last one: unmark now rather than on the next visit */
+            if (top->next == NULL) clear_bits(q, b);
+            gc_free(ptst, top, gc_id);
+            break;
+        }
+        clear_bits(q, b);
+    }
+    critical_exit();
+    return v;
+}
+
+pval_t bucket_priq_delete_min(bucket_prioq_t *q) {
+    return bucket_priq_delete_min_key(q, NULL);
+}
+
+pkey_t bucket_priq_peek_min(bucket_prioq_t *q) {
+    bucket_node_t *top;
+    pkey_t k = SENTINEL_KEYMAX;
+    long b;
+
+    critical_enter();
+    while ((b = find_first(q)) >= 0) {
+        if ((top = q->tops[b]) != NULL) {
+            k = top->k;
+            break;
+        }
+        clear_bits(q, b);
+    }
+    critical_exit();
+    return k;
+}
@@ -0,0 +1,45 @@
+#ifndef BUCKET_PRIOQ_H
+#define BUCKET_PRIOQ_H
+
+#include "prioq.h"
+
+/* Up to 64^BUCKET_LEVELS buckets */
+#define BUCKET_LEVELS 5
+
+typedef struct bucket_node_s {
+    pkey_t                 k;
+    pval_t                 v;
+    struct bucket_node_s  *next;
+} bucket_node_t;
+
+/* Bucket queue for keys from a bounded range. Key k goes to bucket
+ * (k - 1) mod nbuckets, a lock-free stack, so the order is exact as
+ * long as the live keys lie in one aligned window [i * nbuckets + 1,
+ * (i + 1) * nbuckets]. Within a bucket, the order is LIFO.
+ *
+ * A hierarchical bitmap marks the non-empty buckets: bit b of level 0
+ * is set when bucket b may hold elements, bit w of level l + 1 when
+ * word w of level l is non-zero. delete_min descends from the single
+ * top word with one find-first-set per level. Inserts set the bits
+ * bottom-up after the push; a thread that finds a bucket (or word)
+ * empty clears its bit, then checks again and restores the bit if an
+ * insert got in between, so no element is ever left unmarked. */
+typedef struct {
+    long                      nbuckets;
+    int                       levels;
+    bucket_node_t * volatile *tops;
+    volatile unsigned long   *bits[BUCKET_LEVELS];
+    long                      words[BUCKET_LEVELS];
+} bucket_prioq_t;
+
+bucket_prioq_t *bucket_priq_init(long nbuckets);
+void            bucket_priq_destroy(bucket_prioq_t *q);
+
+void   bucket_priq_insert(bucket_prioq_t *q, pkey_t key, pval_t value);
+pval_t bucket_priq_delete_min(bucket_prioq_t *q);
+pval_t bucket_priq_delete_min_key(bucket_prioq_t *q, pkey_t *key);
+/* Key of the top of the lowest non-empty bucket, SENTINEL_KEYMAX if
+ * none. A snapshot, like peek_min_key. */
+pkey_t bucket_priq_peek_min(bucket_prioq_t *q);
+
+#endif
@@ -1,4 +1,5 @@
 #define _GNU_SOURCE
+#include <stdlib.h>
 #include "common.h"
 
 #if defined(__linux__)
@@ -47,6 +48,52 @@ gettime(struct timespec *ts)
 
 
 
+static volatile int slot_taken[THREAD_SLOTS];
+static volatile int slots_used = 0;
+static __thread int my_slot = -1;
+static pthread_key_t slot_key;
+static pthread_once_t slot_once = PTHREAD_ONCE_INIT;
+
+static void
+slot_release (void *slot)
+{
+    __sync_lock_release(&slot_taken[(long)slot - 1]);
+}
+
+static void
+slot_key_init (void)
+{
+    E_en(pthread_key_create(&slot_key, slot_release));
+}
+
+int
+thread_slot (void)
+{
+    int s, u;
+
+    if (my_slot >= 0)
+	return my_slot;
+    pthread_once(&slot_once, slot_key_init);
+    for (s = 0; s < THREAD_SLOTS; s++)
+	if (!slot_taken[s] && !__sync_lock_test_and_set(&slot_taken[s], 1))
+	    break;
+    if (s == THREAD_SLOTS) {
+	fprintf(stderr, "E: more than %d live threads need a slot\n", THREAD_SLOTS);
+	abort();
+    }
+    while ((u = slots_used) <= s && !__sync_bool_compare_and_swap(&slots_used, u, s + 1))
+	;
+    /* the destructor only runs for a non-NULL value */
+    E_en(pthread_setspecific(slot_key, (void *)(long)(s + 1)));
+    return my_slot = s;
+}
+
+int
+thread_slots_used (void)
+{
+    return slots_used;
+}
+
 struct timespec
 timediff (struct timespec begin, struct timespec end)
 {
@@ -118,6 +118,16 @@ void rng_init (unsigned short rng[3]);
 extern void gettime(struct timespec *t);
 extern struct timespec timediff(struct timespec, struct timespec);
 
+/* Slots for per-thread state in shared structures, such as thread
+ * buffers or deques. A thread takes the lowest free slot on first use
+ * and gives it back when it exits, so only live threads count against
+ * THREAD_SLOTS; the next thread to take a slot inherits whatever the
+ * previous holder left in it. */
+#define THREAD_SLOTS 256
+extern int thread_slot(void);
+/* One above the highest slot handed out so far */
+extern int thread_slots_used(void);
+
 
 #endif
 
@@ -53,8 +53,9 @@
 #define INVALID_BYTE 0
 #define INITIALISE_NODES(_p,_c) memset((_p), INVALID_BYTE, (_c));
 
-/* Number of unique block sizes we can deal with. */
-#define MAX_SIZES 32
+/* Number of unique block sizes we can deal with: the skiplist takes
+ * one per tower height (NUM_LEVELS), plus a few for other nodes. */
+#define MAX_SIZES 40
 
 #define MAX_HOOKS 4
 
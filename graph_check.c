@@ -0,0 +1,178 @@
+/**
+ * Task graph validation.
+ *
+ * Runs on nthreads threads in phases separated by a barrier. The first
+ * walks a range of tasks: checks the children's ids, counts self loops
+ * and duplicate edges, and counts every task's parents with atomic
+ * adds. The second compares these counts with the initial indegrees and
+ * collects the roots. The last is Kahn's algorithm, one level at a
+ * time: the frontier is cut into chunks claimed with a shared counter,
+ * and a child joins the next frontier when its last parent is visited.
+ * Tasks never visited are on a cycle or behind one.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "graph_sched.h"
+#include "common.h"
+
+// Frontier tasks claimed at a time
+#define CHECK_CHUNK 256
+
+typedef struct check_state {
+    graph_sched_t     *gs;
+    volatile int      *left;       // parents, then parents not yet visited
+    int               *cur, *next; // frontiers of this level and the next
+    long               n_cur;
+    volatile long      n_next CACHELINE;
+    volatile long      claim CACHELINE;
+    long               visited;
+    int                levels;
+    pthread_barrier_t  barrier;
+} check_state_t;
+
+typedef struct check_worker {
+    pthread_t          thread;
+    check_state_t     *s;
+    int                lo, hi;
+    int               *scratch;
+    long               scratch_len;
+    long               bad_ids;
+    long               self_loops;
+    long               duplicates;
+    long               bad_indegree;
+} check_worker_t;
+
+static int id_cmp(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+// Repeated children of task i, sorting a copy if the list is not sorted
+static long count_duplicates(check_worker_t *w, int i) {
+    graph_sched_t *gs = w->s->gs;
+    const int *deps = graph_sched_deps(gs, i);
+    int n = graph_sched_n_deps(gs, i), sorted = 1;
+    long dups = 0;
+
+    for (int j = 1; j < n && sorted; j++)
+        sorted = deps[j - 1] <= deps[j];
+    if (!sorted) {
+        if (n > w->scratch_len) {
+            w->scratch_len = n;
+            E_NULL(w->scratch = (int *)realloc(w->scratch, n * sizeof(int)));
+        }
+        memcpy(w->scratch, deps, n * sizeof(int));
+        qsort(w->scratch, n, sizeof(int), id_cmp);
+        deps = w->scratch;
+    }
+    for (int j = 1; j < n; j++)
+        dups += deps[j - 1] == deps[j];
+    return dups;
+}
+
+static void *check_worker_run(void *_w) {
+    check_worker_t *w = (check_worker_t *)_w;
+    check_state_t *s = w->s;
+    graph_sched_t *gs = s->gs;
+    long k, end;
+
+    // Edges, and the parents of every task
+    for (int i = w->lo; i < w->hi; i++) {
+        const int *deps = graph_sched_deps(gs, i);
+        for (int j = 0; j < graph_sched_n_deps(gs, i); j++) {
+            int c = deps[j];
+            if (c < 0 || c >= gs->n_tasks) {
+                w->bad_ids++;
+                continue;
+            }
+            if (c == i) w->self_loops++;
+            __sync_fetch_and_add(&s->left[c], 1);
+        }
+        w->duplicates += count_duplicates(w, i);
+    }
+    pthread_barrier_wait(&s->barrier);
+
+    // Indegrees, and the first frontier
+    for (int i = w->lo; i < w->hi; i++) {
+        if (s->left[i] != gs->init_indegree[i]) w->bad_indegree++;
+        if (s->left[i] == 0) s->cur[__sync_fetch_and_add(&s->n_next, 1)] = i;
+    }
+    if (pthread_barrier_wait(&s->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+        s->n_cur = s->n_next;
+        s->n_next = 0;
+    }
+    pthread_barrier_wait(&s->barrier);
+
+    // Kahn's algorithm, level by level
+    while (s->n_cur > 0) {
+        while ((k = __sync_fetch_and_add(&s->claim, CHECK_CHUNK)) < s->n_cur) {
+            end = min(k + CHECK_CHUNK, s->n_cur);
+            for (; k < end; k++) {
+                int id = s->cur[k];
+                const int *deps = graph_sched_deps(gs, id);
+                for (int j = 0; j < graph_sched_n_deps(gs, id); j++) {
+                    int c = deps[j];
+                    if (c >= 0 && c < gs->n_tasks && __sync_sub_and_fetch(&s->left[c], 1) == 0)
+                        s->next[__sync_fetch_and_add(&s->n_next, 1)] = c;
+                }
+            }
+        }
+        if (pthread_barrier_wait(&s->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+            int *t = s->cur;
+            s->visited += s->n_cur;
+            s->levels++;
+            s->cur = s->next;
+            s->next = t;
+            s->n_cur = s->n_next;
+            s->n_next = 0;
+            s->claim = 0;
+        }
+        pthread_barrier_wait(&s->barrier);
+    }
+    return NULL;
+}
+
+int graph_sched_check(graph_sched_t *gs, int nthreads, graph_check_t *res) {
+    check_state_t *s;
+    check_worker_t *ws;
+    graph_check_t r = { 0 };
+    int n = gs->n_tasks;
+
+    if (nthreads < 1) nthreads = 1;
+    if (gs->init_indegree == NULL) graph_sched_snapshot(gs);
+    E_en(posix_memalign((void **)&s, CACHE_LINE_SIZE, sizeof(check_state_t)));
+    memset(s, 0, sizeof(check_state_t));
+    s->gs = gs;
+    E_NULL(s->left = (volatile int *)calloc(n + 1, sizeof(int)));
+    E_NULL(s->cur = (int *)malloc((n + 1) * sizeof(int)));
+    E_NULL(s->next = (int *)malloc((n + 1) * sizeof(int)));
+    E_en(pthread_barrier_init(&s->barrier, NULL, nthreads));
+
+    E_NULL(ws = (check_worker_t *)calloc(nthreads, sizeof(check_worker_t)));
+    for (int t = 0; t < nthreads; t++) {
+        ws[t].s = s;
+        ws[t].lo = (int)((long)n * t / nthreads);
+        ws[t].hi = (int)((long)n * (t + 1) / nthreads);
+        E_en(pthread_create(&ws[t].thread, NULL, check_worker_run, &ws[t]));
+    }
+    for (int t = 0; t < nthreads; t++) {
+        pthread_join(ws[t].thread, NULL);
+        r.bad_ids += ws[t].bad_ids;
+        r.self_loops += ws[t].self_loops;
+        r.duplicates += ws[t].duplicates;
+        r.bad_indegree += ws[t].bad_indegree;
+        free(ws[t].scratch);
+    }
+    r.cyclic = n - s->visited;
+    r.levels = r.cyclic ? 0 : s->levels;
+
+    pthread_barrier_destroy(&s->barrier);
+    free(ws);
+    free(s->next);
+    free(s->cur);
+    free((void *)s->left);
+    free(s);
+    if (res) *res = r;
+    return r.bad_ids || r.self_loops || r.duplicates || r.bad_indegree || r.cyclic ? -1 : 0;
+}
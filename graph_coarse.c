@@ -0,0 +1,219 @@
+/**
+ * Task graph coarsening.
+ *
+ * Two fusions, each bounded by the cost budget of a super-task. Chain
+ * fusion walks from every task that does not continue a chain, and
+ * appends the only child while that child has no other parent. Sibling
+ * grouping then packs the children of each super-task whose only
+ * parent it is into bins, first fit in child order. Such a child has a
+ * single incoming edge, so merging it with a sibling can not close a
+ * cycle. The super-task graph is built by contracting the groups, with
+ * duplicate edges dropped.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "graph_coarse.h"
+#include "common.h"
+
+#define task_cost(cost, i) ((cost) ? (cost)[i] : 1)
+
+// Body of a super-task: its members, in order
+static void coarse_task(graph_sched_t *gs, int id, void *arg) {
+    graph_coarse_t *c = (graph_coarse_t *)arg;
+
+    if (c->fn == NULL) return;
+    for (long k = c->mstart[id]; k < c->mstart[id + 1]; k++)
+        c->fn(c->orig, c->members[k], c->arg);
+}
+
+// Contract the groups into the super-task graph. Members keep the
+// order of chain (chains[cstart[a]] .. for chain a), chains that of
+// their index.
+static graph_sched_t *contract(graph_coarse_t *c, int n_groups, const int *chain_group,
+                               int n_chains, const long *cstart, const int *chains) {
+    graph_sched_t *gs = c->orig, *cg;
+    long *fill;
+    int *mark, n = gs->n_tasks;
+
+    E_NULL(c->mstart = (long *)calloc(n_groups + 1, sizeof(long)));
+    E_NULL(c->members = (int *)malloc((n + 1) * sizeof(int)));
+    for (int a = 0; a < n_chains; a++)
+        c->mstart[chain_group[a] + 1] += cstart[a + 1] - cstart[a];
+    for (int s = 0; s < n_groups; s++)
+        c->mstart[s + 1] += c->mstart[s];
+    E_NULL(fill = (long *)malloc((n_groups + 1) * sizeof(long)));
+    memcpy(fill, c->mstart, (n_groups + 1) * sizeof(long));
+    for (int a = 0; a < n_chains; a++) {
+        for (long k = cstart[a]; k < cstart[a + 1]; k++) {
+            c->members[fill[chain_group[a]]++] = chains[k];
+            c->group[chains[k]] = chain_group[a];
+        }
+    }
+
+    E_NULL(cg = (graph_sched_t *)calloc(1, sizeof(graph_sched_t)));
+    cg->n_tasks = n_groups;
+    cg->tasks = graph_sched_alloc_tasks(n_groups);
+    E_NULL(cg->offsets = (long *)calloc(n_groups + 1, sizeof(long)));
+    E_NULL(mark = (int *)malloc(n_groups * sizeof(int)));
+
+    // Count, then fill, the distinct super-task children of each group
+    for (int pass = 0; pass < 2; pass++) {
+        for (int s = 0; s < n_groups; s++)
+            mark[s] = -1;
+        for (int s = 0; s < n_groups; s++) {
+            long e = pass ? cg->offsets[s] : 0;
+            for (long k = c->mstart[s]; k < c->mstart[s + 1]; k++) {
+                int m = c->members[k];
+                for (int j = 0; j < graph_sched_n_deps(gs, m); j++) {
+                    int t = c->group[graph_sched_deps(gs, m)[j]];
+                    if (t == s || mark[t] == s) continue;
+                    mark[t] = s;
+                    if (pass) {
+                        cg->edges[e++] = t;
+                        cg->tasks[t].indegree++;
+                    } else {
+                        cg->offsets[s + 1]++;
+                    }
+                }
+            }
+        }
+        if (pass == 0) {
+            for (int s = 0; s < n_groups; s++)
+                cg->offsets[s + 1] += cg->offsets[s];
+            cg->n_edges = cg->offsets[n_groups];
+            E_NULL(cg->edges = (int *)malloc((cg->n_edges + 1) * sizeof(int)));
+        }
+    }
+    free(mark);
+    free(fill);
+    return cg;
+}
+
+graph_coarse_t *graph_coarse_create(graph_sched_t *gs, const long *cost, long budget,
+                                    int flags) {
+    graph_coarse_t *c;
+    int n = gs->n_tasks, n_chains = 0, n_groups = 0, cur, child;
+    int *parent, *chain_of, *chains, *leader, *chain_group;
+    long *cstart, *ccost, *prio, bin_cost;
+
+    if (budget < 1) return NULL;
+    if (gs->init_indegree == NULL) graph_sched_snapshot(gs);
+    E_NULL(c = (graph_coarse_t *)calloc(1, sizeof(graph_coarse_t)));
+    c->orig = gs;
+    E_NULL(c->group = (int *)malloc((n + 1) * sizeof(int)));
+
+    // Parent of the tasks that have exactly one
+    E_NULL(parent = (int *)malloc((n + 1) * sizeof(int)));
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < graph_sched_n_deps(gs, i); j++)
+            parent[graph_sched_deps(gs, i)[j]] = i;
+    }
+
+    // Chains: at most n of them, over all n tasks
+    E_NULL(chain_of = (int *)malloc((n + 1) * sizeof(int)));
+    E_NULL(chains = (int *)malloc((n + 1) * sizeof(int)));
+    E_NULL(cstart = (long *)malloc((n + 1) * sizeof(long)));
+    E_NULL(ccost = (long *)malloc((n + 1) * sizeof(long)));
+    cstart[0] = 0;
+    for (int v = 0; v < n; v++) {
+        // reached from the head of its chain
+        if ((flags & GRAPH_COARSE_CHAINS) && gs->init_indegree[v] == 1 &&
+            graph_sched_n_deps(gs, parent[v]) == 1)
+            continue;
+        cur = v;
+        chains[cstart[n_chains]] = v;
+        ccost[n_chains] = task_cost(cost, v);
+        chain_of[v] = n_chains;
+        cstart[n_chains + 1] = cstart[n_chains] + 1;
+        while ((flags & GRAPH_COARSE_CHAINS) && graph_sched_n_deps(gs, cur) == 1 &&
+               gs->init_indegree[child = graph_sched_deps(gs, cur)[0]] == 1) {
+            if (ccost[n_chains] + task_cost(cost, child) > budget) {
+                // the rest of the chain starts another one
+                n_chains++;
+                cstart[n_chains + 1] = cstart[n_chains];
+                ccost[n_chains] = 0;
+            } else {
+                c->n_chained++;
+            }
+            chains[cstart[n_chains + 1]++] = child;
+            ccost[n_chains] += task_cost(cost, child);
+            chain_of[child] = n_chains;
+            cur = child;
+        }
+        n_chains++;
+    }
+
+    // Siblings: chains headed by a single-parent child of the last
+    // task of another chain, packed into bins led by their first chain
+    E_NULL(leader = (int *)malloc((n_chains + 1) * sizeof(int)));
+    for (int a = 0; a < n_chains; a++)
+        leader[a] = a;
+    if (flags & GRAPH_COARSE_SIBLINGS) {
+        for (int a = 0; a < n_chains; a++) {
+            int tail = chains[cstart[a + 1] - 1], bin = -1;
+            const int *deps = graph_sched_deps(gs, tail);
+            bin_cost = 0;
+            for (int j = 0; j < graph_sched_n_deps(gs, tail); j++) {
+                int b = chain_of[deps[j]];
+                if (gs->init_indegree[deps[j]] != 1 || b == a) continue;
+                if (bin >= 0 && bin_cost + ccost[b] <= budget) {
+                    leader[b] = bin;
+                    bin_cost += ccost[b];
+                    c->n_grouped++;
+                } else {
+                    bin = b;
+                    bin_cost = ccost[b];
+                }
+            }
+        }
+    }
+    E_NULL(chain_group = (int *)malloc((n_chains + 1) * sizeof(int)));
+    for (int a = 0; a < n_chains; a++) {
+        if (leader[a] == a) chain_group[a] = n_groups++;
+    }
+    for (int a = 0; a < n_chains; a++)
+        chain_group[a] = chain_group[leader[a]];
+
+    c->gs = contract(c, n_groups, chain_group, n_chains, cstart, chains);
+
+    // Summed costs, and the best member priority
+    E_NULL(c->cost = (long *)calloc(n_groups + 1, sizeof(long)));
+    E_NULL(prio = (long *)malloc((n_groups + 1) * sizeof(long)));
+    for (int s = 0; s < n_groups; s++)
+        prio[s] = (long)gs->tasks[c->members[c->mstart[s]]].priority;
+    for (int i = 0; i < n; i++) {
+        c->cost[c->group[i]] += task_cost(cost, i);
+        prio[c->group[i]] = min(prio[c->group[i]], (long)gs->tasks[i].priority);
+    }
+    graph_sched_set_priorities(c->gs, prio);
+    c->gs->policy = gs->policy;
+    graph_sched_snapshot(c->gs);
+
+    free(prio);
+    free(chain_group);
+    free(leader);
+    free(ccost);
+    free(cstart);
+    free(chains);
+    free(chain_of);
+    free(parent);
+    return c;
+}
+
+void graph_coarse_destroy(graph_coarse_t *c) {
+    if (c == NULL) return;
+    graph_sched_destroy(c->gs);
+    free(c->cost);
+    free(c->members);
+    free(c->mstart);
+    free(c->group);
+    free(c);
+}
+
+long graph_coarse_run(graph_coarse_t *c, int nthreads, graph_task_fn_t fn, void *arg) {
+    c->fn = fn;
+    c->arg = arg;
+    return graph_sched_run(c->gs, nthreads, coarse_task, c);
+}
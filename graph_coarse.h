@@ -0,0 +1,46 @@
+#ifndef GRAPH_COARSE_H
+#define GRAPH_COARSE_H
+
+#include "graph_sched.h"
+
+// What graph_coarse_create() fuses
+#define GRAPH_COARSE_CHAINS   1 // a task into its parent, if each is the
+                                // other's only neighbour on that side
+#define GRAPH_COARSE_SIBLINGS 2 // children whose only parent is the same
+                                // super-task
+
+// A coarser graph over the same tasks. Every super-task runs its
+// members one after the other, in an order that respects their edges,
+// and has an edge to another super-task if any of its members has one
+// to a member of the other. Fusing only ever adds dependencies, so
+// every edge of the original graph is kept.
+typedef struct graph_coarse {
+    graph_sched_t  *gs;        // super-task graph, no queue attached
+    graph_sched_t  *orig;
+    int            *group;     // super-task of each original task
+    // Members of super-task s:
+    // members[mstart[s]] .. members[mstart[s + 1] - 1]
+    long           *mstart;
+    int            *members;
+    long           *cost;      // summed member costs (counts without costs)
+    long            n_chained; // tasks fused into their parent's chain
+    long            n_grouped; // super-tasks merged with a sibling
+    graph_task_fn_t fn;        // body of the original tasks, and its
+    void           *arg;       // argument, while graph_coarse_run() runs
+} graph_coarse_t;
+
+// Fuse the tasks of gs into super-tasks of cost at most budget, cost[i]
+// being the cost of task i (1 for every task if cost is NULL). flags
+// selects the fusions. The super-tasks inherit the policy of gs, and
+// are ordered by the best priority of their members.
+graph_coarse_t *graph_coarse_create(graph_sched_t *gs, const long *cost, long budget,
+                                    int flags);
+void            graph_coarse_destroy(graph_coarse_t *c);
+
+// Run the super-task graph (a queue must be attached to c->gs), fn
+// being called on c->orig for every original task. Returns the number
+// of super-tasks executed.
+long            graph_coarse_run(graph_coarse_t *c, int nthreads, graph_task_fn_t fn,
+                                 void *arg);
+
+#endif
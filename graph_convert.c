@@ -0,0 +1,95 @@
+/**
+ * Converts task graphs to the binary CSR format that graph_perf_meas
+ * and graph_numa_perf_meas map with -f, or, with 64-bit ids, that
+ * graph_stream_perf_meas streams.
+ *
+ * Usage: ./graph_convert [-t|-l] <input> <output>
+ *        ./graph_convert [-t|-l] [-g gen] [-S seed] -r <n_tasks> <edges_per_task> <output>
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include "common.h"
+#include "graph_sched.h"
+
+static void
+usage(FILE *out, const char *argv0)
+{
+    fprintf(out, "Usage: %s [-t|-l] <input> <output>\n", argv0);
+    fprintf(out, "       %s [-t|-l] [-g gen] [-S seed] -r <n_tasks> <edges_per_task> <output>\n", argv0);
+    fprintf(out, "\n");
+    fprintf(out, "  input   Edge list text file or binary graph file\n");
+    fprintf(out, "  -r      Generate a graph instead of reading one\n");
+    fprintf(out, "  -g GEN  Generator: random, layered, wavefront, forkjoin, cholesky,\n");
+    fprintf(out, "          lu or powerlaw (default random)\n");
+    fprintf(out, "  -S SEED Generator seed (default %d)\n", GRAPH_GEN_SEED);
+    fprintf(out, "  -l      Write 64-bit ids, for graph_stream_perf_meas\n");
+    fprintf(out, "  -t      Write a text edge list instead of the binary format\n");
+}
+
+static int
+save_edgelist(graph_sched_t *gs, const char *path)
+{
+    FILE *f;
+
+    if ((f = fopen(path, "w")) == NULL) {
+        perror(path);
+        return -1;
+    }
+    fprintf(f, "# %d tasks, %ld edges\n", gs->n_tasks, gs->n_edges);
+    for (int i = 0; i < gs->n_tasks; i++) {
+        const int *deps = graph_sched_deps(gs, i);
+        for (int j = 0; j < graph_sched_n_deps(gs, i); j++)
+            fprintf(f, "%d %d\n", i, deps[j]);
+    }
+    return fclose(f);
+}
+
+int
+main(int argc, char **argv)
+{
+    graph_sched_t *gs;
+    int text = 0, wide = 0, gen = 0, opt, rc;
+    graph_gen_kind_t kind = GRAPH_GEN_RANDOM;
+    unsigned long seed = GRAPH_GEN_SEED;
+
+    while ((opt = getopt(argc, argv, "tlrg:S:h")) >= 0) {
+        switch (opt) {
+        case 'g':
+            if (graph_sched_parse_gen(optarg, &kind) < 0) {
+                usage(stderr, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'S': seed = strtoul(optarg, NULL, 0); break;
+        case 't': text = 1; break;
+        case 'l': wide = 1; break;
+        case 'r': gen = 1; break;
+        case 'h': usage(stdout, argv[0]); exit(EXIT_SUCCESS);
+        default:  usage(stderr, argv[0]); exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind != (gen ? 3 : 2) || (text && wide)) {
+        usage(stderr, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (gen)
+        gs = graph_sched_generate(kind, atoi(argv[optind]), atoi(argv[optind + 1]), seed,
+                                  (int)sysconf(_SC_NPROCESSORS_ONLN));
+    else
+        gs = graph_sched_load(argv[optind], (int)sysconf(_SC_NPROCESSORS_ONLN));
+    if (gs == NULL)
+        exit(EXIT_FAILURE);
+
+    if (text)
+        rc = save_edgelist(gs, argv[argc - 1]);
+    else
+        rc = graph_sched_save_csr_ids(gs, argv[argc - 1], wide ? sizeof(int64_t) : sizeof(int));
+    if (rc == 0)
+        printf("%d tasks, %ld edges\n", gs->n_tasks, gs->n_edges);
+
+    graph_sched_destroy(gs);
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "graph_dyn.h"
+#include "common.h"
+
+// Keys order by priority, then id, which keeps them unique
+#define DTASK_KEY(t) ((((pkey_t)(t)->priority) << 32 | (pkey_t)(t)->id) + 1)
+
+typedef struct edge_slab {
+    struct edge_slab *next;
+    int               used;
+    graph_dedge_t     edges[GRAPH_DYN_EDGE_SLAB];
+} edge_slab_t;
+
+typedef struct graph_dworker {
+    pthread_t     thread;
+    int           id;
+    graph_dyn_t  *d;
+    long          executed;
+    char          pad[128];
+} graph_dworker_t;
+
+graph_dyn_t *graph_dyn_create(void) {
+    graph_dyn_t *d;
+
+    E_en(posix_memalign((void **)&d, CACHE_LINE_SIZE, sizeof(graph_dyn_t)));
+    memset(d, 0, sizeof(graph_dyn_t));
+    E_NULL(d->chunks = (graph_dtask_t * volatile *)calloc(GRAPH_DYN_MAX_CHUNKS, sizeof(graph_dtask_t *)));
+    return d;
+}
+
+void graph_dyn_destroy(graph_dyn_t *d) {
+    edge_slab_t *s, *next;
+
+    if (d == NULL) return;
+    for (int c = 0; c < GRAPH_DYN_MAX_CHUNKS && d->chunks[c]; c++)
+        free(d->chunks[c]);
+    free((void *)d->chunks);
+    for (s = (edge_slab_t *)d->slabs; s; s = next) {
+        next = s->next;
+        free(s);
+    }
+    graph_queue_destroy(&d->qiface);
+    lane_priq_destroy(d->lanes);
+    free(d);
+}
+
+// Chunk c, allocated by whichever thread gets there first
+static graph_dtask_t *get_chunk(graph_dyn_t *d, int c) {
+    graph_dtask_t *chunk = d->chunks[c];
+
+    if (chunk != NULL) return chunk;
+    E_en(posix_memalign((void **)&chunk, CACHE_LINE_SIZE, GRAPH_DYN_CHUNK * sizeof(graph_dtask_t)));
+    if (!__sync_bool_compare_and_swap(&d->chunks[c], NULL, chunk)) {
+        free(chunk);
+        chunk = d->chunks[c];
+    }
+    return chunk;
+}
+
+// Slabs belong to the graph, so a thread that outlives it keeps no
+// pointer into it
+static graph_dedge_t *alloc_edge(graph_dyn_t *d) {
+    edge_slab_t **cur = (edge_slab_t **)&d->cur_slab[thread_slot()], *s = *cur, *head;
+
+    if (s == NULL || s->used == GRAPH_DYN_EDGE_SLAB) {
+        E_NULL(s = (edge_slab_t *)malloc(sizeof(edge_slab_t)));
+        s->used = 0;
+        do {
+            head = (edge_slab_t *)d->slabs;
+            s->next = head;
+        } while (!__sync_bool_compare_and_swap(&d->slabs, head, s));
+        *cur = s;
+    }
+    return &s->edges[s->used++];
+}
+
+// Ready tasks go to the queue of the thread that readied them, which
+// is the one whose caches hold what the task's parents produced
+static void make_ready(graph_dyn_t *d, graph_dtask_t *t) {
+    if (d->lanes)
+        lane_priq_insert(d->lanes, t->lane, t->deadline, (pval_t)t);
+    else
+        d->qiface.insert(d->qiface.q, DTASK_KEY(t), (pval_t)t);
+}
+
+static graph_dtask_t *next_ready(graph_dyn_t *d) {
+    if (d->lanes)
+        return (graph_dtask_t *)lane_priq_delete_min(d->lanes, NULL);
+    return (graph_dtask_t *)d->qiface.delete_min(d->qiface.q);
+}
+
+void graph_dyn_attach_lanes(graph_dyn_t *d, int n_lanes, const int *weights) {
+    d->lanes = lane_priq_init(n_lanes, weights, 32);
+}
+
+static int new_task(graph_dyn_t *d, prio_t priority, int lane, uint64_t deadline,
+                    graph_dyn_fn_t fn, void *arg) {
+    long id = __sync_fetch_and_add(&d->n_tasks, 1);
+    graph_dtask_t *t;
+
+    if (id >= (long)GRAPH_DYN_MAX_CHUNKS * GRAPH_DYN_CHUNK) {
+        __sync_fetch_and_sub(&d->n_tasks, 1);
+        return -1;
+    }
+    t = &get_chunk(d, (int)(id >> GRAPH_DYN_CHUNK_BITS))[id & (GRAPH_DYN_CHUNK - 1)];
+    t->indegree = 1;
+    t->id = (int)id;
+    t->priority = priority;
+    t->children = NULL;
+    t->fn = fn;
+    t->arg = arg;
+    t->lane = lane;
+    t->deadline = deadline;
+    return (int)id;
+}
+
+int graph_dyn_add_task(graph_dyn_t *d, prio_t priority, graph_dyn_fn_t fn, void *arg) {
+    if (d->lanes)
+        return new_task(d, priority, d->lanes->n_lanes - 1, d->lanes->epoch + priority, fn, arg);
+    return new_task(d, priority, 0, 0, fn, arg);
+}
+
+int graph_dyn_add_task_lane(graph_dyn_t *d, int lane, uint64_t deadline,
+                            graph_dyn_fn_t fn, void *arg) {
+    assert(d->lanes != NULL && 0 <= lane && lane < d->lanes->n_lanes);
+    return new_task(d, 0, lane, deadline, fn, arg);
+}
+
+int graph_dyn_add_edge(graph_dyn_t *d, int parent, int child) {
+    graph_dtask_t *p = graph_dyn_task(d, parent), *c = graph_dyn_task(d, child);
+    graph_dedge_t *e, *head;
+
+    // Count the dependency before publishing it, so that a parent
+    // completing in between cannot take the child to zero early
+    __sync_fetch_and_add(&c->indegree, 1);
+    e = alloc_edge(d);
+    e->child = child;
+    do {
+        head = p->children;
+        if (head == GRAPH_DYN_CLOSED) {
+            // Parent done: nothing to wait for. The edge entry is
+            // left unused in the slab.
+            if (__sync_sub_and_fetch(&c->indegree, 1) == 0)
+                make_ready(d, c);
+            __sync_fetch_and_add(&d->n_late_edges, 1);
+            return 0;
+        }
+        e->next = head;
+    } while (!__sync_bool_compare_and_swap(&p->children, head, e));
+    __sync_fetch_and_add(&d->n_edges, 1);
+    return 1;
+}
+
+void graph_dyn_release(graph_dyn_t *d, int task_id) {
+    graph_dtask_t *t = graph_dyn_task(d, task_id);
+
+    if (__sync_sub_and_fetch(&t->indegree, 1) == 0)
+        make_ready(d, t);
+}
+
+void graph_dyn_producer_enter(graph_dyn_t *d) {
+    __sync_fetch_and_add(&d->producers, 1);
+}
+
+void graph_dyn_producer_exit(graph_dyn_t *d) {
+    __sync_fetch_and_sub(&d->producers, 1);
+}
+
+// Close the child list and release the children
+static void complete(graph_dyn_t *d, graph_dtask_t *t) {
+    graph_dedge_t *e = __sync_lock_test_and_set(&t->children, GRAPH_DYN_CLOSED);
+
+    for (; e != NULL; e = e->next) {
+        graph_dtask_t *c = graph_dyn_task(d, e->child);
+        if (__sync_sub_and_fetch(&c->indegree, 1) == 0)
+            make_ready(d, c);
+    }
+}
+
+// Nothing is left once every task handed out has completed: a task
+// adds its children before it completes, so reading n_completed first
+// never misses a task added by one of the completed ones.
+static int drained(graph_dyn_t *d) {
+    long done = d->n_completed;
+
+    __sync_synchronize();
+    return done == d->n_tasks && d->producers == 0;
+}
+
+static void *graph_dworker_run(void *_w) {
+    graph_dworker_t *w = (graph_dworker_t *)_w;
+    graph_dyn_t *d = w->d;
+    graph_dtask_t *t;
+
+#if defined(__linux__)
+    pin(gettid(), w->id % sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+    numa_priq_set_local_node(w->id);
+
+    while (!drained(d)) {
+        t = next_ready(d);
+        if (t == NULL) {
+            __asm__ __volatile__ ("pause");
+            continue;
+        }
+        if (t->fn) t->fn(d, t->id, t->arg);
+        complete(d, t);
+        w->executed++;
+        __sync_fetch_and_add(&d->n_completed, 1);
+    }
+    return NULL;
+}
+
+long graph_dyn_run(graph_dyn_t *d, int nthreads) {
+    graph_dworker_t *ws;
+    long executed = 0;
+
+    if (nthreads < 1) nthreads = 1;
+    E_en(posix_memalign((void **)&ws, CACHE_LINE_SIZE, nthreads * sizeof(graph_dworker_t)));
+    memset(ws, 0, nthreads * sizeof(graph_dworker_t));
+
+    for (int i = 0; i < nthreads; i++) {
+        ws[i].id = i;
+        ws[i].d = d;
+        E_en(pthread_create(&ws[i].thread, NULL, graph_dworker_run, &ws[i]));
+    }
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(ws[i].thread, NULL);
+        executed += ws[i].executed;
+    }
+    free(ws);
+    return executed;
+}
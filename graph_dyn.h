@@ -0,0 +1,100 @@
+#ifndef GRAPH_DYN_H
+#define GRAPH_DYN_H
+
+#include "graph_sched.h"
+#include "lane_prioq.h"
+
+// Dynamic task graphs: tasks and edges are added while the graph
+// runs, typically by the tasks themselves. Task records live in
+// chunks of GRAPH_DYN_CHUNK tasks that are allocated on demand and
+// never move, so ids and record pointers stay valid as the graph grows.
+#define GRAPH_DYN_CHUNK_BITS 16
+#define GRAPH_DYN_CHUNK      (1 << GRAPH_DYN_CHUNK_BITS)
+#define GRAPH_DYN_MAX_CHUNKS (1 << 15)
+// Edges are carved from slabs of this many entries per thread
+#define GRAPH_DYN_EDGE_SLAB  4096
+
+typedef struct graph_dyn graph_dyn_t;
+
+// Task body; it may add tasks and edges to d
+typedef void (*graph_dyn_fn_t)(graph_dyn_t *d, int task_id, void *arg);
+
+typedef struct graph_dedge {
+    int                  child;
+    struct graph_dedge  *next;
+} graph_dedge_t;
+
+// Children are pushed on a lock-free list, which the task closes when
+// it completes: an edge added after that point finds the list closed
+// and does not wait for the parent.
+#define GRAPH_DYN_CLOSED ((graph_dedge_t *)1)
+
+typedef struct graph_dtask {
+    // Unfinished parents, plus one until the creator releases the task
+    volatile int             indegree;
+    int                      id;
+    prio_t                   priority;
+    graph_dedge_t * volatile children;
+    graph_dyn_fn_t           fn;
+    void                    *arg;
+    // Service class and absolute TSC deadline, under lanes
+    int                      lane;
+    uint64_t                 deadline;
+} CACHELINE graph_dtask_t;
+
+struct graph_dyn {
+    graph_dtask_t * volatile *chunks;
+    volatile long            n_tasks;     // ids handed out
+    volatile long            n_edges;
+    volatile long            n_completed;
+    // External threads adding tasks; workers keep running until it
+    // drops to zero
+    volatile int             producers;
+    graph_queue_iface_t      qiface;
+    int                      n_nodes;
+    volatile long            n_late_edges; // edges to completed parents
+    // Edge slabs, freed with the graph, and the one each thread slot
+    // (common.h) is carving edges from
+    void * volatile          slabs;
+    void                    *cur_slab[THREAD_SLOTS];
+    // Per-class lanes, used instead of qiface when attached
+    lane_prioq_t            *lanes;
+};
+
+#define graph_dyn_task(d, id) \
+    (&(d)->chunks[(id) >> GRAPH_DYN_CHUNK_BITS][(id) & (GRAPH_DYN_CHUNK - 1)])
+
+// An empty graph. Attach a queue before adding tasks, e.g.
+// d->n_nodes = graph_queue_init_numa(&d->qiface, nodes);
+graph_dyn_t *graph_dyn_create(void);
+void         graph_dyn_destroy(graph_dyn_t *d);
+
+// New task with priority (lower first, below 2^31) and body fn(arg).
+// It is held back from running until graph_dyn_release(), so edges
+// to it can be added first. Returns its id, or -1 when full.
+int  graph_dyn_add_task(graph_dyn_t *d, prio_t priority, graph_dyn_fn_t fn, void *arg);
+// Per-class scheduling: ready tasks go to n_lanes EDF lanes shared
+// by weight (lane_prioq.h) instead of qiface. Attach before adding
+// tasks; plain graph_dyn_add_task() then uses the last lane, with
+// its priority as a deadline relative to the attach.
+void graph_dyn_attach_lanes(graph_dyn_t *d, int n_lanes, const int *weights);
+// New task in lane, due at TSC deadline. Held back as above.
+int  graph_dyn_add_task_lane(graph_dyn_t *d, int lane, uint64_t deadline,
+                             graph_dyn_fn_t fn, void *arg);
+// Make child wait for parent. Returns 1, or 0 if the parent has
+// already completed, in which case nothing is added. Safe at any time
+// before child has started: hold it (see graph_dyn_add_task) meanwhile.
+int  graph_dyn_add_edge(graph_dyn_t *d, int parent, int child);
+// Drop the creation hold of a task
+void graph_dyn_release(graph_dyn_t *d, int task_id);
+
+// Bracket additions from threads that are not running a task
+void graph_dyn_producer_enter(graph_dyn_t *d);
+void graph_dyn_producer_exit(graph_dyn_t *d);
+
+// Run on nthreads pinned workers until every task added, including
+// those added during the run, has completed and no producer is left.
+// Returns the number of tasks executed.
+long graph_dyn_run(graph_dyn_t *d, int nthreads);
+
+#endif
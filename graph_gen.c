@@ -0,0 +1,372 @@
+/**
+ * Task graph generators.
+ *
+ * Every generator defines the children of task i as a function of i
+ * and a per-task random stream derived from the seed, so a graph only
+ * depends on its parameters, not on the number of threads building it.
+ * Construction runs in two parallel passes over ranges of tasks: the
+ * first counts children into offsets, the second (after a prefix sum)
+ * writes the edges and increments the children's indegrees. Task ids
+ * are a topological order in every generator.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "graph_sched.h"
+#include "common.h"
+
+// Largest fan-out drawn by the power-law generator
+#define GEN_MAX_FANOUT 4096
+
+typedef struct gen {
+    graph_gen_kind_t kind;
+    int           n;
+    int           degree;
+    uint64_t      seed;
+    int           width;        // layered, wavefront
+    int           m;            // fork-join: size of the fork tree
+    int           tiles;        // cholesky, lu
+    long         *step_start;   // cholesky, lu: first task of each step
+    int           max_fanout;   // bound on children() before dedup
+} gen_t;
+
+typedef struct gen_worker {
+    pthread_t      thread;
+    const gen_t   *g;
+    graph_sched_t *gs;
+    int            lo, hi;
+    int            pass;
+    int           *scratch;
+} gen_worker_t;
+
+static const char *gen_names[] = {
+    [GRAPH_GEN_RANDOM]    = "random",
+    [GRAPH_GEN_LAYERED]   = "layered",
+    [GRAPH_GEN_WAVEFRONT] = "wavefront",
+    [GRAPH_GEN_FORKJOIN]  = "forkjoin",
+    [GRAPH_GEN_CHOLESKY]  = "cholesky",
+    [GRAPH_GEN_LU]        = "lu",
+    [GRAPH_GEN_POWERLAW]  = "powerlaw",
+};
+
+int graph_sched_parse_gen(const char *name, graph_gen_kind_t *kind) {
+    for (int i = 0; i < sizeof(gen_names) / sizeof(gen_names[0]); i++) {
+        if (strcmp(name, gen_names[i]) == 0) {
+            *kind = (graph_gen_kind_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// splitmix64: seeded per task, so streams do not depend on scheduling
+static inline uint64_t gen_rand(uint64_t *s) {
+    uint64_t z = (*s += 0x9e3779b97f4a7c15UL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+    return z ^ (z >> 31);
+}
+
+static int int_cmp(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+// Sort and drop duplicates
+static int sort_unique(int *out, int cnt) {
+    int k = 0;
+
+    if (cnt <= 16) {
+        for (int i = 1; i < cnt; i++) {
+            int v = out[i], j = i;
+            while (j > 0 && out[j - 1] > v) {
+                out[j] = out[j - 1];
+                j--;
+            }
+            out[j] = v;
+        }
+    } else {
+        qsort(out, cnt, sizeof(int), int_cmp);
+    }
+    for (int i = 0; i < cnt; i++) {
+        if (k == 0 || out[k - 1] != out[i]) out[k++] = out[i];
+    }
+    return k;
+}
+
+// Tiled factorisations: number of tasks in a step with m trailing tiles
+static long chol_step(long m) { return 1 + 2 * m + m * (m - 1) / 2; }
+static long lu_step(long m)   { return 1 + 2 * m + m * m; }
+
+// Task ids of the Cholesky kernels at step k (m = tiles - k - 1)
+#define CHOL_POTRF(g, k)       ((g)->step_start[k])
+#define CHOL_TRSM(g, i, k)     ((g)->step_start[k] + 1 + ((i) - (k) - 1))
+#define CHOL_SYRK(g, i, k)     ((g)->step_start[k] + 1 + ((g)->tiles - (k) - 1) + ((i) - (k) - 1))
+#define CHOL_GEMM(g, i, j, k)  ((g)->step_start[k] + 1 + 2L * ((g)->tiles - (k) - 1) + \
+                                (long)((i) - (k) - 1) * ((i) - (k) - 2) / 2 + ((j) - (k) - 1))
+// and of the LU kernels
+#define LU_GETRF(g, k)         ((g)->step_start[k])
+#define LU_ROW(g, k, j)        ((g)->step_start[k] + 1 + ((j) - (k) - 1))
+#define LU_COL(g, i, k)        ((g)->step_start[k] + 1 + ((g)->tiles - (k) - 1) + ((i) - (k) - 1))
+#define LU_GEMM(g, i, j, k)    ((g)->step_start[k] + 1 + 2L * ((g)->tiles - (k) - 1) + \
+                                (long)((i) - (k) - 1) * ((g)->tiles - (k) - 1) + ((j) - (k) - 1))
+
+// Step of task i, and its offset within the step
+static int tile_step(const gen_t *g, long i, long *o) {
+    int lo = 0, hi = g->tiles - 1;
+
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (g->step_start[mid] <= i) lo = mid; else hi = mid - 1;
+    }
+    *o = i - g->step_start[lo];
+    return lo;
+}
+
+// Right-looking tiled Cholesky: POTRF(k), TRSM(i,k) and SYRK(i,k) for
+// i > k, GEMM(i,j,k) for i > j > k. Edges follow the tile updates.
+static int chol_children(const gen_t *g, long id, int *out) {
+    int T = g->tiles, cnt = 0, k, i, j, a;
+    long o, m, x;
+
+    k = tile_step(g, id, &o);
+    m = T - k - 1;
+    if (o == 0) {
+        for (i = k + 1; i < T; i++)
+            out[cnt++] = CHOL_TRSM(g, i, k);
+    } else if (o < 1 + m) {
+        i = k + 1 + (o - 1);
+        out[cnt++] = CHOL_SYRK(g, i, k);
+        for (j = k + 1; j < i; j++)
+            out[cnt++] = CHOL_GEMM(g, i, j, k);
+        for (int i2 = i + 1; i2 < T; i2++)
+            out[cnt++] = CHOL_GEMM(g, i2, i, k);
+    } else if (o < 1 + 2 * m) {
+        i = k + 1 + (o - 1 - m);
+        out[cnt++] = i == k + 1 ? CHOL_POTRF(g, i) : CHOL_SYRK(g, i, k + 1);
+    } else {
+        x = o - 1 - 2 * m;
+        a = (int)((1 + sqrt(1 + 8.0 * x)) / 2);
+        while ((long)a * (a - 1) / 2 > x) a--;
+        while ((long)(a + 1) * a / 2 <= x) a++;
+        i = k + 1 + a;
+        j = k + 1 + (int)(x - (long)a * (a - 1) / 2);
+        out[cnt++] = j == k + 1 ? CHOL_TRSM(g, i, k + 1) : CHOL_GEMM(g, i, j, k + 1);
+    }
+    return cnt;
+}
+
+// Tiled LU without pivoting: GETRF(k), ROW(k,j) for j > k, COL(i,k)
+// for i > k, GEMM(i,j,k) for i, j > k.
+static int lu_children(const gen_t *g, long id, int *out) {
+    int T = g->tiles, cnt = 0, k, i, j;
+    long o, m, x;
+
+    k = tile_step(g, id, &o);
+    m = T - k - 1;
+    if (o == 0) {
+        for (j = k + 1; j < T; j++)
+            out[cnt++] = LU_ROW(g, k, j);
+        for (i = k + 1; i < T; i++)
+            out[cnt++] = LU_COL(g, i, k);
+    } else if (o < 1 + m) {
+        j = k + 1 + (o - 1);
+        for (i = k + 1; i < T; i++)
+            out[cnt++] = LU_GEMM(g, i, j, k);
+    } else if (o < 1 + 2 * m) {
+        i = k + 1 + (o - 1 - m);
+        for (j = k + 1; j < T; j++)
+            out[cnt++] = LU_GEMM(g, i, j, k);
+    } else {
+        x = o - 1 - 2 * m;
+        i = k + 1 + (int)(x / m);
+        j = k + 1 + (int)(x % m);
+        // next update of tile (i, j)
+        if (i == k + 1 && j == k + 1)
+            out[cnt++] = LU_GETRF(g, k + 1);
+        else if (i == k + 1)
+            out[cnt++] = LU_ROW(g, k + 1, j);
+        else if (j == k + 1)
+            out[cnt++] = LU_COL(g, i, k + 1);
+        else
+            out[cnt++] = LU_GEMM(g, i, j, k + 1);
+    }
+    return cnt;
+}
+
+// Children of task i, sorted, written to out (max_fanout entries)
+static int children(const gen_t *g, int i, int *out) {
+    uint64_t s = g->seed ^ ((uint64_t)i * 0xd1b54a32d192ed03UL);
+    int n = g->n, d = g->degree, cnt = 0, range = n - i - 1;
+
+    switch (g->kind) {
+    case GRAPH_GEN_RANDOM:
+    case GRAPH_GEN_POWERLAW:
+        if (range <= 0) return 0;
+        if (g->kind == GRAPH_GEN_POWERLAW) {
+            // Pareto, alpha = 2: P(fan-out > x) = (d / 2x)^2, mean d
+            double u = ((gen_rand(&s) >> 11) + 1) * (1.0 / 9007199254740992.0);
+            d = (int)min(d / 2.0 / sqrt(u), (double)g->max_fanout);
+        }
+        for (int j = 0; j < d; j++)
+            out[cnt++] = i + 1 + (int)(gen_rand(&s) % range);
+        return sort_unique(out, cnt);
+
+    case GRAPH_GEN_LAYERED: {
+        // d nearest tasks of the next layer, wrapping around
+        int w = g->width, next = (i / w + 1) * w;
+        int wn = min(w, n - next), c;
+        if (next >= n) return 0;
+        c = (int)((long)(i % w) * wn / w);
+        d = min(d, wn);
+        for (int j = 0; j < d; j++)
+            out[cnt++] = next + ((c + j - d / 2) % wn + wn) % wn;
+        return sort_unique(out, cnt);
+    }
+
+    case GRAPH_GEN_WAVEFRONT:
+        // grid cell (r, c) enables (r, c + 1) and (r + 1, c)
+        if (i % g->width + 1 < g->width && i + 1 < n) out[cnt++] = i + 1;
+        if (i + g->width < n) out[cnt++] = i + g->width;
+        return cnt;
+
+    case GRAPH_GEN_FORKJOIN: {
+        // Fork tree 0 .. m-1 as a d-ary heap; the join of fork node f
+        // is task 2m - 1 - f, and waits for the joins of f's children.
+        int m = g->m;
+        if (i < m) {
+            if ((long)d * i + 1 >= m) {
+                out[cnt++] = 2 * m - 1 - i;
+            } else {
+                for (long c = (long)d * i + 1; c <= (long)d * i + d && c < m; c++)
+                    out[cnt++] = (int)c;
+            }
+        } else if (i < 2 * m - 1) {
+            out[cnt++] = 2 * m - 1 - (2 * m - 1 - i - 1) / d;
+        }
+        return cnt;
+    }
+
+    case GRAPH_GEN_CHOLESKY:
+        return sort_unique(out, chol_children(g, i, out));
+
+    case GRAPH_GEN_LU:
+        return sort_unique(out, lu_children(g, i, out));
+    }
+    return 0;
+}
+
+static void *gen_worker_run(void *_w) {
+    gen_worker_t *w = (gen_worker_t *)_w;
+    graph_sched_t *gs = w->gs;
+    int cnt;
+
+    for (int i = w->lo; i < w->hi; i++) {
+        cnt = children(w->g, i, w->scratch);
+        if (w->pass == 0) {
+            gs->offsets[i + 1] = cnt;
+            continue;
+        }
+        memcpy(&gs->edges[gs->offsets[i]], w->scratch, cnt * sizeof(int));
+        for (int j = 0; j < cnt; j++)
+            __sync_fetch_and_add(&gs->tasks[w->scratch[j]].indegree, 1);
+        gs->tasks[i].priority = (prio_t)i;
+    }
+    return NULL;
+}
+
+static void gen_pass(gen_worker_t *ws, int nthreads, int pass) {
+    for (int t = 0; t < nthreads; t++) {
+        ws[t].pass = pass;
+        E_en(pthread_create(&ws[t].thread, NULL, gen_worker_run, &ws[t]));
+    }
+    for (int t = 0; t < nthreads; t++)
+        pthread_join(ws[t].thread, NULL);
+}
+
+// Shape parameters of the generator; fixes the exact task count
+static void gen_setup(gen_t *g) {
+    long total;
+
+    g->max_fanout = max(g->degree, 2);
+    switch (g->kind) {
+    case GRAPH_GEN_LAYERED:
+    case GRAPH_GEN_WAVEFRONT:
+        g->width = max((int)ceil(sqrt((double)g->n)), 1);
+        break;
+    case GRAPH_GEN_FORKJOIN:
+        g->degree = max(g->degree, 2);
+        g->m = max(g->n / 2, 1);
+        g->n = 2 * g->m;
+        break;
+    case GRAPH_GEN_CHOLESKY:
+    case GRAPH_GEN_LU:
+        // largest tile count that stays within n tasks
+        g->tiles = 1;
+        for (;;) {
+            int T = g->tiles + 1;
+            total = 0;
+            for (int k = 0; k < T; k++)
+                total += g->kind == GRAPH_GEN_LU ? lu_step(T - k - 1) : chol_step(T - k - 1);
+            if (total > g->n) break;
+            g->tiles = T;
+        }
+        E_NULL(g->step_start = (long *)malloc((g->tiles + 1) * sizeof(long)));
+        g->step_start[0] = 0;
+        for (int k = 0; k < g->tiles; k++) {
+            long m = g->tiles - k - 1;
+            g->step_start[k + 1] = g->step_start[k] +
+                (g->kind == GRAPH_GEN_LU ? lu_step(m) : chol_step(m));
+        }
+        g->n = (int)g->step_start[g->tiles];
+        g->max_fanout = 2 * g->tiles + 1;
+        break;
+    case GRAPH_GEN_POWERLAW:
+        g->max_fanout = GEN_MAX_FANOUT;
+        break;
+    default:
+        break;
+    }
+}
+
+graph_sched_t *graph_sched_generate(graph_gen_kind_t kind, int n_tasks, int degree,
+                                    unsigned long seed, int nthreads) {
+    graph_sched_t *gs;
+    gen_worker_t *ws;
+    gen_t g = { .kind = kind, .n = n_tasks, .degree = max(degree, 0), .seed = seed };
+    int n;
+
+    if (n_tasks < 1) return NULL;
+    if (nthreads < 1) nthreads = 1;
+    gen_setup(&g);
+    n = g.n;
+
+    E_NULL(gs = (graph_sched_t *)calloc(1, sizeof(graph_sched_t)));
+    gs->n_tasks = n;
+    gs->tasks = graph_sched_alloc_tasks(n);
+    E_NULL(gs->offsets = (long *)calloc(n + 1, sizeof(long)));
+
+    E_NULL(ws = (gen_worker_t *)calloc(nthreads, sizeof(gen_worker_t)));
+    for (int t = 0; t < nthreads; t++) {
+        ws[t].g = &g;
+        ws[t].gs = gs;
+        ws[t].lo = (int)((long)n * t / nthreads);
+        ws[t].hi = (int)((long)n * (t + 1) / nthreads);
+        E_NULL(ws[t].scratch = (int *)malloc(g.max_fanout * sizeof(int)));
+    }
+
+    gen_pass(ws, nthreads, 0);
+    for (int i = 0; i < n; i++)
+        gs->offsets[i + 1] += gs->offsets[i];
+    gs->n_edges = gs->offsets[n];
+    E_NULL(gs->edges = (int *)malloc((gs->n_edges + 1) * sizeof(int)));
+    gen_pass(ws, nthreads, 1);
+
+    for (int t = 0; t < nthreads; t++)
+        free(ws[t].scratch);
+    free(ws);
+    free(g.step_start);
+    graph_sched_snapshot(gs);
+    return gs;
+}
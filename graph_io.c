@@ -0,0 +1,384 @@
+/**
+ * Loading and saving task graphs.
+ *
+ * Text edge lists are parsed in parallel slices and turned into CSR
+ * with a counting sort on the parent id. The binary format holds the
+ * CSR arrays as graph_sched_t uses them, so loading one only maps the
+ * file: offsets and edges point straight into the mapping, and only the
+ * (mutable) indegree counters are copied into task records.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "graph_sched.h"
+#include "common.h"
+
+// Edge list loading runs in passes over per-thread state: parse a
+// slice of the text into private edge buffers, count parents and
+// children with atomic adds, then (after a prefix sum) scatter the
+// edges into CSR and sort each task's children.
+typedef struct load_worker {
+    pthread_t      thread;
+    const char    *path;
+    const char    *lo, *hi;     // text slice, whole lines
+    int           *src, *dst;   // parsed edges
+    long           n, cap;
+    int            max_id;
+    graph_sched_t *gs;
+    long          *fill;        // next free edge slot of each task
+    int            first, last; // tasks sorted in the last pass
+    int            pass;
+} load_worker_t;
+
+// Non-negative decimal id; -1 if there is none, -2 if out of range.
+// Unlike strtol, never skips past the end of the line.
+static long parse_id(const char **pp) {
+    const char *p = *pp;
+    long v = 0;
+
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p < '0' || *p > '9') return *p == '-' ? -2 : -1;
+    while (*p >= '0' && *p <= '9') {
+        if (v < INT32_MAX) v = v * 10 + (*p - '0');
+        p++;
+    }
+    *pp = p;
+    return v >= INT32_MAX ? -2 : v;
+}
+
+static void load_parse(load_worker_t *w) {
+    const char *p = w->lo, *q, *line;
+    long s, d;
+
+    w->cap = 1 << 16;
+    E_NULL(w->src = (int *)malloc(w->cap * sizeof(int)));
+    E_NULL(w->dst = (int *)malloc(w->cap * sizeof(int)));
+    w->max_id = -1;
+    for (; p < w->hi; p = q + 1) {
+        if ((q = memchr(p, '\n', w->hi - p)) == NULL) q = w->hi;
+        line = p;
+        if (*p == '#' || *p == '%') continue;
+        if ((s = parse_id(&p)) == -1) continue;
+        d = s >= 0 ? parse_id(&p) : -2;
+        if (s < 0 || d < 0) {
+            fprintf(stderr, "%s: invalid edge %.*s\n", w->path, (int)(q - line), line);
+            continue;
+        }
+        if (w->n == w->cap) {
+            w->cap *= 2;
+            E_NULL(w->src = (int *)realloc(w->src, w->cap * sizeof(int)));
+            E_NULL(w->dst = (int *)realloc(w->dst, w->cap * sizeof(int)));
+        }
+        w->src[w->n] = (int)s;
+        w->dst[w->n] = (int)d;
+        w->n++;
+        w->max_id = max(w->max_id, (int)max(s, d));
+    }
+}
+
+static int id_cmp(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+static void *load_worker_run(void *_w) {
+    load_worker_t *w = (load_worker_t *)_w;
+    graph_sched_t *gs = w->gs;
+
+    switch (w->pass) {
+    case 0:
+        load_parse(w);
+        break;
+    case 1:
+        for (long i = 0; i < w->n; i++) {
+            __sync_fetch_and_add(&gs->offsets[w->src[i] + 1], 1);
+            __sync_fetch_and_add(&gs->tasks[w->dst[i]].indegree, 1);
+        }
+        break;
+    case 2:
+        for (long i = 0; i < w->n; i++)
+            gs->edges[__sync_fetch_and_add(&w->fill[w->src[i]], 1)] = w->dst[i];
+        break;
+    case 3:
+        // Scatter order depends on the threads, sorted lists do not
+        for (int i = w->first; i < w->last; i++) {
+            qsort(&gs->edges[gs->offsets[i]], graph_sched_n_deps(gs, i), sizeof(int), id_cmp);
+            gs->tasks[i].priority = (prio_t)i;
+        }
+        break;
+    }
+    return NULL;
+}
+
+static void load_pass(load_worker_t *ws, int nthreads, int pass) {
+    for (int t = 0; t < nthreads; t++) {
+        ws[t].pass = pass;
+        E_en(pthread_create(&ws[t].thread, NULL, load_worker_run, &ws[t]));
+    }
+    for (int t = 0; t < nthreads; t++)
+        pthread_join(ws[t].thread, NULL);
+}
+
+graph_sched_t *graph_sched_load_edgelist(const char *path, int nthreads) {
+    graph_sched_t *gs;
+    load_worker_t *ws;
+    FILE *f;
+    char *text;
+    long size, n_edges = 0, *fill;
+    int n_tasks = 0;
+
+    if ((f = fopen(path, "r")) == NULL) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    E_NULL(text = (char *)malloc(size + 1));
+    if ((long)fread(text, 1, size, f) != size) {
+        perror(path);
+        fclose(f);
+        free(text);
+        return NULL;
+    }
+    text[size] = '\0';
+    fclose(f);
+
+    // Slices start after the line end nearest to an even split
+    if (nthreads < 1) nthreads = 1;
+    E_NULL(ws = (load_worker_t *)calloc(nthreads, sizeof(load_worker_t)));
+    for (int t = 0; t < nthreads; t++) {
+        const char *p = text + size * t / nthreads, *nl;
+        if (t > 0) p = (nl = memchr(p - 1, '\n', text + size - (p - 1))) ? nl + 1 : text + size;
+        ws[t].lo = p;
+        ws[t].path = path;
+        if (t > 0) ws[t - 1].hi = p;
+    }
+    ws[nthreads - 1].hi = text + size;
+    load_pass(ws, nthreads, 0);
+    free(text);
+
+    for (int t = 0; t < nthreads; t++) {
+        n_edges += ws[t].n;
+        n_tasks = max(n_tasks, ws[t].max_id + 1);
+    }
+
+    E_NULL(gs = (graph_sched_t *)calloc(1, sizeof(graph_sched_t)));
+    gs->n_tasks = n_tasks;
+    gs->n_edges = n_edges;
+    gs->tasks = graph_sched_alloc_tasks(n_tasks);
+    E_NULL(gs->offsets = (long *)calloc(n_tasks + 1, sizeof(long)));
+    E_NULL(gs->edges = (int *)malloc((n_edges + 1) * sizeof(int)));
+    for (int t = 0; t < nthreads; t++) {
+        ws[t].gs = gs;
+        ws[t].first = (int)((long)n_tasks * t / nthreads);
+        ws[t].last = (int)((long)n_tasks * (t + 1) / nthreads);
+    }
+
+    // Counting sort on the parent id
+    load_pass(ws, nthreads, 1);
+    for (int i = 0; i < n_tasks; i++)
+        gs->offsets[i + 1] += gs->offsets[i];
+    E_NULL(fill = (long *)malloc((n_tasks + 1) * sizeof(long)));
+    memcpy(fill, gs->offsets, (n_tasks + 1) * sizeof(long));
+    for (int t = 0; t < nthreads; t++)
+        ws[t].fill = fill;
+    load_pass(ws, nthreads, 2);
+    load_pass(ws, nthreads, 3);
+
+    free(fill);
+    for (int t = 0; t < nthreads; t++) {
+        free(ws[t].src);
+        free(ws[t].dst);
+    }
+    free(ws);
+    graph_sched_snapshot(gs);
+    return gs;
+}
+
+int graph_file_section_ok(uint64_t pos, uint64_t count, size_t elem, uint64_t size) {
+    return pos <= size && pos % elem == 0 && count <= (size - pos) / elem;
+}
+
+// The sections must describe a graph: offsets from 0 to n_edges in
+// order, edge ids in range and indegrees that match the edges. NULL if
+// they do, else what is wrong.
+static const char *check_csr(const graph_file_hdr_t *hdr, const void *map) {
+    const long *offsets = (const long *)((const char *)map + hdr->offsets_pos);
+    const int *edges = (const int *)((const char *)map + hdr->edges_pos);
+    const int32_t *indegree = (const int32_t *)((const char *)map + hdr->indegree_pos);
+    long n = (long)hdr->n_tasks, m = (long)hdr->n_edges;
+    const char *err = NULL;
+    int32_t *count;
+
+    if (offsets[0] != 0 || offsets[n] != m) return "offsets do not span the edges";
+    for (long i = 0; i < n; i++)
+        if (offsets[i + 1] < offsets[i]) return "offsets out of order";
+
+    E_NULL(count = (int32_t *)calloc(n + 1, sizeof(int32_t)));
+    for (long e = 0; e < m && !err; e++) {
+        if (edges[e] < 0 || edges[e] >= n)
+            err = "edge to a task out of range";
+        else
+            count[edges[e]]++;
+    }
+    for (long i = 0; i < n && !err; i++)
+        if (count[i] != indegree[i]) err = "indegrees do not match the edges";
+    free(count);
+    return err;
+}
+
+graph_sched_t *graph_sched_load_csr(const char *path) {
+    graph_sched_t *gs;
+    graph_file_hdr_t *hdr;
+    struct stat st;
+    const int32_t *indegree;
+    const char *err;
+    void *map;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        perror(path);
+        return NULL;
+    }
+    E(fstat(fd, &st));
+    if ((size_t)st.st_size < sizeof(graph_file_hdr_t)) {
+        fprintf(stderr, "%s: not a graph file\n", path);
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    hdr = (graph_file_hdr_t *)map;
+    if (hdr->id_bytes == sizeof(int64_t)) {
+        fprintf(stderr, "%s: 64-bit ids, only streamed (graph_stream.h)\n", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    if (memcmp(hdr->magic, GRAPH_FILE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != GRAPH_FILE_VERSION || hdr->id_bytes != sizeof(int) ||
+        hdr->n_tasks >= INT32_MAX ||
+        !graph_file_section_ok(hdr->offsets_pos, hdr->n_tasks + 1, sizeof(long), st.st_size) ||
+        !graph_file_section_ok(hdr->edges_pos, hdr->n_edges, sizeof(int), st.st_size) ||
+        !graph_file_section_ok(hdr->indegree_pos, hdr->n_tasks, sizeof(int32_t), st.st_size)) {
+        fprintf(stderr, "%s: unsupported or corrupt graph file\n", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    if ((err = check_csr(hdr, map)) != NULL) {
+        fprintf(stderr, "%s: corrupt graph file: %s\n", path, err);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    E_NULL(gs = (graph_sched_t *)calloc(1, sizeof(graph_sched_t)));
+    gs->map = map;
+    gs->map_len = st.st_size;
+    gs->n_tasks = (int)hdr->n_tasks;
+    gs->n_edges = (long)hdr->n_edges;
+    gs->offsets = (long *)((char *)map + hdr->offsets_pos);
+    gs->edges = (int *)((char *)map + hdr->edges_pos);
+
+    // Counters are written during a run, so they get their own copy
+    indegree = (const int32_t *)((char *)map + hdr->indegree_pos);
+    gs->tasks = graph_sched_alloc_tasks(gs->n_tasks);
+    for (int i = 0; i < gs->n_tasks; i++) {
+        gs->tasks[i].indegree = indegree[i];
+        gs->tasks[i].priority = (prio_t)i;
+    }
+    graph_sched_snapshot(gs);
+    return gs;
+}
+
+graph_sched_t *graph_sched_load(const char *path, int nthreads) {
+    char magic[8] = {0};
+    FILE *f;
+
+    if ((f = fopen(path, "r")) == NULL) {
+        perror(path);
+        return NULL;
+    }
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic)) {
+        // Too short for a header, maybe a tiny edge list
+    }
+    fclose(f);
+    if (memcmp(magic, GRAPH_FILE_MAGIC, sizeof(magic)) == 0)
+        return graph_sched_load_csr(path);
+    return graph_sched_load_edgelist(path, nthreads);
+}
+
+static int write_at(FILE *f, uint64_t pos, const void *buf, size_t len) {
+    if (fseeko(f, (off_t)pos, SEEK_SET) != 0) return -1;
+    return fwrite(buf, 1, len, f) == len ? 0 : -1;
+}
+
+// Edges widened to 64-bit ids, a chunk at a time
+static int write_wide_edges(FILE *f, uint64_t pos, const int *edges, long n) {
+    int64_t buf[4096];
+    long k;
+
+    if (fseeko(f, (off_t)pos, SEEK_SET) != 0) return -1;
+    for (long i = 0; i < n; i += k) {
+        k = min(n - i, 4096L);
+        for (long j = 0; j < k; j++)
+            buf[j] = edges[i + j];
+        if (fwrite(buf, sizeof(int64_t), k, f) != (size_t)k) return -1;
+    }
+    return 0;
+}
+
+int graph_sched_save_csr(graph_sched_t *gs, const char *path) {
+    return graph_sched_save_csr_ids(gs, path, sizeof(int));
+}
+
+int graph_sched_save_csr_ids(graph_sched_t *gs, const char *path, int id_bytes) {
+    graph_file_hdr_t hdr;
+    int32_t *indegree;
+    FILE *f;
+    int rc = 0;
+
+    if (id_bytes != sizeof(int) && id_bytes != sizeof(int64_t)) return -1;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, GRAPH_FILE_MAGIC, sizeof(hdr.magic));
+    hdr.version = GRAPH_FILE_VERSION;
+    hdr.id_bytes = id_bytes;
+    hdr.n_tasks = gs->n_tasks;
+    hdr.n_edges = gs->n_edges;
+    hdr.offsets_pos = GRAPH_FILE_ALIGN(sizeof(hdr));
+    hdr.edges_pos = GRAPH_FILE_ALIGN(hdr.offsets_pos + (hdr.n_tasks + 1) * sizeof(long));
+    hdr.indegree_pos = GRAPH_FILE_ALIGN(hdr.edges_pos + hdr.n_edges * id_bytes);
+
+    // The task records may be mid-run, so indegrees come from the edges
+    E_NULL(indegree = (int32_t *)calloc(gs->n_tasks + 1, sizeof(int32_t)));
+    for (long i = 0; i < gs->n_edges; i++) {
+        indegree[gs->edges[i]]++;
+    }
+
+    if ((f = fopen(path, "w")) == NULL) {
+        perror(path);
+        free(indegree);
+        return -1;
+    }
+    if (write_at(f, 0, &hdr, sizeof(hdr)) ||
+        write_at(f, hdr.offsets_pos, gs->offsets, (hdr.n_tasks + 1) * sizeof(long)) ||
+        (id_bytes == sizeof(int) ?
+         write_at(f, hdr.edges_pos, gs->edges, hdr.n_edges * sizeof(int)) :
+         write_wide_edges(f, hdr.edges_pos, gs->edges, gs->n_edges)) ||
+        write_at(f, hdr.indegree_pos, indegree, hdr.n_tasks * sizeof(int32_t))) {
+        perror(path);
+        rc = -1;
+    }
+    if (fclose(f) != 0) rc = -1;
+    free(indegree);
+    return rc;
+}
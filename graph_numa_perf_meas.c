@@ -6,12 +6,60 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include "gc/gc.h"
 #include "common.h"
 #include "graph_sched.h"
 #include "numa_prioq.h"
 
+// Simulated task execution. Each task reads the output buffers of its
+// parents, writes its own, then spins for the rest of its cost.
+typedef struct task_ctx {
+    long   *cost;      // cycles per task, or NULL
+    char   *bufs;      // n_tasks output buffers of bytes each, or NULL
+    long    bytes;
+    long   *pstart;    // parents of i: parents[pstart[i]] .. parents[pstart[i + 1] - 1]
+    int    *parents;
+} task_ctx_t;
+
+static void spin_task(graph_sched_t *gs, int task_id, void *arg) {
+    task_ctx_t *ctx = (task_ctx_t *)arg;
+    uint64_t until = read_tsc_p() + (ctx->cost ? ctx->cost[task_id] : 0);
+    long sum = task_id;
+
+    if (ctx->bufs) {
+        for (long k = ctx->pstart[task_id]; k < ctx->pstart[task_id + 1]; k++) {
+            const long *in = (const long *)(ctx->bufs + ctx->parents[k] * ctx->bytes);
+            for (long j = 0; j < ctx->bytes / (long)sizeof(long); j++)
+                sum += in[j];
+        }
+        long *out = (long *)(ctx->bufs + task_id * ctx->bytes);
+        for (long j = 0; j < ctx->bytes / (long)sizeof(long); j++)
+            out[j] = sum + j;
+    }
+    while (read_tsc_p() < until)
+        ;
+}
+
+// Parent lists, the transpose of the graph's CSR
+static void build_parents(graph_sched_t *gs, task_ctx_t *ctx) {
+    int n = gs->n_tasks;
+
+    E_NULL(ctx->pstart = (long *)calloc(n + 1, sizeof(long)));
+    E_NULL(ctx->parents = (int *)malloc((gs->n_edges + 1) * sizeof(int)));
+    for (long k = 0; k < gs->n_edges; k++)
+        ctx->pstart[gs->edges[k] + 1]++;
+    for (int i = 0; i < n; i++)
+        ctx->pstart[i + 1] += ctx->pstart[i];
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < graph_sched_n_deps(gs, i); j++)
+            ctx->parents[ctx->pstart[graph_sched_deps(gs, i)[j]]++] = i;
+    }
+    memmove(ctx->pstart + 1, ctx->pstart, n * sizeof(long));
+    ctx->pstart[0] = 0;
+}
+
 int main(int argc, char **argv) {
     int n_tasks, edges_per_task, nthreads, num_nodes;
     graph_sched_t *gs;
@@ -19,65 +67,183 @@ int main(int argc, char **argv) {
     long tasks_executed = 0;
     long pq_ops = 0;
     double dt;
+    char *queue = "numa";
+    char *file = NULL;
+    char *place = "local";
+    int bypass = 0;
+    char *gen_name = "random";
+    graph_gen_kind_t gen;
+    unsigned long gen_seed = GRAPH_GEN_SEED;
+    double build_dt;
+    task_ctx_t ctx = { 0 };
+    long work = 0;
+    long *cost = NULL, *rank, cp;
+    double total_work = 0;
+    uint64_t mk_start, makespan;
+    char *policy_name = "user";
+    graph_prio_policy_t policy;
+    unsigned int seed = 0;
+    graph_queue_opts_t qopts = { 0 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "q:w:f:p:a:b:sg:S:")) >= 0) {
+        switch (opt) {
+        case 'g': gen_name = optarg; break;
+        case 'S': gen_seed = strtoul(optarg, NULL, 0); break;
+        case 's': bypass = 1; break;
+        case 'a': place = optarg; break;
+        case 'b': ctx.bytes = atol(optarg) & ~(long)(sizeof(long) - 1); break;
+        case 'p': policy_name = optarg; break;
+        case 'f': file = optarg; break;
+        case 'q': queue = optarg; break;
+        case 'w': work = atol(optarg); break;
+        }
+    }
 
-    if (argc != 5) {
-        fprintf(stderr, "Usage: %s <threads> <num_nodes> <n_tasks> <edges_per_task>\n", argv[0]);
+    if (argc - optind != (file ? 2 : 4) ||
+        graph_queue_find(queue) == NULL ||
+        graph_sched_parse_policy(policy_name, &policy) < 0 ||
+        graph_sched_parse_gen(gen_name, &gen) < 0 ||
+        (strcmp(place, "local") != 0 && strcmp(place, "spread") != 0 &&
+         strcmp(place, "queue") != 0)) {
+        fprintf(stderr, "Usage: %s [-q queue] [-w cycles] [-p user|fifo|lifo|rank] [-a local|spread|queue] [-b bytes] [-s] [-g gen] [-S seed] <threads> <num_nodes> <n_tasks> <edges_per_task>\n", argv[0]);
+        fprintf(stderr, "       %s [-q queue] [-w cycles] [-p user|fifo|lifo|rank] [-a local|spread|queue] [-b bytes] [-s] -f <graph file> <threads> <num_nodes>\n", argv[0]);
+        fprintf(stderr, "  -q  ready queue (default numa):");
+        for (const graph_queue_backend_t *b = graph_queue_backends; b->name; b++)
+            fprintf(stderr, " %s", b->name);
+        fprintf(stderr, "\n");
+        fprintf(stderr, "  -a  placement of ready children (default local)\n");
+        fprintf(stderr, "  -b  output buffer per task, read by its children\n");
+        fprintf(stderr, "  -s  run a ready child directly when it is not behind the queue head\n");
+        fprintf(stderr, "  -g  generator: random, layered, wavefront, forkjoin, cholesky, lu or powerlaw\n");
+        fprintf(stderr, "  -S  generator seed (default %d)\n", GRAPH_GEN_SEED);
         exit(EXIT_FAILURE);
     }
 
-    nthreads = atoi(argv[1]);
-    num_nodes = atoi(argv[2]);
-    n_tasks = atoi(argv[3]);
-    edges_per_task = atoi(argv[4]);
+    nthreads = atoi(argv[optind]);
+    num_nodes = atoi(argv[optind + 1]);
+    if (!file) {
+        n_tasks = atoi(argv[optind + 2]);
+        edges_per_task = atoi(argv[optind + 3]);
+    }
 
     _init_gc_subsystem();
 
-    // Create graph with NUMA-sharded queue
-    gs = graph_sched_create_random_numa(n_tasks, edges_per_task, num_nodes);
+    // Load or generate the graph, in parallel on the worker threads
+    gettime(&start);
+    if (file)
+        gs = graph_sched_load(file, nthreads);
+    else
+        gs = graph_sched_generate(gen, n_tasks, edges_per_task, gen_seed, nthreads);
     if (!gs) {
         fprintf(stderr, "Failed to create graph scheduler\n");
         exit(EXIT_FAILURE);
     }
+    gettime(&end);
+    elapsed = timediff(start, end);
+    build_dt = elapsed.tv_sec + (double)elapsed.tv_nsec / 1000000000.0;
+    n_tasks = gs->n_tasks;
+    edges_per_task = gs->n_edges / n_tasks;
 
-    // Measure initial enqueues
-    graph_sched_init_ready(gs);
-    for (int i = 0; i < gs->n_tasks; i++) {
-        if (gs->tasks[i].indegree == 0) pq_ops++;
+    // Attach the ready queue, NUMA-sharded unless told otherwise
+    qopts.num_nodes = num_nodes;
+    if (graph_sched_attach_by_name(gs, queue, &qopts) < 0 || !gs->qiface.q) {
+        fprintf(stderr, "Failed to create graph scheduler\n");
+        exit(EXIT_FAILURE);
+    }
+    if (strcmp(place, "spread") == 0)
+        gs->place = GRAPH_PLACE_SPREAD;
+    else if (strcmp(place, "queue") == 0)
+        gs->place = GRAPH_PLACE_QUEUE;
+    else
+        gs->place = GRAPH_PLACE_LOCAL;
+    gs->bypass = bypass;
+
+    // Buffers are left untouched until the task that writes them runs,
+    // so that their pages are placed by first touch on its node
+    if (ctx.bytes > 0) {
+        E_NULL(ctx.bufs = (char *)malloc(n_tasks * ctx.bytes));
+        build_parents(gs, &ctx);
     }
 
-    gettime(&start);
+    // Task costs in [work/2, 3*work/2], fixed across runs
+    if (work > 0) {
+        E_NULL(cost = (long *)malloc(n_tasks * sizeof(long)));
+        for (int i = 0; i < n_tasks; i++) {
+            cost[i] = work / 2 + rand_r(&seed) % (work + 1);
+            total_work += cost[i];
+        }
+    }
 
-    while (1) {
-        int id = graph_sched_extract_min_topo(gs);
-        if (id < 0) break;
+    cp = graph_sched_set_policy(gs, policy, cost, nthreads);
+    if (policy != GRAPH_PRIO_RANK) {
+        E_NULL(rank = (long *)malloc(n_tasks * sizeof(long)));
+        cp = graph_sched_upward_rank(gs, cost, rank, nthreads);
+        free(rank);
+    }
+    if (cp < 0) {
+        fprintf(stderr, "Error: The graph has a cycle\n");
+        exit(EXIT_FAILURE);
+    }
 
-        pq_ops++; // For the delete_min itself
-        
-        int enqueued = graph_sched_task_completed(gs, id);
-        pq_ops += enqueued;
+    gettime(&start);
+    mk_start = read_tsc_p();
 
-        tasks_executed++;
-    }
+    ctx.cost = cost;
+    tasks_executed = graph_sched_run(gs, nthreads, cost || ctx.bufs ? spin_task : NULL, &ctx);
 
+    makespan = read_tsc_p() - mk_start;
     gettime(&end);
 
+    // Initial enqueues, delete_mins and enqueues of ready children.
+    // A task passed on through the bypass slot saves an insert and a
+    // delete_min.
+    pq_ops = gs->n_inserts + gs->n_deletes;
+
     elapsed = timediff(start, end);
     dt = elapsed.tv_sec + (double)elapsed.tv_nsec / 1000000000.0;
 
     printf("Threads:        %d\n", nthreads);
     printf("NUMA nodes:     %d\n", num_nodes);
+    printf("Queue:          %s\n", queue);
+    printf("Policy:         %s\n", policy_name);
+    printf("Placement:      %s\n", place);
+    printf("Buffer/task:    %ld bytes\n", ctx.bytes);
     printf("Tasks:          %d\n", n_tasks);
+    if (file)
+        printf("Graph:          %s\n", file);
+    else
+        printf("Generator:      %s (seed %lu)\n", gen_name, gen_seed);
     printf("Edges/task:     %d\n", edges_per_task);
+    printf("Build time:     %.6f s\n", build_dt);
     printf("Tasks executed: %ld\n", tasks_executed);
     printf("Total time:     %.6f s\n", dt);
     printf("Tasks/s:        %.0f\n", tasks_executed / dt);
     printf("PQ ops:         %ld\n", pq_ops);
     printf("PQ ops/s:       %.0f\n", pq_ops / dt);
+    printf("PQ ops saved:   %ld (%ld tasks bypassed the queue)\n",
+           2 * gs->n_bypassed, gs->n_bypassed);
+    printf("Makespan:       %lu cycles\n", (unsigned long)makespan);
+    // Share of tasks run on the node whose worker made them ready, and
+    // so found their freshest parent's output in that node's memory
+    printf("Wasted pops:    %ld\n", gs->n_wasted);
+    printf("Same-node runs: %.1f%%\n", 100.0 * gs->n_same_node / tasks_executed);
+    if (cost) {
+        printf("Crit. path:     %ld cycles\n", cp);
+        printf("Efficiency:     %.3f (lower bound / makespan)\n",
+               max((double)cp, total_work / nthreads) / makespan);
+    } else {
+        printf("Crit. path:     %ld tasks\n", cp);
+    }
 
     if (tasks_executed != n_tasks) {
         fprintf(stderr, "Warning: Executed %ld tasks, expected %d\n", tasks_executed, n_tasks);
     }
 
+    free(cost);
+    free(ctx.bufs);
+    free(ctx.pstart);
+    free(ctx.parents);
     graph_sched_destroy(gs);
     _destroy_gc_subsystem();
 
@@ -2,46 +2,144 @@
  * Graph scheduling benchmark.
  * Tests the graph_sched layer built on top of the lock-free priority queue.
  *
- * Usage: ./graph_perf_meas <n_tasks> <edges_per_task>
+ * Usage: ./graph_perf_meas [-n threads] [-q queue] [-w cycles] [-p policy] [-r runs] [-H] [-T trace] [-V] [-C budget [-F]] [-g gen] [-S seed] <n_tasks> <edges_per_task>
+ *        ./graph_perf_meas [-n threads] [-q queue] [-w cycles] [-p policy] [-r runs] [-H] [-T trace] [-V] [-C budget [-F]] -f <graph file>
  */
 
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include "gc/gc.h"
 #include "common.h"
 #include "graph_sched.h"
+#include "graph_trace.h"
+#include "graph_coarse.h"
 
 static void
 usage(FILE *out, const char *argv0)
 {
-    fprintf(out, "Usage: %s <n_tasks> <edges_per_task>\n", argv0);
+    fprintf(out, "Usage: %s [OPTION]... <n_tasks> <edges_per_task>\n", argv0);
+    fprintf(out, "       %s [OPTION]... -f FILE\n", argv0);
     fprintf(out, "\n");
-    fprintf(out, "  n_tasks         Number of tasks in the DAG\n");
-    fprintf(out, "  edges_per_task  Average number of outgoing edges per task\n");
+    fprintf(out, "  -C BUDGET       Also run the graph coarsened into super-tasks of at most\n");
+    fprintf(out, "                  BUDGET cycles of work (tasks without -w), and compare\n");
+    fprintf(out, "  -F              Coarsen chains only, not siblings\n");
+    fprintf(out, "  -f FILE         Run on a graph file (edge list or graph_convert output)\n");
+    fprintf(out, "  -H              Trace the last run and print histograms of queue wait,\n");
+    fprintf(out, "                  worker idle time and critical-path slack\n");
+    fprintf(out, "  -g GEN          Graph generator: random, layered, wavefront, forkjoin,\n");
+    fprintf(out, "                  cholesky, lu or powerlaw (default random)\n");
+    fprintf(out, "  -m NODES        Shards of the numa and hier queues (default 2)\n");
+    fprintf(out, "  -n THREADS      Number of worker threads (default 1)\n");
+    fprintf(out, "  -p POLICY       Dequeue order: user (task index), fifo, lifo or\n");
+    fprintf(out, "                  rank (critical path first) (default user)\n");
+    fprintf(out, "  -S SEED         Generator seed (default %d)\n", GRAPH_GEN_SEED);
+    fprintf(out, "  -T FILE         Trace the last run and write it to FILE as a Chrome\n");
+    fprintf(out, "                  trace (chrome://tracing, Perfetto)\n");
+    fprintf(out, "  -q QUEUE        Ready queue (default pq):\n");
+    for (const graph_queue_backend_t *b = graph_queue_backends; b->name; b++)
+        fprintf(out, "                    %-8s%s\n", b->name, b->desc);
+    fprintf(out, "  -r RUNS         Run the graph RUNS times, resetting it in between,\n");
+    fprintf(out, "                  and report the per-run reset overhead (default 1)\n");
+    fprintf(out, "  -V              Check the graph (ids, duplicate edges, indegrees, cycles)\n");
+    fprintf(out, "                  on the worker threads before running it\n");
+    fprintf(out, "  -W KEYS         Priority window of the steal queue's deques (default %d)\n",
+            GRAPH_STEAL_WINDOW);
+    fprintf(out, "  -w CYCLES       Mean busy work per task in TSC cycles; task costs\n");
+    fprintf(out, "                  are uniform in [CYCLES/2, 3*CYCLES/2] (default 0)\n");
+    fprintf(out, "  n_tasks         Number of tasks in the DAG (approximate for shaped graphs)\n");
+    fprintf(out, "  edges_per_task  Fan-out of the generator\n");
+}
+
+// Simulated task execution: spin for the task's cost in cycles
+static void
+spin_task(graph_sched_t *gs, int task_id, void *arg)
+{
+    uint64_t until = read_tsc_p() + ((long *)arg)[task_id];
+    while (read_tsc_p() < until)
+        ;
 }
 
 int
 main(int argc, char **argv)
 {
-    int n_tasks, edges_per_task;
+    int n_tasks, edges_per_task = 0;
+    char *file = NULL;
     graph_sched_t *gs;
     struct timespec start, end, elapsed;
-    int executed = 0;
-    int task_id;
-    double dt;
+    long executed = 0, wasted = 0;
+    int runs = 1;
+    char *gen_name = "random";
+    graph_gen_kind_t gen;
+    unsigned long gen_seed = GRAPH_GEN_SEED;
+    double build_dt, attach_dt, check_dt = 0, reset_dt = 0;
+    int check = 0;
+    long budget = 0;
+    int coarse_flags = GRAPH_COARSE_CHAINS | GRAPH_COARSE_SIBLINGS;
+    graph_coarse_t *coarse = NULL;
+    double coarse_dt = 0, coarse_run_dt = 0;
+    uint64_t coarse_makespan = 0;
+    long ops = 0, coarse_ops = 0, coarse_executed = 0;
+    graph_check_t chk;
+    long *cost = NULL, *rank, cp;
+    double total_work = 0;
+    uint64_t mk_start, makespan = 0;
+    char *policy_name = "user";
+    char *queue = "pq";
+    int num_nodes = 2;
+    long window = GRAPH_STEAL_WINDOW;
+    graph_queue_opts_t qopts;
+    graph_prio_policy_t policy;
+    unsigned int seed = 0;
+    size_t mem, mem_tasks, mem_offsets, mem_edges;
+    int nthreads = 1;
+    long work = 0;
+    int opt;
+    int hists = 0;
+    char *trace_file = NULL;
+    graph_trace_t *trace = NULL;
+    double dt, prio_dt;
     
     // Parse command-line arguments
-    if (argc != 3) {
+    while ((opt = getopt(argc, argv, "n:q:m:W:w:f:p:r:g:S:HT:VC:Fh")) >= 0) {
+        switch (opt) {
+        case 'C': budget = atol(optarg); break;
+        case 'F': coarse_flags = GRAPH_COARSE_CHAINS; break;
+        case 'V': check = 1; break;
+        case 'g': gen_name = optarg; break;
+        case 'S': gen_seed = strtoul(optarg, NULL, 0); break;
+        case 'r': runs = atoi(optarg); break;
+        case 'H': hists = 1; break;
+        case 'T': trace_file = optarg; break;
+        case 'p': policy_name = optarg; break;
+        case 'f': file = optarg; break;
+        case 'n': nthreads = atoi(optarg); break;
+        case 'q': queue = optarg; break;
+        case 'm': num_nodes = atoi(optarg); break;
+        case 'W': window = atol(optarg); break;
+        case 'w': work = atol(optarg); break;
+        case 'h': usage(stdout, argv[0]); exit(EXIT_SUCCESS);
+        default:  usage(stderr, argv[0]); exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind != (file ? 0 : 2)) {
         usage(stderr, argv[0]);
         exit(EXIT_FAILURE);
     }
     
-    n_tasks = atoi(argv[1]);
-    edges_per_task = atoi(argv[2]);
+    if (file) {
+        n_tasks = 1;
+    } else {
+        n_tasks = atoi(argv[optind]);
+        edges_per_task = atoi(argv[optind + 1]);
+    }
     
-    if (n_tasks <= 0 || edges_per_task < 0) {
+    if (n_tasks <= 0 || edges_per_task < 0 || nthreads <= 0 || runs <= 0 ||
+        num_nodes <= 0 || window < 0 || budget < 0 || graph_queue_find(queue) == NULL ||
+        graph_sched_parse_policy(policy_name, &policy) < 0 ||
+        graph_sched_parse_gen(gen_name, &gen) < 0) {
         fprintf(stderr, "Error: Invalid arguments\n");
         usage(stderr, argv[0]);
         exit(EXIT_FAILURE);
@@ -50,56 +148,216 @@ main(int argc, char **argv)
     // Initialize garbage collection subsystem
     _init_gc_subsystem();
     
-    // Create the task graph using standard priority queue
-    gs = graph_sched_create_random_prioq(n_tasks, edges_per_task);
+    // Load or generate the graph, both in parallel on the worker threads
+    gettime(&start);
+    if (file) {
+        gs = graph_sched_load(file, nthreads);
+    } else {
+        // Built in parallel on the worker threads
+        gs = graph_sched_generate(gen, n_tasks, edges_per_task, gen_seed, nthreads);
+    }
     if (gs == NULL) {
         fprintf(stderr, "Error: Failed to create graph scheduler\n");
         exit(EXIT_FAILURE);
     }
+    gettime(&end);
+    elapsed = timediff(start, end);
+    build_dt = elapsed.tv_sec + (double)elapsed.tv_nsec / 1000000000.0;
+    n_tasks = gs->n_tasks;
+    
+    if (check) {
+        gettime(&start);
+        if (graph_sched_check(gs, nthreads, &chk) < 0) {
+            fprintf(stderr, "Error: Invalid graph: %ld bad ids, %ld self loops, "
+                    "%ld duplicate edges, %ld bad indegrees, %ld tasks on or behind a cycle\n",
+                    chk.bad_ids, chk.self_loops, chk.duplicates, chk.bad_indegree, chk.cyclic);
+            exit(EXIT_FAILURE);
+        }
+        gettime(&end);
+        elapsed = timediff(start, end);
+        check_dt = elapsed.tv_sec + (double)elapsed.tv_nsec / 1000000000.0;
+    }
+    
+    gettime(&start);
+    qopts.num_nodes = num_nodes;
+    qopts.window = window;
+    graph_sched_attach_by_name(gs, queue, &qopts);
+    gettime(&end);
+    elapsed = timediff(start, end);
+    attach_dt = elapsed.tv_sec + (double)elapsed.tv_nsec / 1000000000.0;
     
-    // Initialize the ready queue with all indegree-0 tasks
-    graph_sched_init_ready(gs);
+    // Task costs, fixed across runs
+    if (work > 0) {
+        E_NULL(cost = (long *)malloc(n_tasks * sizeof(long)));
+        for (int i = 0; i < n_tasks; i++) {
+            cost[i] = work / 2 + rand_r(&seed) % (work + 1);
+            total_work += cost[i];
+        }
+    }
     
-    // Start timing
+    // Priorities; the critical path bounds the makespan from below
     gettime(&start);
+    cp = graph_sched_set_policy(gs, policy, cost, nthreads);
+    gettime(&end);
+    elapsed = timediff(start, end);
+    prio_dt = elapsed.tv_sec + (double)elapsed.tv_nsec / 1000000000.0;
+    if (policy != GRAPH_PRIO_RANK) {
+        E_NULL(rank = (long *)malloc(n_tasks * sizeof(long)));
+        cp = graph_sched_upward_rank(gs, cost, rank, nthreads);
+        free(rank);
+    }
+    if (cp < 0) {
+        fprintf(stderr, "Error: The graph has a cycle (check with -V)\n");
+        exit(EXIT_FAILURE);
+    }
     
-    // Main execution loop: extract and execute tasks in topological order
-    while (1) {
-        task_id = graph_sched_extract_min_topo(gs);
+    dt = 0;
+    for (int run = 0; run < runs; run++) {
+        // Restore the indegrees and seed the ready queue with the
+        // cached roots
+        gettime(&start);
+        graph_sched_reset(gs);
+        gettime(&end);
+        elapsed = timediff(start, end);
+        reset_dt += elapsed.tv_sec + (double)elapsed.tv_nsec / 1000000000.0;
         
-        if (task_id < 0) {
-            // No more runnable tasks
-            break;
+        // Timestamps of every task in the last run; the rings hold the
+        // whole run unless it is very large
+        if ((hists || trace_file) && run == runs - 1) {
+            trace = graph_trace_create(nthreads, min(n_tasks, GRAPH_TRACE_RING));
+            gs->trace = trace;
         }
         
-        // Simulate task execution (minimal work)
-        // In a real scheduler, this would be actual computation
-        executed++;
+        // Start timing
+        gettime(&start);
+        mk_start = read_tsc_p();
         
-        // Mark task as completed and update dependencies
-        graph_sched_task_completed(gs, task_id);
+        // Execute the DAG in topological order on the worker threads
+        executed += graph_sched_run(gs, nthreads, cost ? spin_task : NULL, cost);
+        wasted += gs->n_wasted;
+        ops += gs->n_inserts + gs->n_deletes;
+        
+        // End timing
+        makespan += read_tsc_p() - mk_start;
+        gettime(&end);
+        
+        // Calculate elapsed time
+        elapsed = timediff(start, end);
+        dt += elapsed.tv_sec + (double)elapsed.tv_nsec / 1000000000.0;
     }
+    makespan /= runs;
     
-    // End timing
-    gettime(&end);
-    
-    // Calculate elapsed time
-    elapsed = timediff(start, end);
-    dt = elapsed.tv_sec + (double)elapsed.tv_nsec / 1000000000.0;
+    // The same runs on super-tasks, which execute their member tasks
+    // in turn on the original graph
+    if (budget > 0) {
+        gettime(&start);
+        coarse = graph_coarse_create(gs, cost, budget, coarse_flags);
+        gettime(&end);
+        elapsed = timediff(start, end);
+        coarse_dt = elapsed.tv_sec + (double)elapsed.tv_nsec / 1000000000.0;
+        qopts.num_nodes = num_nodes;
+        qopts.window = window;
+        graph_sched_attach_by_name(coarse->gs, queue, &qopts);
+        for (int run = 0; run < runs; run++) {
+            graph_sched_reset(coarse->gs);
+            gettime(&start);
+            mk_start = read_tsc_p();
+            coarse_executed += graph_coarse_run(coarse, nthreads, cost ? spin_task : NULL, cost);
+            coarse_makespan += read_tsc_p() - mk_start;
+            gettime(&end);
+            elapsed = timediff(start, end);
+            coarse_run_dt += elapsed.tv_sec + (double)elapsed.tv_nsec / 1000000000.0;
+            coarse_ops += coarse->gs->n_inserts + coarse->gs->n_deletes;
+        }
+        coarse_makespan /= runs;
+    }
     
     // Print statistics
+    printf("Threads:    %d\n", nthreads);
     printf("Tasks:      %d\n", n_tasks);
-    printf("Edges/task: %d\n", edges_per_task);
-    printf("Executed:   %d\n", executed);
+    if (file)
+        printf("Graph:      %s\n", file);
+    else
+        printf("Generator:  %s (fan-out %d, seed %lu)\n", gen_name, edges_per_task, gen_seed);
+    printf("Queue:      %s", queue);
+    if (gs->n_nodes > 1)
+        printf(" (%d nodes)", gs->n_nodes);
+    if (strcmp(queue, "steal") == 0)
+        printf(" (window %ld)", window);
+    printf("\n");
+    printf("Policy:     %s (set up in %.6f s)\n", policy_name, prio_dt);
+    printf("Build time: %.6f s (%s on %d threads)\n", build_dt, file ? "load" : "generate",
+           nthreads);
+    if (check)
+        printf("Check time: %.6f s (valid, %d levels)\n", check_dt, chk.levels);
+    printf("Queue init: %.6f s\n", attach_dt);
+    if (runs > 1) {
+        printf("Runs:       %d\n", runs);
+        printf("Reset/run:  %.6f s (%.1f%% of a build, %.1f%% of a run)\n",
+               reset_dt / runs, 100 * reset_dt / runs / build_dt, 100 * reset_dt / dt);
+    }
+    printf("Executed:   %ld\n", executed);
+    printf("Wasted pops: %ld\n", wasted);
     printf("Total time: %.6f s\n", dt);
+    printf("Tasks/s:    %.0f\n", executed / dt);
+    if (strcmp(queue, "steal") == 0) {
+        long local, global, stolen, drift;
+        steal_priq_stats((steal_prioq_t *)gs->qiface.q, &local, &global, &stolen, &drift);
+        printf("Deques:     %ld local, %ld global inserts, %ld stolen, %ld drift checks won\n",
+               local, global, stolen, drift);
+    }
+    printf("Makespan:   %lu cycles%s\n", (unsigned long)makespan, runs > 1 ? " (mean)" : "");
+    if (cost) {
+        // Neither the critical path nor an even split of the work can
+        // be beaten
+        double bound = max((double)cp, total_work / nthreads);
+        printf("Crit. path: %ld cycles\n", cp);
+        printf("Work/thr:   %.0f cycles\n", total_work / nthreads);
+        printf("Efficiency: %.3f (lower bound / makespan)\n", bound / makespan);
+    } else {
+        printf("Crit. path: %ld tasks\n", cp);
+    }
+    
+    if (coarse) {
+        printf("Coarsened:  %d -> %d tasks, %ld -> %ld edges (%ld chained, %ld grouped, %.6f s)\n",
+               n_tasks, coarse->gs->n_tasks, gs->n_edges, coarse->gs->n_edges,
+               coarse->n_chained, coarse->n_grouped, coarse_dt);
+        printf("Queue ops:  %ld -> %ld per run (%.1f%% fewer)\n", ops / runs, coarse_ops / runs,
+               100.0 * (ops - coarse_ops) / ops);
+        printf("Makespan:   %lu -> %lu cycles (speedup %.2f)\n", (unsigned long)makespan,
+               (unsigned long)coarse_makespan, (double)makespan / coarse_makespan);
+        printf("Run time:   %.6f -> %.6f s\n", dt, coarse_run_dt);
+        if (coarse_executed != (long)coarse->gs->n_tasks * runs)
+            fprintf(stderr, "Warning: Executed %ld super-tasks, expected %ld\n",
+                    coarse_executed, (long)coarse->gs->n_tasks * runs);
+    }
+    
+    if (hists)
+        graph_trace_report(trace, gs, stdout);
+    if (trace_file) {
+        if (graph_trace_dump_chrome(trace, trace_file) < 0)
+            fprintf(stderr, "Error: Cannot write %s\n", trace_file);
+        else
+            printf("Trace:      %s\n", trace_file);
+    }
+    
+    // Memory footprint of the graph (CSR edges, padded task records)
+    mem = graph_sched_footprint(gs, &mem_tasks, &mem_offsets, &mem_edges);
+    printf("Edges:      %ld\n", gs->n_edges);
+    printf("Memory:     %.2f MB (tasks %.2f, offsets %.2f, edges %.2f)\n",
+           mem / 1e6, mem_tasks / 1e6, mem_offsets / 1e6, mem_edges / 1e6);
+    printf("Bytes/task: %.1f\n", (double)mem / n_tasks);
     
     // Verify correctness
-    if (executed != n_tasks) {
-        fprintf(stderr, "Warning: Executed %d tasks, expected %d\n", 
-                executed, n_tasks);
+    if (executed != (long)n_tasks * runs) {
+        fprintf(stderr, "Warning: Executed %ld tasks, expected %ld\n", 
+                executed, (long)n_tasks * runs);
     }
     
     // Cleanup
+    free(cost);
+    graph_coarse_destroy(coarse);
+    graph_trace_destroy(trace);
     graph_sched_destroy(gs);
     _destroy_gc_subsystem();
     
@@ -0,0 +1,186 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "graph_sched.h"
+#include "common.h"
+
+typedef struct prio_pair {
+    long value;
+    int  id;
+} prio_pair_t;
+
+static int prio_pair_cmp(const void *a, const void *b) {
+    const prio_pair_t *x = a, *y = b;
+
+    if (x->value != y->value) return x->value < y->value ? -1 : 1;
+    return x->id - y->id;
+}
+
+// The queues drop duplicate keys, so priorities are replaced by the
+// task's position in (value, id) order, which is unique.
+void graph_sched_set_priorities(graph_sched_t *gs, const long *prio) {
+    prio_pair_t *pairs;
+
+    E_NULL(pairs = (prio_pair_t *)malloc(gs->n_tasks * sizeof(prio_pair_t)));
+    for (int i = 0; i < gs->n_tasks; i++) {
+        pairs[i].value = prio[i];
+        pairs[i].id = i;
+    }
+    qsort(pairs, gs->n_tasks, sizeof(prio_pair_t), prio_pair_cmp);
+    for (int i = 0; i < gs->n_tasks; i++)
+        gs->tasks[pairs[i].id].priority = (prio_t)i;
+    free(pairs);
+}
+
+// Shared state of the reverse-topological sweep. A task is ready once
+// all of its children have their rank; ready tasks are appended to
+// queue, and every slot is claimed by exactly one worker. done counts
+// the tasks ranked, each after its pushes.
+typedef struct rank_sweep {
+    graph_sched_t     *gs;
+    const long        *cost;
+    long              *rank;
+    long              *pstart;    // parents of i: parents[pstart[i]] .. parents[pstart[i + 1] - 1]
+    int               *parents;
+    volatile int      *left;      // children without a rank yet
+    volatile int      *queue;     // -1 until the slot is filled
+    volatile long      head CACHELINE;
+    volatile long      tail CACHELINE;
+    volatile long      done CACHELINE;
+} rank_sweep_t;
+
+static void sweep_push(rank_sweep_t *s, int id) {
+    s->queue[__sync_fetch_and_add(&s->tail, 1)] = id;
+}
+
+// No slot from tail on will be filled: every task pushed so far is
+// ranked, so nothing can push any more. The tasks left lie on or above
+// a cycle. done is read before tail, so a task still being ranked
+// keeps them apart.
+static int sweep_stuck(rank_sweep_t *s, long slot) {
+    long d = s->done;
+    long t = s->tail;
+
+    return d == t && slot >= t;
+}
+
+static void *rank_worker(void *_s) {
+    rank_sweep_t *s = (rank_sweep_t *)_s;
+    graph_sched_t *gs = s->gs;
+    long slot, r;
+    int id;
+
+    while ((slot = __sync_fetch_and_add(&s->head, 1)) < gs->n_tasks) {
+        // the slot is filled once a child of the task is done
+        while ((id = s->queue[slot]) < 0) {
+            if (sweep_stuck(s, slot)) return NULL;
+            __asm__ __volatile__ ("pause");
+        }
+
+        const int *deps = graph_sched_deps(gs, id);
+        r = 0;
+        for (int i = 0; i < graph_sched_n_deps(gs, id); i++)
+            r = max(r, s->rank[deps[i]]);
+        s->rank[id] = r + (s->cost ? s->cost[id] : 1);
+
+        for (long k = s->pstart[id]; k < s->pstart[id + 1]; k++) {
+            if (__sync_sub_and_fetch(&s->left[s->parents[k]], 1) == 0)
+                sweep_push(s, s->parents[k]);
+        }
+        __sync_fetch_and_add(&s->done, 1);
+    }
+    return NULL;
+}
+
+long graph_sched_upward_rank(graph_sched_t *gs, const long *cost, long *rank, int nthreads) {
+    rank_sweep_t *s;
+    pthread_t *ts;
+    int n = gs->n_tasks;
+    long cp = 0;
+
+    if (nthreads < 1) nthreads = 1;
+    E_en(posix_memalign((void **)&s, CACHE_LINE_SIZE, sizeof(rank_sweep_t)));
+    memset(s, 0, sizeof(rank_sweep_t));
+    s->gs = gs;
+    s->cost = cost;
+    s->rank = rank;
+
+    // Transpose the CSR to find each task's parents
+    E_NULL(s->pstart = (long *)calloc(n + 1, sizeof(long)));
+    E_NULL(s->parents = (int *)malloc((gs->n_edges + 1) * sizeof(int)));
+    for (long k = 0; k < gs->n_edges; k++)
+        s->pstart[gs->edges[k] + 1]++;
+    for (int i = 0; i < n; i++)
+        s->pstart[i + 1] += s->pstart[i];
+    for (int i = 0; i < n; i++) {
+        const int *deps = graph_sched_deps(gs, i);
+        for (int j = 0; j < graph_sched_n_deps(gs, i); j++)
+            s->parents[s->pstart[deps[j]]++] = i;
+    }
+    memmove(s->pstart + 1, s->pstart, n * sizeof(long));
+    s->pstart[0] = 0;
+
+    E_NULL(s->left = (volatile int *)malloc(n * sizeof(int)));
+    E_NULL(s->queue = (volatile int *)malloc(n * sizeof(int)));
+    for (int i = 0; i < n; i++) {
+        s->queue[i] = -1;
+        s->left[i] = graph_sched_n_deps(gs, i);
+    }
+    for (int i = 0; i < n; i++) {
+        if (s->left[i] == 0) sweep_push(s, i);
+    }
+
+    E_NULL(ts = (pthread_t *)malloc(nthreads * sizeof(pthread_t)));
+    for (int i = 0; i < nthreads; i++)
+        E_en(pthread_create(&ts[i], NULL, rank_worker, s));
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(ts[i], NULL);
+
+    if (s->done < n)
+        cp = -1;
+    for (int i = 0; i < n && cp >= 0; i++)
+        cp = max(cp, rank[i]);
+
+    free(ts);
+    free((void *)s->queue);
+    free((void *)s->left);
+    free(s->parents);
+    free(s->pstart);
+    free(s);
+    return cp;
+}
+
+long graph_sched_set_policy(graph_sched_t *gs, graph_prio_policy_t policy,
+                            const long *cost, int nthreads) {
+    long *rank, cp;
+
+    gs->policy = policy;
+    if (policy != GRAPH_PRIO_RANK) return 0;
+
+    E_NULL(rank = (long *)malloc(gs->n_tasks * sizeof(long)));
+    cp = graph_sched_upward_rank(gs, cost, rank, nthreads);
+    // largest rank first
+    for (int i = 0; i < gs->n_tasks && cp >= 0; i++)
+        rank[i] = -rank[i];
+    if (cp >= 0)
+        graph_sched_set_priorities(gs, rank);
+    free(rank);
+    return cp;
+}
+
+static const char *policy_names[] = {
+    [GRAPH_PRIO_USER] = "user",
+    [GRAPH_PRIO_FIFO] = "fifo",
+    [GRAPH_PRIO_LIFO] = "lifo",
+    [GRAPH_PRIO_RANK] = "rank",
+};
+
+int graph_sched_parse_policy(const char *name, graph_prio_policy_t *policy) {
+    for (int i = 0; i < sizeof(policy_names) / sizeof(policy_names[0]); i++) {
+        if (strcmp(name, policy_names[i]) == 0) {
+            *policy = (graph_prio_policy_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
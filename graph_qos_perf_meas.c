@@ -0,0 +1,241 @@
+/**
+ * Mixed-workload benchmark for the per-class lanes of graph_dyn.
+ * A producer thread releases small latency-critical DAGs at a fixed
+ * period while a stream of batch tasks keeps the workers busy, and
+ * the release-to-completion latency of the critical DAGs is measured
+ * against their deadlines.
+ *
+ * Usage: ./graph_qos_perf_meas [-n threads] [-s sched] [-W weight] [-j jobs] [-P cycles] [-D cycles]
+ *                              [-k fan-out] [-c cycles] [-b backlog] [-w cycles]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gc/gc.h"
+#include "common.h"
+#include "graph_dyn.h"
+
+#define LANE_CRIT  0
+#define LANE_BATCH 1
+
+typedef struct {
+    uint64_t release;
+    uint64_t deadline;
+    uint64_t done;
+} job_t;
+
+static job_t *jobs;
+static int n_jobs, fanout;
+static uint64_t period, rel_deadline, crit_work, batch_work, batch_deadline;
+static int lanes;
+static volatile long jobs_done, batch_done;
+static volatile int stop;
+
+static void spin(uint64_t cycles) {
+    uint64_t until = read_tsc_p() + cycles;
+    while (read_tsc_p() < until)
+        ;
+}
+
+// Under a single queue every task has the same priority, so tasks run
+// in the order they were created
+static int add(graph_dyn_t *d, int lane, uint64_t deadline, graph_dyn_fn_t fn, void *arg) {
+    if (lanes)
+        return graph_dyn_add_task_lane(d, lane, deadline, fn, arg);
+    return graph_dyn_add_task(d, 0, fn, arg);
+}
+
+static void batch_task(graph_dyn_t *d, int task_id, void *arg) {
+    int t;
+
+    spin(batch_work);
+    __sync_fetch_and_add(&batch_done, 1);
+    // Keep the backlog constant until the critical jobs are over
+    if (!stop) {
+        t = add(d, LANE_BATCH, read_tsc_p() + batch_deadline, batch_task, NULL);
+        graph_dyn_release(d, t);
+    }
+}
+
+static void crit_task(graph_dyn_t *d, int task_id, void *arg) {
+    spin(crit_work);
+}
+
+static void crit_join(graph_dyn_t *d, int task_id, void *arg) {
+    spin(crit_work);
+    jobs[(long)arg].done = read_tsc_p();
+    __sync_fetch_and_add(&jobs_done, 1);
+}
+
+// Fork-join job: root, fanout leaves, join. The join records the
+// completion of the whole job.
+static void release_job(graph_dyn_t *d, long j) {
+    int root, join, leaf;
+    uint64_t dl;
+
+    jobs[j].release = read_tsc_p();
+    jobs[j].deadline = dl = jobs[j].release + rel_deadline;
+    root = add(d, LANE_CRIT, dl, crit_task, NULL);
+    join = add(d, LANE_CRIT, dl, crit_join, (void *)j);
+    for (int i = 0; i < fanout; i++) {
+        leaf = add(d, LANE_CRIT, dl, crit_task, NULL);
+        graph_dyn_add_edge(d, root, leaf);
+        graph_dyn_add_edge(d, leaf, join);
+        graph_dyn_release(d, leaf);
+    }
+    graph_dyn_release(d, join);
+    graph_dyn_release(d, root);
+}
+
+static void *producer(void *_d) {
+    graph_dyn_t *d = (graph_dyn_t *)_d;
+    uint64_t next = read_tsc_p();
+
+    for (long j = 0; j < n_jobs; j++, next += period) {
+        while (read_tsc_p() < next)
+            sched_yield();
+        release_job(d, j);
+    }
+    while (jobs_done < n_jobs)
+        sched_yield();
+    stop = 1;
+    graph_dyn_producer_exit(d);
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void
+usage(FILE *out, const char *argv0)
+{
+    fprintf(out, "Usage: %s [OPTION]...\n", argv0);
+    fprintf(out, "\n");
+    fprintf(out, "  -b BACKLOG      Batch tasks kept queued (default 64)\n");
+    fprintf(out, "  -c CYCLES       Work per critical task in TSC cycles (default 10000)\n");
+    fprintf(out, "  -D CYCLES       Relative deadline of a critical job (default 500000)\n");
+    fprintf(out, "  -j JOBS         Critical jobs released (default 1000)\n");
+    fprintf(out, "  -k FANOUT       Parallel tasks per critical job (default 4)\n");
+    fprintf(out, "  -n THREADS      Number of worker threads (default 1)\n");
+    fprintf(out, "  -P CYCLES       Release period of critical jobs (default 1000000)\n");
+    fprintf(out, "  -s SCHED        lanes (critical and batch lanes, EDF in each) or\n");
+    fprintf(out, "                  single (one queue in creation order) (default lanes)\n");
+    fprintf(out, "  -W WEIGHT       Share of the critical lane against 1 for batch\n");
+    fprintf(out, "                  (default 16)\n");
+    fprintf(out, "  -w CYCLES       Work per batch task in TSC cycles (default 100000)\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    int nthreads = 1, weight = 16, backlog = 64, opt, weights[2];
+    char *sched = "lanes";
+    long executed, missed = 0;
+    uint64_t *lat;
+    graph_dyn_t *d;
+    pthread_t prod;
+    struct timespec start, end, elapsed;
+    double dt;
+
+    n_jobs = 1000;
+    fanout = 4;
+    period = 1000000;
+    rel_deadline = 500000;
+    crit_work = 10000;
+    batch_work = 100000;
+    while ((opt = getopt(argc, argv, "n:s:W:j:P:D:k:c:b:w:h")) >= 0) {
+        switch (opt) {
+        case 'n': nthreads = atoi(optarg); break;
+        case 's': sched = optarg; break;
+        case 'W': weight = atoi(optarg); break;
+        case 'j': n_jobs = atoi(optarg); break;
+        case 'P': period = strtoull(optarg, NULL, 10); break;
+        case 'D': rel_deadline = strtoull(optarg, NULL, 10); break;
+        case 'k': fanout = atoi(optarg); break;
+        case 'c': crit_work = strtoull(optarg, NULL, 10); break;
+        case 'b': backlog = atoi(optarg); break;
+        case 'w': batch_work = strtoull(optarg, NULL, 10); break;
+        case 'h': usage(stdout, argv[0]); exit(EXIT_SUCCESS);
+        default:  usage(stderr, argv[0]); exit(EXIT_FAILURE);
+        }
+    }
+    lanes = strcmp(sched, "lanes") == 0;
+    if (argc != optind || nthreads <= 0 || weight <= 0 || n_jobs <= 0 || fanout <= 0 ||
+        backlog < 0 || (!lanes && strcmp(sched, "single") != 0)) {
+        fprintf(stderr, "Error: Invalid arguments\n");
+        usage(stderr, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    // Batch tasks are due once the backlog could have been worked off
+    batch_deadline = (uint64_t)backlog * batch_work / nthreads;
+
+    _init_gc_subsystem();
+
+    d = graph_dyn_create();
+    if (lanes) {
+        weights[LANE_CRIT] = weight;
+        weights[LANE_BATCH] = 1;
+        graph_dyn_attach_lanes(d, 2, weights);
+    } else {
+        d->n_nodes = graph_queue_init_by_name(&d->qiface, "pq", NULL);
+    }
+    E_NULL(jobs = (job_t *)calloc(n_jobs, sizeof(job_t)));
+    E_NULL(lat = (uint64_t *)malloc(n_jobs * sizeof(uint64_t)));
+
+    gettime(&start);
+    for (int i = 0; i < backlog; i++)
+        graph_dyn_release(d, add(d, LANE_BATCH, read_tsc_p() + batch_deadline, batch_task, NULL));
+    graph_dyn_producer_enter(d);
+    E_en(pthread_create(&prod, NULL, producer, d));
+    executed = graph_dyn_run(d, nthreads);
+    pthread_join(prod, NULL);
+    gettime(&end);
+    elapsed = timediff(start, end);
+    dt = elapsed.tv_sec + (double)elapsed.tv_nsec / 1000000000.0;
+
+    for (int j = 0; j < n_jobs; j++) {
+        lat[j] = jobs[j].done - jobs[j].release;
+        if (jobs[j].done > jobs[j].deadline) missed++;
+    }
+    qsort(lat, n_jobs, sizeof(uint64_t), cmp_u64);
+
+    printf("Threads:    %d\n", nthreads);
+    if (lanes)
+        printf("Scheduler:  lanes (weights %d:1)\n", weight);
+    else
+        printf("Scheduler:  single queue\n");
+    printf("Critical:   %d jobs of %d tasks x %lu cycles, every %lu cycles, due after %lu\n",
+           n_jobs, fanout + 2, (unsigned long)crit_work, (unsigned long)period,
+           (unsigned long)rel_deadline);
+    printf("Batch:      backlog %d tasks x %lu cycles\n", backlog, (unsigned long)batch_work);
+    printf("Total time: %.6f s\n", dt);
+    printf("Tasks:      %ld\n", executed);
+    printf("Batch/s:    %.0f\n", batch_done / dt);
+    printf("Latency:    p50 %lu  p90 %lu  p99 %lu  p99.9 %lu  max %lu cycles\n",
+           (unsigned long)lat[n_jobs / 2], (unsigned long)lat[(long)n_jobs * 90 / 100],
+           (unsigned long)lat[(long)n_jobs * 99 / 100],
+           (unsigned long)lat[(long)n_jobs * 999 / 1000], (unsigned long)lat[n_jobs - 1]);
+    printf("Missed:     %ld of %d jobs (%.2f%%)\n", missed, n_jobs, 100.0 * missed / n_jobs);
+    if (lanes) {
+        long total = d->lanes->lanes[LANE_CRIT].taken + d->lanes->lanes[LANE_BATCH].taken;
+        for (int l = 0; l < 2; l++) {
+            lane_t *L = &d->lanes->lanes[l];
+            printf("Lane %d:     %s, %ld tasks (%.1f%%), %ld late (max %lu cycles)\n",
+                   l, l == LANE_CRIT ? "critical" : "batch", L->taken,
+                   total ? 100.0 * L->taken / total : 0.0, L->missed,
+                   (unsigned long)L->max_late);
+        }
+    }
+
+    free(lat);
+    free(jobs);
+    graph_dyn_destroy(d);
+    _destroy_gc_subsystem();
+
+    return 0;
+}
@@ -0,0 +1,358 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "graph_sched.h"
+#include "common.h"
+
+// Backends without a native batch operation loop over the single ones
+
+// Wrappers for standard priority queue
+static void prioq_insert_wrapper(void *q, pkey_t key, pval_t value) {
+    insert((pq_t *)q, key, value);
+}
+
+static pval_t prioq_delete_min_wrapper(void *q) {
+    return deletemin((pq_t *)q);
+}
+
+static pkey_t prioq_peek_min_wrapper(void *q) {
+    return peek_min_key((pq_t *)q);
+}
+
+static void prioq_insert_batch_wrapper(void *q, const pkey_t *keys, const pval_t *vals,
+                                       int n, int shard) {
+    for (int i = 0; i < n; i++)
+        insert((pq_t *)q, keys[i], vals[i]);
+}
+
+static int prioq_delete_min_batch_wrapper(void *q, pval_t *vals, int max) {
+    int got = 0;
+
+    while (got < max && (vals[got] = deletemin((pq_t *)q)) != NULL)
+        got++;
+    return got;
+}
+
+static void prioq_destroy_wrapper(void *q) {
+    pq_destroy((pq_t *)q);
+}
+
+// Wrappers for NUMA-sharded priority queue
+static void numa_prioq_insert_wrapper(void *q, pkey_t key, pval_t value) {
+    numa_priq_insert((numa_prioq_t *)q, key, value);
+}
+
+static pval_t numa_prioq_delete_min_wrapper(void *q) {
+    return numa_priq_delete_min((numa_prioq_t *)q);
+}
+
+static void numa_prioq_insert_hint_wrapper(void *q, pkey_t key, pval_t value, int shard) {
+    numa_priq_insert_node((numa_prioq_t *)q, key, value, shard);
+}
+
+static pkey_t numa_prioq_peek_min_wrapper(void *q) {
+    return numa_priq_peek_min((numa_prioq_t *)q);
+}
+
+static void numa_prioq_insert_batch_wrapper(void *q, const pkey_t *keys, const pval_t *vals,
+                                            int n, int shard) {
+    numa_priq_insert_batch((numa_prioq_t *)q, keys, vals, n, shard);
+}
+
+static int numa_prioq_delete_min_batch_wrapper(void *q, pval_t *vals, int max) {
+    return numa_priq_delete_min_batch((numa_prioq_t *)q, vals, max);
+}
+
+static long numa_prioq_size_hint_wrapper(void *q) {
+    numa_prioq_t *nq = (numa_prioq_t *)q;
+    long n = 0;
+
+    for (int i = 0; i < nq->num_nodes; i++)
+        n += nq->load[i].n;
+    return n;
+}
+
+static void numa_prioq_destroy_wrapper(void *q) {
+    numa_priq_destroy((numa_prioq_t *)q);
+}
+
+// Wrappers for hierarchical (thread/node/global) priority queue
+static void hier_prioq_insert_wrapper(void *q, pkey_t key, pval_t value) {
+    hier_priq_insert((hier_prioq_t *)q, key, value);
+}
+
+static pval_t hier_prioq_delete_min_wrapper(void *q) {
+    return hier_priq_delete_min((hier_prioq_t *)q);
+}
+
+static void hier_prioq_insert_hint_wrapper(void *q, pkey_t key, pval_t value, int shard) {
+    hier_priq_insert_node((hier_prioq_t *)q, key, value, shard);
+}
+
+static pkey_t hier_prioq_peek_min_wrapper(void *q) {
+    return hier_priq_peek_min((hier_prioq_t *)q);
+}
+
+static void hier_prioq_insert_batch_wrapper(void *q, const pkey_t *keys, const pval_t *vals,
+                                            int n, int shard) {
+    for (int i = 0; i < n; i++) {
+        if (shard < 0)
+            hier_priq_insert((hier_prioq_t *)q, keys[i], vals[i]);
+        else
+            hier_priq_insert_node((hier_prioq_t *)q, keys[i], vals[i], shard);
+    }
+}
+
+static int hier_prioq_delete_min_batch_wrapper(void *q, pval_t *vals, int max) {
+    int got = 0;
+
+    while (got < max && (vals[got] = hier_priq_delete_min((hier_prioq_t *)q)) != NULL)
+        got++;
+    return got;
+}
+
+// Shared tiers only: thread buffers are private to their owners
+static long hier_prioq_size_hint_wrapper(void *q) {
+    hier_prioq_t *hq = (hier_prioq_t *)q;
+    long n = hq->global_load.n;
+
+    for (int i = 0; i < hq->num_nodes; i++)
+        n += hq->load[i].n;
+    return n;
+}
+
+static void hier_prioq_destroy_wrapper(void *q) {
+    hier_priq_destroy((hier_prioq_t *)q);
+}
+
+// Wrappers for the work-stealing deques
+static void steal_prioq_insert_wrapper(void *q, pkey_t key, pval_t value) {
+    steal_priq_insert((steal_prioq_t *)q, key, value);
+}
+
+static pval_t steal_prioq_delete_min_wrapper(void *q) {
+    return steal_priq_delete_min((steal_prioq_t *)q);
+}
+
+static pkey_t steal_prioq_peek_min_wrapper(void *q) {
+    return steal_priq_peek_min((steal_prioq_t *)q);
+}
+
+static void steal_prioq_insert_batch_wrapper(void *q, const pkey_t *keys, const pval_t *vals,
+                                             int n, int shard) {
+    for (int i = 0; i < n; i++)
+        steal_priq_insert((steal_prioq_t *)q, keys[i], vals[i]);
+}
+
+static int steal_prioq_delete_min_batch_wrapper(void *q, pval_t *vals, int max) {
+    int got = 0;
+
+    while (got < max && (vals[got] = steal_priq_delete_min((steal_prioq_t *)q)) != NULL)
+        got++;
+    return got;
+}
+
+static long steal_prioq_size_hint_wrapper(void *q) {
+    steal_prioq_t *sq = (steal_prioq_t *)q;
+    long n = sq->global_load.n, d;
+
+    for (int i = 0; i < STEAL_MAX_THREADS; i++) {
+        d = sq->deques[i].bottom - sq->deques[i].top;
+        if (d > 0) n += d;
+    }
+    return n;
+}
+
+static void steal_prioq_destroy_wrapper(void *q) {
+    steal_priq_destroy((steal_prioq_t *)q);
+}
+
+// Wrappers for the bucket queue
+static void bucket_prioq_insert_wrapper(void *q, pkey_t key, pval_t value) {
+    bucket_priq_insert((bucket_prioq_t *)q, key, value);
+}
+
+static pval_t bucket_prioq_delete_min_wrapper(void *q) {
+    return bucket_priq_delete_min((bucket_prioq_t *)q);
+}
+
+static pkey_t bucket_prioq_peek_min_wrapper(void *q) {
+    return bucket_priq_peek_min((bucket_prioq_t *)q);
+}
+
+static void bucket_prioq_insert_batch_wrapper(void *q, const pkey_t *keys, const pval_t *vals,
+                                              int n, int shard) {
+    for (int i = 0; i < n; i++)
+        bucket_priq_insert((bucket_prioq_t *)q, keys[i], vals[i]);
+}
+
+static int bucket_prioq_delete_min_batch_wrapper(void *q, pval_t *vals, int max) {
+    int got = 0;
+
+    while (got < max && (vals[got] = bucket_priq_delete_min((bucket_prioq_t *)q)) != NULL)
+        got++;
+    return got;
+}
+
+static void bucket_prioq_destroy_wrapper(void *q) {
+    bucket_priq_destroy((bucket_prioq_t *)q);
+}
+
+// For the backends that do not count their elements
+static long no_size_hint(void *q) {
+    return -1;
+}
+
+int graph_queue_init_prioq(graph_queue_iface_t *qi) {
+    qi->q = (void *)pq_init(32);
+    qi->insert = prioq_insert_wrapper;
+    qi->delete_min = prioq_delete_min_wrapper;
+    qi->insert_hint = NULL;
+    qi->peek_min = prioq_peek_min_wrapper;
+    qi->insert_batch = prioq_insert_batch_wrapper;
+    qi->delete_min_batch = prioq_delete_min_batch_wrapper;
+    qi->size_hint = no_size_hint;
+    qi->destroy = prioq_destroy_wrapper;
+    return 1;
+}
+
+int graph_queue_init_numa(graph_queue_iface_t *qi, int num_nodes) {
+    qi->q = (void *)numa_priq_init(num_nodes, 32);
+    qi->insert = numa_prioq_insert_wrapper;
+    qi->delete_min = numa_prioq_delete_min_wrapper;
+    qi->insert_hint = numa_prioq_insert_hint_wrapper;
+    qi->peek_min = numa_prioq_peek_min_wrapper;
+    qi->insert_batch = numa_prioq_insert_batch_wrapper;
+    qi->delete_min_batch = numa_prioq_delete_min_batch_wrapper;
+    qi->size_hint = numa_prioq_size_hint_wrapper;
+    qi->destroy = numa_prioq_destroy_wrapper;
+    return ((numa_prioq_t *)qi->q)->num_nodes;
+}
+
+int graph_queue_init_hier(graph_queue_iface_t *qi, int num_nodes) {
+    qi->q = (void *)hier_priq_init(num_nodes, 32, HIER_NODE_CAP);
+    qi->insert = hier_prioq_insert_wrapper;
+    qi->delete_min = hier_prioq_delete_min_wrapper;
+    qi->insert_hint = hier_prioq_insert_hint_wrapper;
+    qi->peek_min = hier_prioq_peek_min_wrapper;
+    qi->insert_batch = hier_prioq_insert_batch_wrapper;
+    qi->delete_min_batch = hier_prioq_delete_min_batch_wrapper;
+    qi->size_hint = hier_prioq_size_hint_wrapper;
+    qi->destroy = hier_prioq_destroy_wrapper;
+    return ((hier_prioq_t *)qi->q)->num_nodes;
+}
+
+int graph_queue_init_steal(graph_queue_iface_t *qi, pkey_t window) {
+    qi->q = (void *)steal_priq_init(32, window);
+    qi->insert = steal_prioq_insert_wrapper;
+    qi->delete_min = steal_prioq_delete_min_wrapper;
+    qi->insert_hint = NULL;
+    qi->peek_min = steal_prioq_peek_min_wrapper;
+    qi->insert_batch = steal_prioq_insert_batch_wrapper;
+    qi->delete_min_batch = steal_prioq_delete_min_batch_wrapper;
+    qi->size_hint = steal_prioq_size_hint_wrapper;
+    qi->destroy = steal_prioq_destroy_wrapper;
+    return 1;
+}
+
+int graph_queue_init_bucket(graph_queue_iface_t *qi, long nbuckets) {
+    qi->q = (void *)bucket_priq_init(nbuckets);
+    qi->insert = bucket_prioq_insert_wrapper;
+    qi->delete_min = bucket_prioq_delete_min_wrapper;
+    qi->insert_hint = NULL;
+    qi->peek_min = bucket_prioq_peek_min_wrapper;
+    qi->insert_batch = bucket_prioq_insert_batch_wrapper;
+    qi->delete_min_batch = bucket_prioq_delete_min_batch_wrapper;
+    qi->size_hint = no_size_hint;
+    qi->destroy = bucket_prioq_destroy_wrapper;
+    return 1;
+}
+
+void graph_queue_destroy(graph_queue_iface_t *qi) {
+    // q is NULL if no queue was attached
+    if (qi->q != NULL) qi->destroy(qi->q);
+    qi->q = NULL;
+}
+
+// Registry entries
+static int init_prioq(graph_queue_iface_t *qi, const graph_queue_opts_t *opts) {
+    return graph_queue_init_prioq(qi);
+}
+
+static int init_numa(graph_queue_iface_t *qi, const graph_queue_opts_t *opts) {
+    return graph_queue_init_numa(qi, opts->num_nodes);
+}
+
+static int init_hier(graph_queue_iface_t *qi, const graph_queue_opts_t *opts) {
+    return graph_queue_init_hier(qi, opts->num_nodes);
+}
+
+static int init_steal(graph_queue_iface_t *qi, const graph_queue_opts_t *opts) {
+    return graph_queue_init_steal(qi, opts->window > 0 ? opts->window : GRAPH_STEAL_WINDOW);
+}
+
+static int init_bucket(graph_queue_iface_t *qi, const graph_queue_opts_t *opts) {
+    if (opts->nbuckets < 1) return -1;
+    return graph_queue_init_bucket(qi, opts->nbuckets);
+}
+
+const graph_queue_backend_t graph_queue_backends[] = {
+    { "pq",     "lock-free skiplist",                    init_prioq },
+    { "numa",   "one skiplist per node, stealing",       init_numa },
+    { "hier",   "thread buffers, node and global tiers", init_hier },
+    { "steal",  "work-stealing deques, global skiplist", init_steal },
+    { "bucket", "bucket queue over a bitmap",            init_bucket },
+    { NULL,     NULL,                                    NULL },
+};
+
+const graph_queue_backend_t *graph_queue_find(const char *name) {
+    for (const graph_queue_backend_t *b = graph_queue_backends; b->name; b++) {
+        if (strcmp(b->name, name) == 0) return b;
+    }
+    return NULL;
+}
+
+int graph_queue_init_by_name(graph_queue_iface_t *qi, const char *name,
+                             const graph_queue_opts_t *opts) {
+    const graph_queue_backend_t *b = graph_queue_find(name);
+    graph_queue_opts_t defaults = { 1, 0, 0 };
+
+    if (b == NULL) return -1;
+    return b->init(qi, opts ? opts : &defaults);
+}
+
+void graph_sched_attach_prioq(graph_sched_t *gs) {
+    gs->n_nodes = graph_queue_init_prioq(&gs->qiface);
+}
+
+void graph_sched_attach_numa(graph_sched_t *gs, int num_nodes) {
+    gs->n_nodes = graph_queue_init_numa(&gs->qiface, num_nodes);
+}
+
+void graph_sched_attach_hier(graph_sched_t *gs, int num_nodes) {
+    gs->n_nodes = graph_queue_init_hier(&gs->qiface, num_nodes);
+}
+
+void graph_sched_attach_steal(graph_sched_t *gs, pkey_t window) {
+    gs->n_nodes = graph_queue_init_steal(&gs->qiface, window);
+}
+
+// Keys of a run lie in (key_base, key_base + n_tasks], and key_base is
+// a multiple of n_tasks, so bucket (key - 1) mod n_tasks is the
+// task's rank in the dequeue order
+void graph_sched_attach_bucket(graph_sched_t *gs) {
+    gs->n_nodes = graph_queue_init_bucket(&gs->qiface, gs->n_tasks);
+}
+
+int graph_sched_attach_by_name(graph_sched_t *gs, const char *name,
+                               const graph_queue_opts_t *opts) {
+    graph_queue_opts_t o = { 1, 0, 0 };
+    int n;
+
+    if (opts) o = *opts;
+    // see graph_sched_attach_bucket()
+    o.nbuckets = gs->n_tasks;
+    if ((n = graph_queue_init_by_name(&gs->qiface, name, &o)) < 0) return -1;
+    gs->n_nodes = n;
+    return n;
+}
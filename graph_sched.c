@@ -1,79 +1,71 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/mman.h>
 #include "graph_sched.h"
+#include "graph_trace.h"
 #include "common.h"
 
-// Wrappers for standard priority queue
-static void prioq_insert_wrapper(void *q, pkey_t key, pval_t value) {
-    insert((pq_t *)q, key, value);
+// Queue key of a task becoming ready. Keys must be unique and above
+// SENTINEL_KEYMIN; each task is readied once per run, so the FIFO and
+// LIFO counters stay within 1 .. n_tasks. Every run starts above the
+// keys of the previous one: a drained pq_t keeps its last deleted node
+// linked, and keys below it are only inserted at the bottom level
+// until the next restructure, which would make reseeding quadratic.
+static inline pkey_t task_key(graph_sched_t *gs, int id) {
+    switch (gs->policy) {
+    case GRAPH_PRIO_FIFO:
+        return gs->key_base + __sync_add_and_fetch(&gs->ready_seq, 1);
+    case GRAPH_PRIO_LIFO:
+        return gs->key_base + gs->n_tasks - __sync_fetch_and_add(&gs->ready_seq, 1);
+    default:
+        return gs->key_base + gs->tasks[id].priority + 1;
+    }
 }
 
-static pval_t prioq_delete_min_wrapper(void *q) {
-    return deletemin((pq_t *)q);
+static inline pval_t task_entry(graph_sched_t *gs, int id) {
+    return (pval_t)((uintptr_t)&gs->tasks[id] | (gs->gen & GRAPH_ENTRY_TAG));
 }
 
-// Wrappers for NUMA-sharded priority queue
-static void numa_prioq_insert_wrapper(void *q, pkey_t key, pval_t value) {
-    numa_priq_insert((numa_prioq_t *)q, key, value);
-}
+typedef struct graph_worker {
+    pthread_t          thread;
+    int                id;
+    graph_sched_t     *gs;
+    graph_task_fn_t    fn;
+    void              *arg;
+    long               executed;
+    long               inserts;
+    long               deletes;
+    long               same_node;
+    long               bypassed;
+    char               pad[128];
+} graph_worker_t;
+
+// Cache line aligned, zeroed array of task records
+graph_task_t *graph_sched_alloc_tasks(int n_tasks) {
+    graph_task_t *tasks;
 
-static pval_t numa_prioq_delete_min_wrapper(void *q) {
-    return numa_priq_delete_min((numa_prioq_t *)q);
+    E_en(posix_memalign((void **)&tasks, CACHE_LINE_SIZE, n_tasks * sizeof(graph_task_t)));
+    memset(tasks, 0, n_tasks * sizeof(graph_task_t));
+    return tasks;
 }
 
-// Internal helper for shared graph construction logic
+// Random graph built on all online CPUs
 static graph_sched_t *graph_sched_alloc_and_build(int n_tasks, int edges_per_task) {
-    graph_sched_t *gs;
-    int i, j, child, edge_count;
-    unsigned int seed = (unsigned int)time(NULL);
-
-    E_NULL(gs = (graph_sched_t *)malloc(sizeof(graph_sched_t)));
-    gs->n_tasks = n_tasks;
-    E_NULL(gs->tasks = (graph_task_t *)calloc(n_tasks, sizeof(graph_task_t)));
-
-    for (i = 0; i < n_tasks; i++) {
-        gs->tasks[i].id = i;
-        gs->tasks[i].priority = (prio_t)i;
-        gs->tasks[i].indegree = 0;
-        gs->tasks[i].n_deps = 0;
-        gs->tasks[i].deps = NULL;
-    }
+    return graph_sched_generate(GRAPH_GEN_RANDOM, n_tasks, edges_per_task, GRAPH_GEN_SEED,
+                                (int)sysconf(_SC_NPROCESSORS_ONLN));
+}
 
-    for (i = 0; i < n_tasks - 1; i++) {
-        if (edges_per_task > 0) {
-            E_NULL(gs->tasks[i].deps = (int *)malloc(edges_per_task * sizeof(int)));
-        }
-        edge_count = 0;
-        for (j = 0; j < edges_per_task; j++) {
-            int range = n_tasks - i - 1;
-            if (range <= 0) break;
-            child = i + 1 + (rand_r(&seed) % range);
-            
-            int duplicate = 0;
-            for (int k = 0; k < edge_count; k++) {
-                if (gs->tasks[i].deps[k] == child) {
-                    duplicate = 1;
-                    break;
-                }
-            }
-            if (!duplicate) {
-                gs->tasks[i].deps[edge_count++] = child;
-                gs->tasks[child].indegree++;
-            }
-        }
-        gs->tasks[i].n_deps = edge_count;
-    }
-    return gs;
+graph_sched_t *graph_sched_create_random(int n_tasks, int edges_per_task) {
+    return graph_sched_alloc_and_build(n_tasks, edges_per_task);
 }
 
 graph_sched_t *graph_sched_create_random_prioq(int n_tasks, int edges_per_task) {
     graph_sched_t *gs = graph_sched_alloc_and_build(n_tasks, edges_per_task);
     if (!gs) return NULL;
 
-    gs->qiface.q = (void *)pq_init(32);
-    gs->qiface.insert = prioq_insert_wrapper;
-    gs->qiface.delete_min = prioq_delete_min_wrapper;
+    graph_sched_attach_prioq(gs);
     return gs;
 }
 
@@ -81,70 +73,278 @@ graph_sched_t *graph_sched_create_random_numa(int n_tasks, int edges_per_task, i
     graph_sched_t *gs = graph_sched_alloc_and_build(n_tasks, edges_per_task);
     if (!gs) return NULL;
 
-    gs->qiface.q = (void *)numa_priq_init(num_nodes, 32);
-    gs->qiface.insert = numa_prioq_insert_wrapper;
-    gs->qiface.delete_min = numa_prioq_delete_min_wrapper;
+    graph_sched_attach_numa(gs, num_nodes);
+    return gs;
+}
+
+graph_sched_t *graph_sched_create_random_hier(int n_tasks, int edges_per_task, int num_nodes) {
+    graph_sched_t *gs = graph_sched_alloc_and_build(n_tasks, edges_per_task);
+    if (!gs) return NULL;
+
+    graph_sched_attach_hier(gs, num_nodes);
     return gs;
 }
 
 void graph_sched_destroy(graph_sched_t *gs) {
     if (gs == NULL) return;
-    for (int i = 0; i < gs->n_tasks; i++) {
-        if (gs->tasks[i].deps) free(gs->tasks[i].deps);
-    }
-    free(gs->tasks);
-    // Note: We don't have a generic destroy and the prompt said 
-    // "do not invent one unless you see it declared somewhere".
-    // However, numa_priq_destroy exists. Standard pq has pq_destroy.
-    // We should call the appropriate one if we want to be clean, 
-    // but the original code had no destroy for standard pq in the prompt's view.
-    // Actually, prioq.h HAS pq_destroy(pq_t *pq).
-    // Given the qiface, we'd need a destroy pointer too.
-    // But I'll stick to the user's specific logic for now.
-    // Since I know pq_destroy and numa_priq_destroy exist, I'll use them if I can.
-    // For now, I'll just free the ones I know.
-    if (gs->qiface.insert == numa_prioq_insert_wrapper) {
-        numa_priq_destroy((numa_prioq_t *)gs->qiface.q);
+    if (gs->map) {
+        // offsets and edges point into the mapped graph file
+        munmap(gs->map, gs->map_len);
     } else {
-        pq_destroy((pq_t *)gs->qiface.q);
+        free(gs->edges);
+        free(gs->offsets);
     }
+    free(gs->tasks);
+    free(gs->init_indegree);
+    free(gs->roots);
+    graph_queue_destroy(&gs->qiface);
     free(gs);
 }
 
-void graph_sched_init_ready(graph_sched_t *gs) {
+void graph_sched_snapshot(graph_sched_t *gs) {
+    free(gs->init_indegree);
+    free(gs->roots);
+    E_NULL(gs->init_indegree = (int *)malloc((gs->n_tasks + 1) * sizeof(int)));
+    E_NULL(gs->roots = (int *)malloc((gs->n_tasks + 1) * sizeof(int)));
+    gs->n_roots = 0;
     for (int i = 0; i < gs->n_tasks; i++) {
-        if (gs->tasks[i].indegree == 0) {
-            gs->qiface.insert(gs->qiface.q, gs->tasks[i].priority, (pval_t)&gs->tasks[i]);
-        }
+        gs->init_indegree[i] = gs->tasks[i].indegree;
+        if (gs->init_indegree[i] == 0) gs->roots[gs->n_roots++] = i;
     }
+    E_NULL(gs->roots = (int *)realloc(gs->roots, (gs->n_roots + 1) * sizeof(int)));
 }
 
+void graph_sched_reset(graph_sched_t *gs) {
+    if (gs->init_indegree == NULL) graph_sched_snapshot(gs);
+
+    // Task records are padded, so this is a strided copy rather than
+    // a memcpy
+    for (int i = 0; i < gs->n_tasks; i++) {
+        gs->tasks[i].indegree = gs->init_indegree[i];
+        gs->tasks[i].state = GRAPH_TASK_WAITING;
+        // Roots count as readied by no node
+        gs->tasks[i].ready_node = -1;
+    }
+    gs->n_completed = 0;
+    gs->n_inserts = gs->n_roots;
+    gs->n_deletes = 0;
+    gs->n_same_node = 0;
+    gs->n_bypassed = 0;
+    gs->n_wasted = 0;
+    graph_sched_init_ready(gs);
+    gs->seeded = 1;
+}
+
+void graph_sched_init_ready(graph_sched_t *gs) {
+    if (gs->roots == NULL) graph_sched_snapshot(gs);
+
+    gs->ready_seq = 0;
+    gs->key_base += gs->n_tasks;
+    gs->gen++;
+    for (int i = 0; i < gs->n_roots; i++) {
+        int id = gs->roots[i];
+        gs->tasks[id].state = GRAPH_TASK_READY;
+        gs->qiface.insert(gs->qiface.q, task_key(gs, id), task_entry(gs, id));
+    }
+}
+
+// Claim the task of a dequeued entry. Entries left over from an
+// earlier run, or for a task that is not READY, are counted and
+// dropped; neither is ever queued by the scheduler itself.
 int graph_sched_extract_min_topo(graph_sched_t *gs) {
     while (1) {
         pval_t val = gs->qiface.delete_min(gs->qiface.q);
         if (val == NULL) return -1;
         
-        graph_task_t *task = (graph_task_t *)val;
-        int task_id = task->id;
+        graph_task_t *task = (graph_task_t *)((uintptr_t)val & ~GRAPH_ENTRY_TAG);
+        int task_id = (int)(task - gs->tasks);
         
-        if (task_id >= 0 && task_id < gs->n_tasks && gs->tasks[task_id].indegree == 0) {
+        if (task_id >= 0 && task_id < gs->n_tasks &&
+            ((uintptr_t)val & GRAPH_ENTRY_TAG) == (gs->gen & GRAPH_ENTRY_TAG) &&
+            __sync_bool_compare_and_swap(&task->state, GRAPH_TASK_READY, GRAPH_TASK_RUNNING)) {
             return task_id;
         }
+        __sync_fetch_and_add(&gs->n_wasted, 1);
     }
 }
 
-int graph_sched_task_completed(graph_sched_t *gs, int task_id) {
-    int enqueued = 0;
+// Insert a ready child, the k-th one readied by the completing task,
+// according to the placement policy
+static void place_child(graph_sched_t *gs, int child_id, pkey_t key, int node, int k) {
+    pval_t val = task_entry(gs, child_id);
+
+    gs->tasks[child_id].ready_node = node;
+    if (gs->qiface.insert_hint == NULL || gs->place == GRAPH_PLACE_QUEUE) {
+        gs->qiface.insert(gs->qiface.q, key, val);
+    } else if (gs->place == GRAPH_PLACE_SPREAD) {
+        gs->qiface.insert_hint(gs->qiface.q, key, val, (node + k / GRAPH_SPREAD_KEEP) % gs->n_nodes);
+    } else {
+        gs->qiface.insert_hint(gs->qiface.q, key, val, node);
+    }
+}
+
+// Insert a batch of ready children into the completing worker's node
+// shard, or wherever the queue puts them
+static void flush_children(graph_sched_t *gs, const pkey_t *keys, const pval_t *vals,
+                           int n, int node) {
+    int shard = gs->qiface.insert_hint == NULL || gs->place == GRAPH_PLACE_QUEUE ? -1 : node;
+
+    gs->qiface.insert_batch(gs->qiface.q, keys, vals, n, shard);
+}
+
+int graph_sched_task_completed_next(graph_sched_t *gs, int task_id, int *next) {
+    pkey_t keys[GRAPH_BATCH];
+    pval_t vals[GRAPH_BATCH];
+    int enqueued = 0, batched = 0;
+    int node, best = -1;
+    pkey_t key, best_key = 0;
+    if (next) *next = -1;
     if (task_id < 0 || task_id >= gs->n_tasks) return 0;
+    gs->tasks[task_id].state = GRAPH_TASK_DONE;
     
-    graph_task_t *task = &gs->tasks[task_id];
-    for (int i = 0; i < task->n_deps; i++) {
-        int child_id = task->deps[i];
-        gs->tasks[child_id].indegree--;
-        if (gs->tasks[child_id].indegree == 0) {
-            gs->qiface.insert(gs->qiface.q, gs->tasks[child_id].priority, (pval_t)&gs->tasks[child_id]);
+    node = gs->n_nodes > 1 ? numa_priq_node_id(gs->n_nodes) : 0;
+    const int *deps = graph_sched_deps(gs, task_id);
+    int n_deps = graph_sched_n_deps(gs, task_id);
+    for (int i = 0; i < n_deps; i++) {
+        int child_id = deps[i];
+        // The thread taking the counter to zero owns the enqueue
+        if (__sync_sub_and_fetch(&gs->tasks[child_id].indegree, 1) == 0) {
+            // Only the thread taking the counter to zero gets here
+            assert(gs->tasks[child_id].state == GRAPH_TASK_WAITING);
+            gs->tasks[child_id].state = GRAPH_TASK_READY;
+            // after the decrement, so not before any parent's end
+            if (gs->trace) gs->tasks[child_id].ready_tsc = read_tsc_p();
+            key = task_key(gs, child_id);
+            if (next && (best < 0 || key < best_key)) {
+                // Hold the best child back, enqueue the one it replaces
+                int t = best;
+                pkey_t tk = best_key;
+                best = child_id;
+                best_key = key;
+                if (t < 0) continue;
+                child_id = t;
+                key = tk;
+            }
+            if (gs->place == GRAPH_PLACE_SPREAD && gs->qiface.insert_hint) {
+                place_child(gs, child_id, key, node, enqueued);
+            } else {
+                gs->tasks[child_id].ready_node = node;
+                keys[batched] = key;
+                vals[batched++] = task_entry(gs, child_id);
+                if (batched == GRAPH_BATCH) {
+                    flush_children(gs, keys, vals, batched, node);
+                    batched = 0;
+                }
+            }
+            enqueued++;
+        }
+    }
+    if (batched > 0) flush_children(gs, keys, vals, batched, node);
+    // After the flush, so the held child is also checked against its
+    // siblings
+    if (best >= 0) {
+        if (best_key <= gs->qiface.peek_min(gs->qiface.q)) {
+            gs->tasks[best].ready_node = node;
+            *next = best;
+        } else {
+            place_child(gs, best, best_key, node, enqueued);
             enqueued++;
         }
     }
     return enqueued;
 }
+
+int graph_sched_task_completed(graph_sched_t *gs, int task_id) {
+    return graph_sched_task_completed_next(gs, task_id, NULL);
+}
+
+size_t graph_sched_footprint(graph_sched_t *gs, size_t *tasks, size_t *offsets, size_t *edges) {
+    *tasks = gs->n_tasks * sizeof(graph_task_t);
+    *offsets = (gs->n_tasks + 1) * sizeof(long);
+    *edges = gs->n_edges * sizeof(int);
+    // plus the initial indegrees and root list kept for resets
+    return sizeof(graph_sched_t) + *tasks + *offsets + *edges +
+        (gs->n_tasks + gs->n_roots) * sizeof(int);
+}
+
+static void *graph_worker_run(void *_w) {
+    graph_worker_t *w = (graph_worker_t *)_w;
+    graph_sched_t *gs = w->gs;
+    int task_id, node, next = -1;
+    uint64_t start = 0;
+
+#if defined(__linux__)
+    pin(gettid(), w->id % sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+    numa_priq_set_local_node(w->id);
+    node = gs->n_nodes > 1 ? numa_priq_node_id(gs->n_nodes) : 0;
+
+    // An empty queue only means the DAG has drained once every task
+    // has completed; until then, running tasks may still enqueue.
+    while (gs->n_completed < gs->n_tasks) {
+        if (next >= 0) {
+            // Held back READY by task_completed_next(), so not queued
+            task_id = next;
+            gs->tasks[task_id].state = GRAPH_TASK_RUNNING;
+            w->bypassed++;
+        } else {
+            task_id = graph_sched_extract_min_topo(gs);
+            if (task_id < 0) {
+                __asm__ __volatile__ ("pause");
+                continue;
+            }
+            w->deletes++;
+        }
+        if (gs->tasks[task_id].ready_node == node) w->same_node++;
+        if (gs->trace) start = read_tsc_p();
+        if (w->fn) w->fn(gs, task_id, w->arg);
+        if (gs->trace)
+            graph_trace_record(gs->trace, w->id, task_id, gs->tasks[task_id].ready_tsc,
+                               start, read_tsc_p());
+        w->inserts += graph_sched_task_completed_next(gs, task_id, gs->bypass ? &next : NULL);
+        w->executed++;
+        __sync_fetch_and_add(&gs->n_completed, 1);
+    }
+    return NULL;
+}
+
+long graph_sched_run(graph_sched_t *gs, int nthreads, graph_task_fn_t task_fn, void *arg) {
+    graph_worker_t *ws;
+    long executed = 0;
+
+    if (nthreads < 1) nthreads = 1;
+    E_en(posix_memalign((void **)&ws, CACHE_LINE_SIZE, nthreads * sizeof(graph_worker_t)));
+    memset(ws, 0, nthreads * sizeof(graph_worker_t));
+
+    if (!gs->seeded) graph_sched_reset(gs);
+    if (gs->trace) {
+        // Roots count as ready from here, see graph_trace_report()
+        graph_trace_clear(gs->trace);
+        gs->trace->workers = nthreads;
+        gettime(&gs->trace->ts0);
+        gs->trace->t0 = read_tsc_p();
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        ws[i].id = i;
+        ws[i].gs = gs;
+        ws[i].fn = task_fn;
+        ws[i].arg = arg;
+        E_en(pthread_create(&ws[i].thread, NULL, graph_worker_run, &ws[i]));
+    }
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(ws[i].thread, NULL);
+        executed += ws[i].executed;
+        gs->n_inserts += ws[i].inserts;
+        gs->n_deletes += ws[i].deletes;
+        gs->n_same_node += ws[i].same_node;
+        gs->n_bypassed += ws[i].bypassed;
+    }
+    if (gs->trace) {
+        gs->trace->t1 = read_tsc_p();
+        gettime(&gs->trace->ts1);
+    }
+    free(ws);
+    gs->seeded = 0;
+    return executed;
+}
@@ -3,38 +3,330 @@
 
 #include "prioq.h"
 #include "numa_prioq.h"
+#include "hier_prioq.h"
+#include "steal_prioq.h"
+#include "bucket_prioq.h"
+
+// Node shard capacity of the hierarchical backend before overflowing
+// to its global tier
+#define HIER_NODE_CAP (1 << 16)
+// Default priority window of the work-stealing backend, in keys
+#define GRAPH_STEAL_WINDOW 1024
 
 typedef pkey_t prio_t;
 
+// Hot per-task record: read and written on every completion of one of
+// the task's parents. Padded to a cache line so that concurrent
+// indegree decrements of neighbouring tasks do not false-share. The
+// task id is the record's index, and its dependencies are kept apart
+// in CSR form (see graph_sched_t).
 typedef struct graph_task {
-    int     id;
+    volatile int indegree;
+    int     ready_node; // node of the worker that made the task ready
     prio_t  priority;
-    int     indegree;
-    int     n_deps;
-    int    *deps;
-} graph_task_t;
+    uint64_t ready_tsc; // when the indegree reached zero, if traced
+    volatile int state; // graph_task_state_t
+} CACHELINE graph_task_t;
+
+// Life of a task in a run. A task is queued once, on its move to
+// READY, and only the worker whose compare-and-swap moves it on to
+// RUNNING executes it.
+typedef enum graph_task_state {
+    GRAPH_TASK_WAITING, // parents left
+    GRAPH_TASK_READY,   // queued, or held for the bypass
+    GRAPH_TASK_RUNNING,
+    GRAPH_TASK_DONE,
+} graph_task_state_t;
+
+// Queue entries are task record pointers tagged in their low bits
+// (records are cache line aligned) with the run that queued them
+#define GRAPH_ENTRY_TAG ((uintptr_t)CACHE_LINE_SIZE - 1)
+
+typedef struct graph_trace graph_trace_t;
 
-// Pluggable queue interface
+// Pluggable queue interface (graph_queue.c). The init functions set
+// every member.
 typedef struct graph_queue_iface {
-    void *q; // opaque handle to the underlying queue (pq_t* or numa_prioq_t*)
+    void *q; // opaque handle to the underlying queue (pq_t*, numa_prioq_t*, hier_prioq_t*,
+             // steal_prioq_t* or bucket_prioq_t*)
     void (*insert)(void *q, pkey_t key, pval_t value);
     pval_t (*delete_min)(void *q);
+    // Insert into a preferred shard; NULL for unsharded queues
+    void (*insert_hint)(void *q, pkey_t key, pval_t value, int shard);
+    // Smallest key the caller would dequeue next, SENTINEL_KEYMAX if none
+    pkey_t (*peek_min)(void *q);
+    // Insert n elements, into shard if the queue is sharded and shard
+    // is not negative. Sharded backends update their load once.
+    void (*insert_batch)(void *q, const pkey_t *keys, const pval_t *vals, int n, int shard);
+    // Up to max elements in the order of successive delete_min calls;
+    // returns the number taken, 0 if the queue looked empty
+    int (*delete_min_batch)(void *q, pval_t *vals, int max);
+    // Estimated element count, -1 if the backend does not count
+    long (*size_hint)(void *q);
+    void (*destroy)(void *q);
 } graph_queue_iface_t;
 
+// Parameters of the backends selected by name; each uses the ones it
+// needs
+typedef struct graph_queue_opts {
+    int     num_nodes;  // numa, hier
+    pkey_t  window;     // steal; GRAPH_STEAL_WINDOW if 0
+    long    nbuckets;   // bucket
+} graph_queue_opts_t;
+
+typedef struct graph_queue_backend {
+    const char *name;
+    const char *desc;
+    // Returns the number of node shards, -1 if opts do not fit
+    int (*init)(graph_queue_iface_t *qi, const graph_queue_opts_t *opts);
+} graph_queue_backend_t;
+
+// Registered backends, terminated by a NULL name
+extern const graph_queue_backend_t graph_queue_backends[];
+
+// Where the children made ready by a completing task are inserted
+typedef enum graph_place_policy {
+    GRAPH_PLACE_LOCAL,  // the completing worker's node shard
+    GRAPH_PLACE_SPREAD, // the first GRAPH_SPREAD_KEEP locally, the rest
+                        // of the fan-out round-robin over the other nodes
+    GRAPH_PLACE_QUEUE,  // wherever the queue's own insert puts them
+} graph_place_policy_t;
+
+#define GRAPH_SPREAD_KEEP 2
+// Children readied by one completion are inserted up to GRAPH_BATCH
+// at a time, except under GRAPH_PLACE_SPREAD
+#define GRAPH_BATCH 64
+
+// Order in which ready tasks are dequeued
+typedef enum graph_prio_policy {
+    GRAPH_PRIO_USER,    // ascending task priority (the task index unless set)
+    GRAPH_PRIO_FIFO,    // in the order tasks became ready
+    GRAPH_PRIO_LIFO,    // most recently readied task first
+    GRAPH_PRIO_RANK,    // largest upward rank (longest path to a sink) first
+} graph_prio_policy_t;
+
 typedef struct graph_sched {
     int                n_tasks;
+    long               n_edges;
     graph_task_t      *tasks;
+    // CSR adjacency: the children of task i are
+    // edges[offsets[i]] .. edges[offsets[i + 1] - 1]
+    long              *offsets;
+    int               *edges;
+    // Indegrees before any task has run, and the tasks without
+    // parents, from which graph_sched_reset() restarts the graph
+    int               *init_indegree;
+    int               *roots;
+    int                n_roots;
+    // Set by graph_sched_reset(), cleared when a run ends
+    int                seeded;
+    // Graph file mapping backing offsets and edges, if loaded from one
+    void              *map;
+    size_t             map_len;
     graph_queue_iface_t qiface;
+    int                n_nodes;   // shards of the attached queue
+    graph_place_policy_t place;
+    graph_prio_policy_t policy;
+    // Run one ready child of a completed task on the same worker,
+    // without a queue round trip, when it is not behind the queue head
+    int                bypass;
+    // Readiness counter keying the queue under FIFO and LIFO
+    volatile long      ready_seq;
+    // Offset of this run's queue keys, see graph_sched_init_ready()
+    pkey_t             key_base;
+    // Seedings so far, the run tag of the queue entries
+    unsigned long      gen;
+    // Timeline of the next runs, if set (graph_trace.h)
+    graph_trace_t     *trace;
+    // Tasks completed in the current graph_sched_run()
+    volatile long      n_completed;
+    // Statistics of the last graph_sched_run()
+    long               n_inserts;
+    long               n_deletes;
+    long               n_same_node; // tasks run on the node that readied them
+    long               n_bypassed;  // tasks that skipped the queue
+    volatile long      n_wasted;    // dequeued entries not run: stale
+                                    // tag, or task not READY
 } graph_sched_t;
 
-// Constructor helpers
+// Task body run by the executor, on the worker thread that dequeued it
+typedef void (*graph_task_fn_t)(graph_sched_t *gs, int task_id, void *arg);
+
+#define graph_sched_n_deps(gs, i) ((int)((gs)->offsets[(i) + 1] - (gs)->offsets[i]))
+#define graph_sched_deps(gs, i)   (&(gs)->edges[(gs)->offsets[i]])
+
+// Generators (graph_gen.c). n_tasks and degree set the size and the
+// fan-out; the exact task count may differ for the shaped graphs:
+//   random     up to degree children drawn uniformly among later tasks
+//   layered    layers of sqrt(n_tasks) tasks, each task feeding the
+//              degree nearest tasks of the next layer
+//   wavefront  sqrt(n_tasks) square grid, cells enable right and down
+//   forkjoin   degree-ary fork tree mirrored by its join tree
+//   cholesky   tiled Cholesky (POTRF/TRSM/SYRK/GEMM), n_tasks bounds
+//              the task count
+//   lu         tiled LU without pivoting (GETRF/TRSM/GEMM)
+//   powerlaw   as random, with Pareto distributed fan-outs of mean degree
+typedef enum graph_gen_kind {
+    GRAPH_GEN_RANDOM,
+    GRAPH_GEN_LAYERED,
+    GRAPH_GEN_WAVEFRONT,
+    GRAPH_GEN_FORKJOIN,
+    GRAPH_GEN_CHOLESKY,
+    GRAPH_GEN_LU,
+    GRAPH_GEN_POWERLAW,
+} graph_gen_kind_t;
+
+#define GRAPH_GEN_SEED 42
+
+// Build a graph on nthreads threads; the result only depends on kind,
+// n_tasks, degree and seed. No queue is attached.
+graph_sched_t *graph_sched_generate(graph_gen_kind_t kind, int n_tasks, int degree,
+                                    unsigned long seed, int nthreads);
+// Generator from its name as listed above; -1 if unknown
+int            graph_sched_parse_gen(const char *name, graph_gen_kind_t *kind);
+
+// Constructor helpers: random graphs with seed GRAPH_GEN_SEED
+graph_sched_t *graph_sched_create_random(int n_tasks, int edges_per_task); // no queue attached
 graph_sched_t *graph_sched_create_random_prioq(int n_tasks, int edges_per_task);
 graph_sched_t *graph_sched_create_random_numa(int n_tasks, int edges_per_task, int num_nodes);
+graph_sched_t *graph_sched_create_random_hier(int n_tasks, int edges_per_task, int num_nodes);
+
+// Queue backends. Each init fills in qi and returns its number of
+// node shards.
+int  graph_queue_init_prioq(graph_queue_iface_t *qi);
+int  graph_queue_init_numa(graph_queue_iface_t *qi, int num_nodes);
+int  graph_queue_init_hier(graph_queue_iface_t *qi, int num_nodes);
+// Per-worker deques for ready tasks within window keys of the
+// worker's current task, the global pq_t for the others
+int  graph_queue_init_steal(graph_queue_iface_t *qi, pkey_t window);
+// One bucket per priority: exact for the keys of a graph of nbuckets
+// tasks, see task_key()
+int  graph_queue_init_bucket(graph_queue_iface_t *qi, long nbuckets);
+void graph_queue_destroy(graph_queue_iface_t *qi);
+// Backend by name, NULL if unknown
+const graph_queue_backend_t *graph_queue_find(const char *name);
+// Init the named backend (opts may be NULL for a single node); -1 if
+// the name is unknown or opts do not fit
+int  graph_queue_init_by_name(graph_queue_iface_t *qi, const char *name,
+                              const graph_queue_opts_t *opts);
+
+// Attach a backend to a graph built or loaded without a queue
+void graph_sched_attach_prioq(graph_sched_t *gs);
+void graph_sched_attach_numa(graph_sched_t *gs, int num_nodes);
+void graph_sched_attach_hier(graph_sched_t *gs, int num_nodes);
+void graph_sched_attach_steal(graph_sched_t *gs, pkey_t window);
+void graph_sched_attach_bucket(graph_sched_t *gs);
+// Attach the named backend, with one bucket per task; returns the
+// number of node shards, -1 if the name is unknown
+int  graph_sched_attach_by_name(graph_sched_t *gs, const char *name,
+                                const graph_queue_opts_t *opts);
+
+// Graph files (graph_io.c). A text edge list has one "parent child"
+// pair of 0-based task ids per line; lines starting with '#' or '%'
+// are comments. The binary format is the CSR arrays as stored in
+// memory, preceded by a graph_file_hdr_t, and is mapped zero-copy.
+#define GRAPH_FILE_MAGIC "GSCHCSR\0"
+#define GRAPH_FILE_VERSION 1
+// Sections start on cache line boundaries
+#define GRAPH_FILE_ALIGN(x) (((x) + CACHE_LINE_SIZE - 1) & ~(uint64_t)(CACHE_LINE_SIZE - 1))
+
+typedef struct graph_file_hdr {
+    char     magic[8];
+    uint32_t version;
+    uint32_t id_bytes;     // size of a task id in the edge array, 4 or 8
+    uint64_t n_tasks;
+    uint64_t n_edges;
+    // Byte offsets from the start of the file of the int64 offsets
+    // array, the edge array and the int32 initial indegrees
+    uint64_t offsets_pos;
+    uint64_t edges_pos;
+    uint64_t indegree_pos;
+} graph_file_hdr_t;
+
+// Whether count elements of elem bytes at pos lie inside a file of
+// size bytes, aligned to their size. Positions are checked before
+// anything is added to them, so no header can wrap the bounds.
+int            graph_file_section_ok(uint64_t pos, uint64_t count, size_t elem, uint64_t size);
+
+// Text is parsed and turned into CSR on nthreads threads; children
+// lists come out sorted, whatever the order of the lines
+graph_sched_t *graph_sched_load_edgelist(const char *path, int nthreads);
+graph_sched_t *graph_sched_load_csr(const char *path);
+// Binary if the file starts with GRAPH_FILE_MAGIC, else text
+graph_sched_t *graph_sched_load(const char *path, int nthreads);
+int            graph_sched_save_csr(graph_sched_t *gs, const char *path);
+// With id_bytes wide edge ids. Only 4 can be mapped back by
+// graph_sched_load_csr(); 8 is for the streaming executor
+// (graph_stream.h).
+int            graph_sched_save_csr_ids(graph_sched_t *gs, const char *path, int id_bytes);
+
+// Cache line aligned, zeroed array of task records
+graph_task_t  *graph_sched_alloc_tasks(int n_tasks);
+
+// Record the current indegrees as the graph's initial state, and cache
+// its roots. Done by the constructors and loaders; call again after
+// changing the edges.
+void graph_sched_snapshot(graph_sched_t *gs);
+// Restore the initial indegrees, clear the run statistics and seed
+// the ready queue with the roots, for another run of the same graph.
+void graph_sched_reset(graph_sched_t *gs);
 
 // Core API
 void graph_sched_destroy(graph_sched_t *gs);
-void graph_sched_init_ready(graph_sched_t *gs);
+void graph_sched_init_ready(graph_sched_t *gs); // enqueue the roots
 int  graph_sched_extract_min_topo(graph_sched_t *gs);
 int  graph_sched_task_completed(graph_sched_t *gs, int task_id); // Returns number of enqueued children
+// Same, but the ready child with the smallest key is kept in *next
+// instead of being enqueued, if its key is not above the queue head.
+// *next is -1 if there is no such child.
+int  graph_sched_task_completed_next(graph_sched_t *gs, int task_id, int *next);
+
+// Priorities (graph_prio.c). Tasks with a lower prio[i] are dequeued
+// first; ties go to the lower task id.
+void graph_sched_set_priorities(graph_sched_t *gs, const long *prio);
+// Upward rank of every task: cost[i] (1 if cost is NULL) plus the
+// largest rank of its children, computed from the sinks up on
+// nthreads threads. Returns the critical path length, the largest
+// rank, or -1 if the graph has a cycle, leaving the ranks of the tasks
+// on or above it unset.
+long graph_sched_upward_rank(graph_sched_t *gs, const long *cost, long *rank, int nthreads);
+// Select the dequeue order. GRAPH_PRIO_RANK sets the priorities from
+// the upward ranks under cost, and returns the critical path length,
+// or -1 and leaves the priorities as they were if the graph has a
+// cycle; the other policies return 0.
+long graph_sched_set_policy(graph_sched_t *gs, graph_prio_policy_t policy,
+                            const long *cost, int nthreads);
+// Policy from its name: "user", "fifo", "lifo" or "rank". Returns -1
+// for an unknown name.
+int  graph_sched_parse_policy(const char *name, graph_prio_policy_t *policy);
+
+// Validation (graph_check.c). Counts of the defects found by
+// graph_sched_check(); all zero for a graph that can be run.
+typedef struct graph_check {
+    long bad_ids;       // edges to a task id out of range
+    long self_loops;
+    long duplicates;    // edges repeated in a task's children
+    long bad_indegree;  // tasks whose initial indegree is not their
+                        // number of parents
+    long cyclic;        // tasks never reached from the roots: on a
+                        // cycle, or behind one
+    int  levels;        // tasks on the longest path, if acyclic
+} graph_check_t;
+
+// Check the graph on nthreads threads: edge ids, self loops and
+// duplicate edges per task, indegrees against the edges, and
+// acyclicity by a level-synchronous Kahn traversal. Returns 0 if the
+// graph is valid, -1 otherwise; res (if not NULL) gets the counts.
+int  graph_sched_check(graph_sched_t *gs, int nthreads, graph_check_t *res);
+
+// Bytes used by the graph: task records, CSR offsets and edges
+size_t graph_sched_footprint(graph_sched_t *gs, size_t *tasks, size_t *offsets, size_t *edges);
+
+// Executor: runs the whole DAG on nthreads pinned worker threads,
+// calling task_fn (if non-NULL) for each task. The graph is reset
+// first, unless graph_sched_reset() was called since the last run, so
+// it can be run any number of times. Returns the number of tasks
+// executed.
+long graph_sched_run(graph_sched_t *gs, int nthreads, graph_task_fn_t task_fn, void *arg);
 
 #endif
@@ -0,0 +1,225 @@
+/**
+ * Dynamic task graph benchmark.
+ * Tasks spawn their children and a continuation that joins them while
+ * the graph runs (see graph_dyn.h).
+ *
+ * Usage: ./graph_spawn_perf_meas [-n threads] [-q queue] [-m nodes] [-o order] [-w cycles] fib <N>
+ *        ./graph_spawn_perf_meas [-n threads] [-q queue] [-m nodes] [-o order] [-w cycles] tree <depth> <branching>
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gc/gc.h"
+#include "common.h"
+#include "graph_dyn.h"
+
+// Task arguments: the size of the subproblem and the continuation
+// that its result is added to (-1 for the root)
+#define PACK(n, cont)   ((void *)(((uintptr_t)(n) << 32) | (uint32_t)((cont) + 1)))
+#define ARG_N(arg)      ((int)((uintptr_t)(arg) >> 32))
+#define ARG_CONT(arg)   ((int)((uintptr_t)(arg) & 0xffffffffUL) - 1)
+
+static long *val;            // partial sums of the continuations, by task id
+static volatile long result;
+static int top;              // size of the root problem
+static int branching;
+static int dfs;
+static long work;
+
+// Depth-first runs the deepest ready tasks first, breadth-first the
+// shallowest
+static prio_t prio_of(int depth) {
+    return dfs ? top - depth : depth;
+}
+
+static void add_to(int cont, long v) {
+    if (cont < 0)
+        __sync_fetch_and_add(&result, v);
+    else
+        __sync_fetch_and_add(&val[cont], v);
+}
+
+static void spin(void) {
+    uint64_t until = read_tsc_p() + work;
+    while (read_tsc_p() < until)
+        ;
+}
+
+static void join_task(graph_dyn_t *d, int task_id, void *arg) {
+    add_to(ARG_CONT(arg), val[task_id]);
+}
+
+// Spawn a join continuation for the caller's children, which takes
+// over the caller's place in front of cont
+static int spawn_join(graph_dyn_t *d, int depth, int cont) {
+    int j = graph_dyn_add_task(d, prio_of(depth), join_task, PACK(0, cont));
+
+    // cont is held by the running caller, so it cannot start meanwhile
+    if (cont >= 0) graph_dyn_add_edge(d, j, cont);
+    return j;
+}
+
+static void spawn(graph_dyn_t *d, int depth, int n, graph_dyn_fn_t fn, int cont) {
+    int c = graph_dyn_add_task(d, prio_of(depth), fn, PACK(n, cont));
+
+    graph_dyn_add_edge(d, c, cont);
+    graph_dyn_release(d, c);
+}
+
+static void fib_task(graph_dyn_t *d, int task_id, void *arg) {
+    int n = ARG_N(arg), cont = ARG_CONT(arg), j;
+
+    spin();
+    if (n < 2) {
+        add_to(cont, n);
+        return;
+    }
+    j = spawn_join(d, top - n, cont);
+    spawn(d, top - n + 1, n - 1, fib_task, j);
+    spawn(d, top - n + 2, n - 2, fib_task, j);
+    graph_dyn_release(d, j);
+}
+
+// Counts the nodes of a complete tree
+static void tree_task(graph_dyn_t *d, int task_id, void *arg) {
+    int depth = ARG_N(arg), cont = ARG_CONT(arg), j;
+
+    spin();
+    if (depth == top) {
+        add_to(cont, 1);
+        return;
+    }
+    j = spawn_join(d, depth, cont);
+    val[j] = 1;
+    for (int i = 0; i < branching; i++)
+        spawn(d, depth + 1, depth + 1, tree_task, j);
+    graph_dyn_release(d, j);
+}
+
+static void
+usage(FILE *out, const char *argv0)
+{
+    fprintf(out, "Usage: %s [OPTION]... fib N\n", argv0);
+    fprintf(out, "       %s [OPTION]... tree DEPTH BRANCHING\n", argv0);
+    fprintf(out, "\n");
+    fprintf(out, "  -m NODES        Shards of the numa and hier queues (default 1)\n");
+    fprintf(out, "  -n THREADS      Number of worker threads (default 1)\n");
+    fprintf(out, "  -o ORDER        Ready task order: dfs (deepest first) or bfs\n");
+    fprintf(out, "                  (default dfs)\n");
+    fprintf(out, "  -q QUEUE        Queue backend (default pq):\n");
+    // Spawned task keys are unbounded, so bucket is not offered
+    for (const graph_queue_backend_t *b = graph_queue_backends; b->name; b++) {
+        if (strcmp(b->name, "bucket") != 0)
+            fprintf(out, "                    %-8s%s\n", b->name, b->desc);
+    }
+    fprintf(out, "  -w CYCLES       Busy work per spawning task in TSC cycles (default 0)\n");
+    fprintf(out, "  fib N           Recursive Fibonacci, joined by continuation tasks\n");
+    fprintf(out, "  tree D B        Node count of a complete tree of depth D and fan-out B\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    int nthreads = 1, num_nodes = 1, opt, root;
+    char *queue = "pq", *order = "dfs", *load;
+    graph_queue_opts_t qopts = { 0 };
+    long n_tasks, expect, executed;
+    graph_dyn_t *d;
+    struct timespec start, end, elapsed;
+    double dt;
+
+    while ((opt = getopt(argc, argv, "n:q:m:o:w:h")) >= 0) {
+        switch (opt) {
+        case 'n': nthreads = atoi(optarg); break;
+        case 'q': queue = optarg; break;
+        case 'm': num_nodes = atoi(optarg); break;
+        case 'o': order = optarg; break;
+        case 'w': work = atol(optarg); break;
+        case 'h': usage(stdout, argv[0]); exit(EXIT_SUCCESS);
+        default:  usage(stderr, argv[0]); exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind < 2) {
+        usage(stderr, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    load = argv[optind];
+    top = atoi(argv[optind + 1]);
+    branching = argc - optind > 2 ? atoi(argv[optind + 2]) : 0;
+    dfs = strcmp(order, "dfs") == 0;
+
+    // Tasks spawned and the expected result
+    if (strcmp(load, "fib") == 0 && argc - optind == 2 && top >= 0 && top <= 40) {
+        long f0 = 0, f1 = 1, c0 = 1, c1 = 1, t;
+        for (int i = 2; i <= top; i++) {
+            t = f0 + f1; f0 = f1; f1 = t;
+            t = c0 + c1 + 2; c0 = c1; c1 = t;
+        }
+        expect = top == 0 ? 0 : f1;
+        n_tasks = top == 0 ? 1 : c1;
+    } else if (strcmp(load, "tree") == 0 && argc - optind == 3 &&
+               top >= 0 && branching >= 1) {
+        long level = 1;
+        expect = 1;
+        for (int i = 0; i < top && expect < (1L << 30); i++) {
+            level *= branching;
+            expect += level;
+        }
+        // Each internal node spawns a join
+        n_tasks = 2 * expect - level;
+    } else {
+        n_tasks = -1;
+    }
+    if (n_tasks <= 0 || n_tasks >= (1L << 30) || nthreads <= 0 || num_nodes <= 0 ||
+        graph_queue_find(queue) == NULL ||
+        (!dfs && strcmp(order, "bfs") != 0) || work < 0) {
+        fprintf(stderr, "Error: Invalid arguments\n");
+        usage(stderr, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    _init_gc_subsystem();
+
+    d = graph_dyn_create();
+    // Spawned task keys are unbounded, so no buckets
+    qopts.num_nodes = num_nodes;
+    if ((d->n_nodes = graph_queue_init_by_name(&d->qiface, queue, &qopts)) < 0) {
+        fprintf(stderr, "Error: Queue %s does not take spawned tasks\n", queue);
+        exit(EXIT_FAILURE);
+    }
+    E_NULL(val = (long *)calloc(n_tasks, sizeof(long)));
+
+    gettime(&start);
+    root = graph_dyn_add_task(d, prio_of(0), load[0] == 'f' ? fib_task : tree_task,
+                              PACK(load[0] == 'f' ? top : 0, -1));
+    graph_dyn_release(d, root);
+    executed = graph_dyn_run(d, nthreads);
+    gettime(&end);
+    elapsed = timediff(start, end);
+    dt = elapsed.tv_sec + (double)elapsed.tv_nsec / 1000000000.0;
+
+    printf("Threads:    %d\n", nthreads);
+    printf("Queue:      %s (%d nodes)\n", queue, d->n_nodes);
+    if (load[0] == 'f')
+        printf("Workload:   fib %d, %s\n", top, order);
+    else
+        printf("Workload:   tree depth %d, fan-out %d, %s\n", top, branching, order);
+    printf("Tasks:      %ld\n", d->n_tasks);
+    printf("Edges:      %ld (%ld to completed parents)\n", d->n_edges, d->n_late_edges);
+    printf("Total time: %.6f s\n", dt);
+    printf("Tasks/s:    %.0f\n", executed / dt);
+    printf("Result:     %ld (%s)\n", result, result == expect ? "ok" : "WRONG");
+
+    if (executed != n_tasks || d->n_tasks != n_tasks) {
+        fprintf(stderr, "Warning: Executed %ld tasks, expected %ld\n", executed, n_tasks);
+    }
+
+    free(val);
+    graph_dyn_destroy(d);
+    _destroy_gc_subsystem();
+
+    return result == expect ? 0 : 1;
+}
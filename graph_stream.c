@@ -0,0 +1,497 @@
+/**
+ * Out-of-core streaming execution of mapped graph files.
+ *
+ * Readiness is counted up: the counter of a task holds its completed
+ * parents and the task is queued when that reaches the indegree in
+ * the file, so the counters of a window start at zero and need no
+ * initialisation pass over the file. They are allocated per window by
+ * the first completing parent, and freed when the window retires,
+ * which bounds the resident state by the windows that parents have
+ * reached but children have not yet finished.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "graph_stream.h"
+#include "common.h"
+
+typedef struct stream_worker {
+    pthread_t        thread;
+    int              id;
+    graph_stream_t  *s;
+    int64_t          executed;
+    char             pad[128];
+} stream_worker_t;
+
+static graph_sid_t win_lo(const graph_stream_t *s, int64_t w) {
+    return w * s->window;
+}
+
+static graph_sid_t win_hi(const graph_stream_t *s, int64_t w) {
+    return min((w + 1) * s->window, s->n_tasks);
+}
+
+graph_stream_t *graph_stream_open(const char *path, graph_sid_t window, int resident,
+                                  int prefetch) {
+    graph_stream_t *s;
+    graph_file_hdr_t *hdr;
+    struct stat st;
+    void *map;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        perror(path);
+        return NULL;
+    }
+    E(fstat(fd, &st));
+    if ((size_t)st.st_size < sizeof(graph_file_hdr_t)) {
+        fprintf(stderr, "%s: not a graph file\n", path);
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    hdr = (graph_file_hdr_t *)map;
+    if (memcmp(hdr->magic, GRAPH_FILE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != GRAPH_FILE_VERSION ||
+        (hdr->id_bytes != sizeof(int32_t) && hdr->id_bytes != sizeof(int64_t)) ||
+        hdr->n_tasks == 0 || hdr->n_tasks >= INT64_MAX / 2 ||
+        !graph_file_section_ok(hdr->offsets_pos, hdr->n_tasks + 1, sizeof(int64_t), st.st_size) ||
+        !graph_file_section_ok(hdr->edges_pos, hdr->n_edges, hdr->id_bytes, st.st_size) ||
+        !graph_file_section_ok(hdr->indegree_pos, hdr->n_tasks, sizeof(int32_t), st.st_size)) {
+        fprintf(stderr, "%s: unsupported or corrupt graph file\n", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    E_en(posix_memalign((void **)&s, CACHE_LINE_SIZE, sizeof(graph_stream_t)));
+    memset(s, 0, sizeof(graph_stream_t));
+    s->map = map;
+    s->map_len = st.st_size;
+    s->id_bytes = (int)hdr->id_bytes;
+    s->n_tasks = (graph_sid_t)hdr->n_tasks;
+    s->n_edges = (int64_t)hdr->n_edges;
+    s->offsets = (const int64_t *)((char *)map + hdr->offsets_pos);
+    s->edges = (const void *)((char *)map + hdr->edges_pos);
+    s->indegree = (const int32_t *)((char *)map + hdr->indegree_pos);
+
+    s->window = window > 0 ? window : GRAPH_STREAM_WINDOW;
+    s->resident = resident > 0 ? resident : GRAPH_STREAM_RESIDENT;
+    s->prefetch = prefetch > 0 ? prefetch : GRAPH_STREAM_PREFETCH;
+    s->n_windows = (s->n_tasks + s->window - 1) / s->window;
+    E_NULL(s->counts = (volatile int32_t * volatile *)calloc(s->n_windows, sizeof(int32_t *)));
+    E_NULL(s->done = (volatile int64_t *)calloc(s->n_windows, sizeof(int64_t)));
+    return s;
+}
+
+void graph_stream_close(graph_stream_t *s) {
+    if (s == NULL) return;
+
+    for (int64_t w = 0; w < s->n_windows; w++)
+        free((void *)s->counts[w]);
+    free((void *)s->counts);
+    free((void *)s->done);
+    graph_queue_destroy(&s->qiface);
+    munmap(s->map, s->map_len);
+    free(s);
+}
+
+int64_t graph_stream_n_deps(const graph_stream_t *s, graph_sid_t task_id) {
+    return s->offsets[task_id + 1] - s->offsets[task_id];
+}
+
+static graph_sid_t edge_at(const graph_stream_t *s, int64_t k) {
+    if (s->id_bytes == sizeof(int32_t))
+        return ((const int32_t *)s->edges)[k];
+    return ((const int64_t *)s->edges)[k];
+}
+
+graph_sid_t graph_stream_dep(const graph_stream_t *s, graph_sid_t task_id, int64_t k) {
+    return edge_at(s, s->offsets[task_id] + k);
+}
+
+// Apply advice to the pages of [lo, hi): all pages it touches to map
+// them in, only those it covers to drop them, as its neighbours may
+// still be in use
+static void advise(const void *lo, const void *hi, int advice) {
+    uintptr_t page = sysconf(_SC_PAGESIZE), a = (uintptr_t)lo, b = (uintptr_t)hi;
+
+    if (advice == MADV_DONTNEED) {
+        a = (a + page - 1) & ~(page - 1);
+        b &= ~(page - 1);
+    } else {
+        a &= ~(page - 1);
+        b = (b + page - 1) & ~(page - 1);
+    }
+    if (a < b) madvise((void *)a, b - a, advice);
+}
+
+// Offsets are only checked as they are used, as the file may not fit
+// in memory: a range that leaves the edge array stops the run
+static int edges_ok(graph_stream_t *s, int64_t a, int64_t b) {
+    if (a >= 0 && a <= b && b <= s->n_edges) return 1;
+    s->error = 1;
+    return 0;
+}
+
+static int window_ok(graph_stream_t *s, int64_t w) {
+    return edges_ok(s, s->offsets[win_lo(s, w)], s->offsets[win_hi(s, w)]);
+}
+
+static void advise_window(graph_stream_t *s, int64_t w, int advice) {
+    graph_sid_t lo = win_lo(s, w), hi = win_hi(s, w);
+
+    if (!window_ok(s, w)) return;
+
+    advise(&s->offsets[lo], &s->offsets[hi + 1], advice);
+    advise((const char *)s->edges + s->offsets[lo] * s->id_bytes,
+           (const char *)s->edges + s->offsets[hi] * s->id_bytes, advice);
+    advise(&s->indegree[lo], &s->indegree[hi], advice);
+}
+
+// Fault in every page of [lo, hi)
+static void touch(const void *lo, const void *hi) {
+    long page = sysconf(_SC_PAGESIZE);
+    volatile char sink = 0;
+
+    for (const volatile char *p = lo; p < (const char *)hi; p += page)
+        sink += *p;
+    (void)sink;
+}
+
+static void prefetch_window(graph_stream_t *s, int64_t w) {
+    graph_sid_t lo = win_lo(s, w), hi = win_hi(s, w);
+
+    if (!window_ok(s, w)) return;
+    advise_window(s, w, MADV_WILLNEED);
+    touch(&s->offsets[lo], &s->offsets[hi + 1]);
+    touch((const char *)s->edges + s->offsets[lo] * s->id_bytes,
+          (const char *)s->edges + s->offsets[hi] * s->id_bytes);
+    touch(&s->indegree[lo], &s->indegree[hi]);
+}
+
+// Runs ahead of admission until the last window has retired
+static void *prefetch_run(void *_s) {
+    graph_stream_t *s = (graph_stream_t *)_s;
+    int64_t p;
+
+    while (!s->error && s->base < s->n_windows) {
+        p = max(s->prefetched, s->base);
+        if (p < s->prefetch_to) {
+            prefetch_window(s, p);
+            s->prefetched = p + 1;
+        } else {
+            usleep(50);
+        }
+    }
+    return NULL;
+}
+
+static volatile int32_t *counts_of(graph_stream_t *s, int64_t w) {
+    volatile int32_t *c = s->counts[w];
+    long live, m;
+
+    if (c != NULL) return c;
+    E_NULL(c = (volatile int32_t *)calloc(win_hi(s, w) - win_lo(s, w), sizeof(int32_t)));
+    if (!__sync_bool_compare_and_swap(&s->counts[w], NULL, c)) {
+        free((void *)c);
+        return s->counts[w];
+    }
+    live = __sync_add_and_fetch(&s->live_counts, 1);
+    while (live > (m = s->max_live_counts) &&
+           !__sync_bool_compare_and_swap(&s->max_live_counts, m, live))
+        ;
+    return c;
+}
+
+static void flush(graph_stream_t *s, pkey_t *keys, pval_t *vals, int n) {
+    s->qiface.insert_batch(s->qiface.q, keys, vals, n, -1);
+    __sync_fetch_and_add(&s->n_inserted, n);
+}
+
+static void push(graph_stream_t *s, pkey_t *keys, pval_t *vals, int *n, graph_sid_t id) {
+    keys[*n] = (pkey_t)id + 1;
+    vals[*n] = (pval_t)(uintptr_t)(id + 1);
+    if (++*n == GRAPH_BATCH) {
+        flush(s, keys, vals, *n);
+        *n = 0;
+    }
+}
+
+// Queue the roots of window w
+static void admit(graph_stream_t *s, int64_t w) {
+    pkey_t keys[GRAPH_BATCH];
+    pval_t vals[GRAPH_BATCH];
+    int n = 0;
+
+    if (!window_ok(s, w)) return;
+    for (graph_sid_t i = win_lo(s, w); i < win_hi(s, w); i++) {
+        if (s->indegree[i] == 0)
+            push(s, keys, vals, &n, i);
+    }
+    if (n > 0) flush(s, keys, vals, n);
+}
+
+static void retire(graph_stream_t *s, int64_t w) {
+    volatile int32_t *c = s->counts[w];
+
+    if (c != NULL) {
+        s->counts[w] = NULL;
+        free((void *)c);
+        __sync_fetch_and_sub(&s->live_counts, 1);
+    }
+    advise_window(s, w, MADV_DONTNEED);
+}
+
+// Retire the oldest windows while they are complete, and admit as many
+static void advance(graph_stream_t *s) {
+    int64_t b;
+
+    while ((b = s->base) < s->n_windows && s->done[b] == win_hi(s, b) - win_lo(s, b)) {
+        if (!__sync_bool_compare_and_swap(&s->base, b, b + 1)) continue;
+        retire(s, b);
+        if (b + s->resident < s->n_windows) admit(s, b + s->resident);
+        s->prefetch_to = min(b + 1 + s->resident + s->prefetch, s->n_windows);
+    }
+}
+
+// Count the completion of id in its children, and queue those that
+// have no parent left
+static void complete(graph_stream_t *s, graph_sid_t id) {
+    pkey_t keys[GRAPH_BATCH];
+    pval_t vals[GRAPH_BATCH];
+    int n = 0;
+    graph_sid_t c;
+    int64_t w;
+
+    if (!edges_ok(s, s->offsets[id], s->offsets[id + 1])) return;
+    for (int64_t k = s->offsets[id]; k < s->offsets[id + 1]; k++) {
+        c = edge_at(s, k);
+        if (c <= id || c >= s->n_tasks) {
+            s->error = 1;
+            break;
+        }
+        w = c / s->window;
+        if (__sync_add_and_fetch(&counts_of(s, w)[c - win_lo(s, w)], 1) != s->indegree[c])
+            continue;
+        if (w >= s->base + s->resident)
+            __sync_fetch_and_add(&s->n_early, 1);
+        push(s, keys, vals, &n, c);
+    }
+    if (n > 0) flush(s, keys, vals, n);
+}
+
+// Nothing queued, nothing running, and nothing taken while we looked:
+// no task can become ready any more. Only tasks in flight insert, so
+// once every task taken has completed, the inserts are final.
+static int stalled(graph_stream_t *s) {
+    int64_t taken = s->n_taken;
+
+    __sync_synchronize();
+    if (s->n_completed != taken || s->n_inserted != taken) return 0;
+    __sync_synchronize();
+    return s->n_taken == taken && s->base < s->n_windows;
+}
+
+static void *stream_worker_run(void *_w) {
+    stream_worker_t *w = (stream_worker_t *)_w;
+    graph_stream_t *s = w->s;
+    graph_sid_t id;
+    int64_t win;
+    pval_t v;
+
+#if defined(__linux__)
+    pin(gettid(), w->id % sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+    numa_priq_set_local_node(w->id);
+
+    while (!s->error && s->base < s->n_windows) {
+        v = s->qiface.delete_min(s->qiface.q);
+        if (v == NULL) {
+            if (stalled(s)) s->error = 1;
+            __asm__ __volatile__ ("pause");
+            continue;
+        }
+        __sync_fetch_and_add(&s->n_taken, 1);
+        id = (graph_sid_t)(uintptr_t)v - 1;
+        if (s->fn) s->fn(id, s->arg);
+        complete(s, id);
+        w->executed++;
+        win = id / s->window;
+        if (__sync_add_and_fetch(&s->done[win], 1) == win_hi(s, win) - win_lo(s, win))
+            advance(s);
+        __sync_fetch_and_add(&s->n_completed, 1);
+    }
+    return NULL;
+}
+
+int64_t graph_stream_run(graph_stream_t *s, int nthreads, graph_stream_fn_t fn, void *arg) {
+    stream_worker_t *ws;
+    pthread_t prefetcher;
+    int64_t executed = 0;
+
+    if (nthreads < 1) nthreads = 1;
+    if (s->qiface.q == NULL) graph_queue_init_prioq(&s->qiface);
+    // Leftovers of a run that stopped early
+    while (s->qiface.delete_min(s->qiface.q) != NULL)
+        ;
+    for (int64_t w = 0; w < s->n_windows; w++) {
+        free((void *)s->counts[w]);
+        s->counts[w] = NULL;
+        s->done[w] = 0;
+    }
+    s->base = 0;
+    s->live_counts = s->max_live_counts = 0;
+    s->n_early = 0;
+    s->error = 0;
+    s->n_inserted = s->n_taken = s->n_completed = 0;
+    s->fn = fn;
+    s->arg = arg;
+
+    s->prefetched = 0;
+    s->prefetch_to = min((int64_t)s->resident + s->prefetch, s->n_windows);
+    E_en(pthread_create(&prefetcher, NULL, prefetch_run, s));
+    for (int64_t w = 0; w < min((int64_t)s->resident, s->n_windows); w++)
+        admit(s, w);
+
+    E_en(posix_memalign((void **)&ws, CACHE_LINE_SIZE, nthreads * sizeof(stream_worker_t)));
+    memset(ws, 0, nthreads * sizeof(stream_worker_t));
+    for (int i = 0; i < nthreads; i++) {
+        ws[i].id = i;
+        ws[i].s = s;
+        E_en(pthread_create(&ws[i].thread, NULL, stream_worker_run, &ws[i]));
+    }
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(ws[i].thread, NULL);
+        executed += ws[i].executed;
+    }
+    pthread_join(prefetcher, NULL);
+    free(ws);
+    return s->error ? -1 : executed;
+}
+
+// splitmix64, seeded per task as in the generators
+static inline uint64_t stream_rand(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15UL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+    return z ^ (z >> 31);
+}
+
+static int sid_cmp(const void *a, const void *b) {
+    graph_sid_t x = *(const graph_sid_t *)a, y = *(const graph_sid_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// The three sections are written sequentially through their own
+// streams. Indegrees are counted in a ring of span + 1 tasks: the
+// parents of task i are all among the span tasks before it, so its
+// count is final once i is reached.
+int graph_stream_write_random(const char *path, graph_sid_t n_tasks, int degree,
+                              graph_sid_t span, uint64_t seed) {
+    graph_file_hdr_t hdr;
+    FILE *fo = NULL, *fe = NULL, *fi = NULL;
+    graph_sid_t *out, m;
+    int32_t *ring;
+    int64_t off = 0, e, d;
+    uint64_t x;
+    int rc = 0;
+
+    if (n_tasks < 1 || degree < 0 || span < 1) return -1;
+    e = min((int64_t)degree, span);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, GRAPH_FILE_MAGIC, sizeof(hdr.magic));
+    hdr.version = GRAPH_FILE_VERSION;
+    hdr.id_bytes = sizeof(int64_t);
+    hdr.n_tasks = n_tasks;
+    // e children each, fewer for the last e tasks
+    hdr.n_edges = max(n_tasks - e, (int64_t)0) * e;
+    for (graph_sid_t i = max(n_tasks - e, (int64_t)0); i < n_tasks; i++)
+        hdr.n_edges += min(e, n_tasks - 1 - i);
+    hdr.offsets_pos = GRAPH_FILE_ALIGN(sizeof(hdr));
+    hdr.edges_pos = GRAPH_FILE_ALIGN(hdr.offsets_pos + (hdr.n_tasks + 1) * sizeof(int64_t));
+    hdr.indegree_pos = GRAPH_FILE_ALIGN(hdr.edges_pos + hdr.n_edges * sizeof(int64_t));
+
+    if ((fo = fopen(path, "w")) == NULL || fwrite(&hdr, sizeof(hdr), 1, fo) != 1 ||
+        (fe = fopen(path, "r+")) == NULL || (fi = fopen(path, "r+")) == NULL ||
+        fseeko(fo, (off_t)hdr.offsets_pos, SEEK_SET) != 0 ||
+        fseeko(fe, (off_t)hdr.edges_pos, SEEK_SET) != 0 ||
+        fseeko(fi, (off_t)hdr.indegree_pos, SEEK_SET) != 0) {
+        perror(path);
+        if (fo) fclose(fo);
+        if (fe) fclose(fe);
+        if (fi) fclose(fi);
+        return -1;
+    }
+    setvbuf(fo, NULL, _IOFBF, 1 << 20);
+    setvbuf(fe, NULL, _IOFBF, 1 << 20);
+    setvbuf(fi, NULL, _IOFBF, 1 << 20);
+    E_NULL(ring = (int32_t *)calloc(span + 1, sizeof(int32_t)));
+    E_NULL(out = (graph_sid_t *)malloc((e + 1) * sizeof(graph_sid_t)));
+
+    for (graph_sid_t i = 0; i < n_tasks && rc == 0; i++) {
+        if (fwrite(&ring[i % (span + 1)], sizeof(int32_t), 1, fi) != 1 ||
+            fwrite(&off, sizeof(int64_t), 1, fo) != 1)
+            rc = -1;
+        ring[i % (span + 1)] = 0;
+
+        // d distinct children among the m tasks after i
+        m = min(span, n_tasks - 1 - i);
+        d = min(e, m);
+        if (d == m) {
+            for (int64_t k = 0; k < d; k++)
+                out[k] = i + 1 + k;
+        } else {
+            x = seed ^ ((uint64_t)i * 0xd1b54a32d192ed03UL);
+            for (int64_t k = 0; k < d; ) {
+                int64_t j;
+                out[k] = i + 1 + (graph_sid_t)(stream_rand(&x) % m);
+                for (j = 0; j < k && out[j] != out[k]; j++)
+                    ;
+                if (j == k) k++;
+            }
+            qsort(out, d, sizeof(graph_sid_t), sid_cmp);
+        }
+        for (int64_t k = 0; k < d; k++)
+            ring[out[k] % (span + 1)]++;
+        if (d > 0 && fwrite(out, sizeof(graph_sid_t), d, fe) != (size_t)d)
+            rc = -1;
+        off += d;
+    }
+    if (rc == 0 && fwrite(&off, sizeof(int64_t), 1, fo) != 1) rc = -1;
+    if (rc < 0) perror(path);
+    if (fclose(fo) != 0 || fclose(fe) != 0 || fclose(fi) != 0) rc = -1;
+    free(out);
+    free(ring);
+    return rc;
+}
+
+size_t graph_stream_rss(void) {
+    unsigned long pages = 0;
+    FILE *f;
+
+    if ((f = fopen("/proc/self/statm", "r")) == NULL) return 0;
+    if (fscanf(f, "%*s %lu", &pages) != 1) pages = 0;
+    fclose(f);
+    return (size_t)pages * sysconf(_SC_PAGESIZE);
+}
+
+size_t graph_stream_peak_rss(void) {
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+    // kilobytes on Linux
+    return (size_t)ru.ru_maxrss * 1024;
+}
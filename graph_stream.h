@@ -0,0 +1,96 @@
+#ifndef GRAPH_STREAM_H
+#define GRAPH_STREAM_H
+
+#include "graph_sched.h"
+
+// Out-of-core execution of graph files (graph_sched.h) too large to be
+// loaded. The file is mapped, not read: edges and indegrees are taken
+// from the mapping as tasks run, and only the state of the active
+// frontier is kept in memory.
+//
+// Task ids must be a topological order, as in the files written by
+// the generators: every edge goes from a lower id to a higher one.
+// Tasks are admitted in windows of consecutive ids. A window's roots
+// are queued when it is admitted, its other tasks when their last
+// parent completes, which may be before the window is admitted. The
+// resident oldest unfinished windows are admitted at any time; when
+// the oldest one has completed, it is retired: its counters are freed
+// and its part of the mapping dropped, and the next window is
+// admitted. A prefetch thread maps in the windows up to prefetch
+// ahead of admission, so that workers rarely fault on the file.
+#define GRAPH_STREAM_WINDOW   (1 << 16)
+#define GRAPH_STREAM_RESIDENT 4
+#define GRAPH_STREAM_PREFETCH 2
+
+// Task ids are 64-bit, whatever the width of the ids in the file
+typedef int64_t graph_sid_t;
+
+typedef void (*graph_stream_fn_t)(graph_sid_t task_id, void *arg);
+
+typedef struct graph_stream {
+    void                   *map;
+    size_t                  map_len;
+    int                     id_bytes;
+    graph_sid_t             n_tasks;
+    int64_t                 n_edges;
+    const int64_t          *offsets;
+    const void             *edges;
+    const int32_t          *indegree;
+
+    graph_sid_t             window;      // tasks per window
+    int64_t                 n_windows;
+    int                     resident;
+    int                     prefetch;
+    // Completed parents of each task of a window, allocated by the
+    // first completion of a parent, freed when the window retires
+    volatile int32_t * volatile *counts;
+    volatile int64_t       *done;        // completed tasks per window
+    volatile int64_t        base;        // oldest unfinished window
+    volatile int64_t        prefetch_to; // prefetch windows below this
+    volatile int64_t        prefetched;
+    graph_queue_iface_t     qiface;
+
+    // Statistics of the last run
+    volatile long           live_counts;  // counter arrays allocated
+    long                    max_live_counts;
+    volatile long           n_early;      // tasks ready before admission
+    volatile int            error;        // a bad edge or offset, or a stall
+    // Queue traffic, to tell a stalled run from a busy one
+    volatile int64_t        n_inserted;
+    volatile int64_t        n_taken;
+    volatile int64_t        n_completed;
+    graph_stream_fn_t       fn;
+    void                   *arg;
+} graph_stream_t;
+
+// Map a graph file. window, resident and prefetch default to the
+// GRAPH_STREAM_ constants when 0 or less. NULL if the file cannot be
+// mapped or is not a graph file.
+graph_stream_t *graph_stream_open(const char *path, graph_sid_t window, int resident,
+                                  int prefetch);
+void            graph_stream_close(graph_stream_t *s);
+
+// Run every task once on nthreads pinned workers, through the
+// attached queue (pq if none). Returns the number of tasks executed,
+// or -1 if the file is not topologically ordered: an edge that is not
+// forward was found, or tasks are left that nothing will make ready.
+// Also -1 if the offsets of a window or task leave the edge array;
+// they are checked as windows are reached. The run then stops early.
+int64_t graph_stream_run(graph_stream_t *s, int nthreads, graph_stream_fn_t fn, void *arg);
+
+// Children of a task, in the file's id width
+int64_t     graph_stream_n_deps(const graph_stream_t *s, graph_sid_t task_id);
+graph_sid_t graph_stream_dep(const graph_stream_t *s, graph_sid_t task_id, int64_t k);
+
+// Write a random graph with 64-bit ids straight to a file, in one
+// sequential pass: task i gets degree distinct children among the
+// span tasks that follow it. Memory use only depends on span and
+// degree, so the graph may be far larger than memory.
+int graph_stream_write_random(const char *path, graph_sid_t n_tasks, int degree,
+                              graph_sid_t span, uint64_t seed);
+
+// Resident set size of the process, and its peak, in bytes
+size_t graph_stream_rss(void);
+size_t graph_stream_peak_rss(void);
+
+#endif
@@ -0,0 +1,161 @@
+/**
+ * Out-of-core task graph benchmark.
+ * Streams a mapped graph file through the windowed executor of
+ * graph_stream.h, optionally after writing a random graph with 64-bit
+ * ids of any size to it, and reports throughput and memory use.
+ *
+ * Usage: ./graph_stream_perf_meas [-n threads] [-q queue] [-m nodes] [-W tasks] [-R windows]
+ *                                 [-p windows] [-w cycles] <file>
+ *        ./graph_stream_perf_meas [...] [-S seed] -r <n_tasks> <degree> <span> <file>
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gc/gc.h"
+#include "common.h"
+#include "graph_stream.h"
+
+static uint64_t work;
+
+static void task(graph_sid_t id, void *arg) {
+    uint64_t until;
+
+    if (work == 0) return;
+    until = read_tsc_p() + work;
+    while (read_tsc_p() < until)
+        ;
+}
+
+static double seconds(struct timespec start, struct timespec end) {
+    struct timespec d = timediff(start, end);
+    return d.tv_sec + (double)d.tv_nsec / 1000000000.0;
+}
+
+static void
+usage(FILE *out, const char *argv0)
+{
+    fprintf(out, "Usage: %s [OPTION]... FILE\n", argv0);
+    fprintf(out, "       %s [OPTION]... -r N_TASKS DEGREE SPAN FILE\n", argv0);
+    fprintf(out, "\n");
+    fprintf(out, "  FILE            Binary graph file with topologically ordered ids\n");
+    fprintf(out, "  -m NODES        Shards of the numa and hier queues (default 1)\n");
+    fprintf(out, "  -n THREADS      Number of worker threads (default 1)\n");
+    fprintf(out, "  -p WINDOWS      Windows prefetched ahead of admission (default %d)\n",
+            GRAPH_STREAM_PREFETCH);
+    fprintf(out, "  -q QUEUE        Queue backend (default pq):\n");
+    // Stream keys are 64-bit task ids, too many for buckets
+    for (const graph_queue_backend_t *b = graph_queue_backends; b->name; b++) {
+        if (strcmp(b->name, "bucket") != 0)
+            fprintf(out, "                    %-8s%s\n", b->name, b->desc);
+    }
+    fprintf(out, "  -R WINDOWS      Windows admitted at a time (default %d)\n",
+            GRAPH_STREAM_RESIDENT);
+    fprintf(out, "  -r              Write a random graph to FILE first: DEGREE children\n");
+    fprintf(out, "                  per task among the SPAN tasks after it, 64-bit ids\n");
+    fprintf(out, "  -S SEED         Generator seed (default %d)\n", GRAPH_GEN_SEED);
+    fprintf(out, "  -W TASKS        Tasks per window (default %d)\n", GRAPH_STREAM_WINDOW);
+    fprintf(out, "  -w CYCLES       Busy work per task in TSC cycles (default 0)\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    int nthreads = 1, num_nodes = 1, resident = 0, prefetch = 0, gen = 0, opt;
+    char *queue = "pq", *path;
+    graph_sid_t window = 0, n_tasks = 0, span = 0;
+    int degree = 0;
+    uint64_t seed = GRAPH_GEN_SEED;
+    graph_queue_opts_t qopts = { 0 };
+    graph_stream_t *s;
+    size_t rss_open;
+    int64_t executed;
+    struct timespec start, end;
+    double dt;
+
+    while ((opt = getopt(argc, argv, "n:q:m:W:R:p:w:rS:h")) >= 0) {
+        switch (opt) {
+        case 'n': nthreads = atoi(optarg); break;
+        case 'q': queue = optarg; break;
+        case 'm': num_nodes = atoi(optarg); break;
+        case 'W': window = atoll(optarg); break;
+        case 'R': resident = atoi(optarg); break;
+        case 'p': prefetch = atoi(optarg); break;
+        case 'w': work = strtoull(optarg, NULL, 10); break;
+        case 'r': gen = 1; break;
+        case 'S': seed = strtoull(optarg, NULL, 10); break;
+        case 'h': usage(stdout, argv[0]); exit(EXIT_SUCCESS);
+        default:  usage(stderr, argv[0]); exit(EXIT_FAILURE);
+        }
+    }
+    if (gen && argc - optind == 4) {
+        n_tasks = atoll(argv[optind]);
+        degree = atoi(argv[optind + 1]);
+        span = atoll(argv[optind + 2]);
+    }
+    if (argc - optind != (gen ? 4 : 1) || (gen && (n_tasks < 1 || degree < 0 || span < 1)) ||
+        nthreads <= 0 || num_nodes <= 0 || window < 0 || resident < 0 || prefetch < 0 ||
+        graph_queue_find(queue) == NULL) {
+        fprintf(stderr, "Error: Invalid arguments\n");
+        usage(stderr, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    path = argv[argc - 1];
+
+    _init_gc_subsystem();
+
+    if (gen) {
+        gettime(&start);
+        if (graph_stream_write_random(path, n_tasks, degree, span, seed) < 0) {
+            fprintf(stderr, "Error: Cannot write %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+        gettime(&end);
+        printf("Generated:  %s in %.6f s\n", path, seconds(start, end));
+    }
+    if ((s = graph_stream_open(path, window, resident, prefetch)) == NULL)
+        exit(EXIT_FAILURE);
+    qopts.num_nodes = num_nodes;
+    if (graph_queue_init_by_name(&s->qiface, queue, &qopts) < 0) {
+        fprintf(stderr, "Error: Queue %s does not take streamed tasks\n", queue);
+        exit(EXIT_FAILURE);
+    }
+    rss_open = graph_stream_rss();
+
+    gettime(&start);
+    executed = graph_stream_run(s, nthreads, task, NULL);
+    gettime(&end);
+    dt = seconds(start, end);
+
+    printf("Threads:    %d\n", nthreads);
+    printf("Queue:      %s\n", queue);
+    printf("Graph:      %" PRId64 " tasks, %" PRId64 " edges, %d-byte ids\n",
+           s->n_tasks, s->n_edges, s->id_bytes);
+    printf("File:       %.1f MB\n", s->map_len / 1e6);
+    printf("Windows:    %" PRId64 " of %" PRId64 " tasks, %d admitted, %d prefetched\n",
+           s->n_windows, s->window, s->resident, s->prefetch);
+    printf("Total time: %.6f s\n", dt);
+    printf("Tasks/s:    %.0f\n", executed / dt);
+    printf("Edges/s:    %.0f\n", s->n_edges / dt);
+    printf("Streamed:   %.1f MB/s\n", s->map_len / 1e6 / dt);
+    printf("RSS:        %.1f MB at open, %.1f MB after, %.1f MB peak\n",
+           rss_open / 1e6, graph_stream_rss() / 1e6, graph_stream_peak_rss() / 1e6);
+    printf("Counters:   %ld windows at most (%.1f MB)\n", s->max_live_counts,
+           s->max_live_counts * s->window * sizeof(int32_t) / 1e6);
+    printf("Early:      %ld tasks ready before admission\n", s->n_early);
+
+    if (executed != s->n_tasks) {
+        if (executed < 0)
+            fprintf(stderr, "Error: %s has an edge that is not forward\n", path);
+        else
+            fprintf(stderr, "Warning: Executed %" PRId64 " tasks, expected %" PRId64 "\n",
+                    executed, s->n_tasks);
+    }
+
+    graph_stream_close(s);
+    _destroy_gc_subsystem();
+
+    return executed == s->n_tasks ? 0 : 1;
+}
@@ -0,0 +1,220 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "graph_trace.h"
+
+graph_trace_t *graph_trace_create(int nthreads, long cap) {
+    graph_trace_t *tr;
+    long c = 1;
+
+    if (nthreads < 1) nthreads = 1;
+    while (c < cap) c <<= 1;
+    E_NULL(tr = (graph_trace_t *)calloc(1, sizeof(graph_trace_t)));
+    tr->nthreads = nthreads;
+    tr->cap = c;
+    E_en(posix_memalign((void **)&tr->rings, CACHE_LINE_SIZE, nthreads * sizeof(graph_trace_ring_t)));
+    memset(tr->rings, 0, nthreads * sizeof(graph_trace_ring_t));
+    for (int i = 0; i < nthreads; i++)
+        E_NULL(tr->rings[i].recs = (graph_trace_rec_t *)malloc(c * sizeof(graph_trace_rec_t)));
+    return tr;
+}
+
+void graph_trace_destroy(graph_trace_t *tr) {
+    if (tr == NULL) return;
+    for (int i = 0; i < tr->nthreads; i++)
+        free(tr->rings[i].recs);
+    free(tr->rings);
+    free(tr);
+}
+
+void graph_trace_clear(graph_trace_t *tr) {
+    for (int i = 0; i < tr->nthreads; i++)
+        tr->rings[i].n = 0;
+}
+
+// Records kept by a worker, oldest first
+static long ring_len(graph_trace_t *tr, int w) {
+    return min(tr->rings[w].n, tr->cap);
+}
+
+static graph_trace_rec_t *ring_rec(graph_trace_t *tr, int w, long i) {
+    graph_trace_ring_t *r = &tr->rings[w];
+    long first = r->n > tr->cap ? r->n - tr->cap : 0;
+    return &r->recs[(first + i) & (tr->cap - 1)];
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static const char *fmt_pow2(uint64_t v, char *buf) {
+    static const char *suffix[] = { "", "K", "M", "G", "T", "P" };
+    int s = 0;
+
+    while (v >= 1024 && s < 5) {
+        v /= 1024;
+        s++;
+    }
+    sprintf(buf, "%lu%s", (unsigned long)v, suffix[s]);
+    return buf;
+}
+
+// Summary and log2 histogram of n values, sorted in place
+static void hist(FILE *out, const char *name, uint64_t *v, long n) {
+    long bucket[65] = { 0 }, top = 0;
+    int lo = 64, hi = 0;
+    double sum = 0;
+    char a[16], b[16];
+
+    if (n == 0) {
+        fprintf(out, "%s: no samples\n", name);
+        return;
+    }
+    qsort(v, n, sizeof(uint64_t), cmp_u64);
+    for (long i = 0; i < n; i++) {
+        // bucket k > 0 holds [2^(k-1), 2^k)
+        int k = v[i] ? 64 - __builtin_clzll(v[i]) : 0;
+        bucket[k]++;
+        sum += v[i];
+    }
+    for (int k = 0; k <= 64; k++) {
+        if (bucket[k] == 0) continue;
+        lo = min(lo, k);
+        hi = max(hi, k);
+        top = max(top, bucket[k]);
+    }
+    fprintf(out, "%s (cycles): n %ld, mean %.0f, p50 %lu, p90 %lu, p99 %lu, max %lu\n",
+            name, n, sum / n, (unsigned long)v[n / 2], (unsigned long)v[n * 9 / 10],
+            (unsigned long)v[n * 99 / 100], (unsigned long)v[n - 1]);
+    for (int k = lo; k <= hi; k++) {
+        int bar = (int)((40 * bucket[k] + top - 1) / top);
+        fprintf(out, "  %6s .. %-6s %10ld  %.*s\n",
+                k ? fmt_pow2(1UL << (k - 1), a) : "0", fmt_pow2(k ? 1UL << k : 1, b),
+                bucket[k], bar, "########################################");
+    }
+}
+
+// Top level of every task: the longest path to it from a root under
+// cost, the earliest start with unbounded workers
+static void top_level(graph_sched_t *gs, const long *cost, long *tlevel) {
+    int n = gs->n_tasks, head = 0, tail = 0;
+    int *left, *order;
+
+    E_NULL(left = (int *)malloc(n * sizeof(int)));
+    E_NULL(order = (int *)malloc(n * sizeof(int)));
+    memcpy(left, gs->init_indegree, n * sizeof(int));
+    memset(tlevel, 0, n * sizeof(long));
+    for (int i = 0; i < gs->n_roots; i++)
+        order[tail++] = gs->roots[i];
+    while (head < tail) {
+        int t = order[head++];
+        const int *deps = graph_sched_deps(gs, t);
+        for (int j = 0; j < graph_sched_n_deps(gs, t); j++) {
+            int c = deps[j];
+            tlevel[c] = max(tlevel[c], tlevel[t] + cost[t]);
+            if (--left[c] == 0) order[tail++] = c;
+        }
+    }
+    free(left);
+    free(order);
+}
+
+void graph_trace_report(graph_trace_t *tr, graph_sched_t *gs, FILE *out) {
+    int workers = min(tr->workers, tr->nthreads);
+    long n = 0, m = 0, dropped = 0, missing = 0;
+    uint64_t *v, span = tr->t1 - tr->t0, busy = 0, prev;
+    long *cost, *rank, *tlevel, cp;
+
+    for (int w = 0; w < workers; w++) {
+        n += ring_len(tr, w);
+        dropped += tr->rings[w].n - ring_len(tr, w);
+    }
+    E_NULL(v = (uint64_t *)malloc((n + 2 * workers + 1) * sizeof(uint64_t)));
+
+    // Ready to start
+    for (int w = 0; w < workers; w++) {
+        for (long i = 0; i < ring_len(tr, w); i++) {
+            graph_trace_rec_t *rec = ring_rec(tr, w, i);
+            v[m++] = rec->start - max(rec->ready, tr->t0);
+        }
+    }
+    hist(out, "Queue wait", v, m);
+
+    // Gaps between the tasks of a worker, from the run start to the
+    // run end; those before dropped records are unknown
+    m = 0;
+    for (int w = 0; w < workers; w++) {
+        prev = tr->rings[w].n > tr->cap ? 0 : tr->t0;
+        for (long i = 0; i < ring_len(tr, w); i++) {
+            graph_trace_rec_t *rec = ring_rec(tr, w, i);
+            if (prev) v[m++] = rec->start - prev;
+            busy += rec->end - rec->start;
+            prev = rec->end;
+        }
+        if (prev) v[m++] = tr->t1 - prev;
+    }
+    hist(out, "Worker idle", v, m);
+    if (span > 0 && dropped == 0)
+        fprintf(out, "Busy:       %.1f%% of %d workers x %lu cycles\n",
+                100.0 * busy / ((double)span * workers), workers, (unsigned long)span);
+
+    // Slack under the measured run times
+    E_NULL(cost = (long *)malloc(gs->n_tasks * sizeof(long)));
+    for (int i = 0; i < gs->n_tasks; i++)
+        cost[i] = -1;
+    for (int w = 0; w < workers; w++) {
+        for (long i = 0; i < ring_len(tr, w); i++) {
+            graph_trace_rec_t *rec = ring_rec(tr, w, i);
+            cost[rec->task] = rec->end - rec->start;
+        }
+    }
+    for (int i = 0; i < gs->n_tasks; i++)
+        missing += cost[i] < 0;
+    if (missing == 0) {
+        E_NULL(rank = (long *)malloc(gs->n_tasks * sizeof(long)));
+        E_NULL(tlevel = (long *)malloc(gs->n_tasks * sizeof(long)));
+        free(v);
+        E_NULL(v = (uint64_t *)malloc(gs->n_tasks * sizeof(uint64_t)));
+        cp = graph_sched_upward_rank(gs, cost, rank, workers);
+        top_level(gs, cost, tlevel);
+        for (int i = 0; i < gs->n_tasks; i++)
+            v[i] = cp - tlevel[i] - rank[i];
+        hist(out, "CP slack", v, gs->n_tasks);
+        fprintf(out, "Meas. path: %ld cycles critical (%.1f%% of the run)\n",
+                cp, span ? 100.0 * cp / span : 0);
+        free(rank);
+        free(tlevel);
+    } else {
+        fprintf(out, "CP slack: %ld of %d tasks not in the trace\n", missing, gs->n_tasks);
+    }
+    free(cost);
+    free(v);
+}
+
+int graph_trace_dump_chrome(graph_trace_t *tr, const char *path) {
+    int workers = min(tr->workers, tr->nthreads);
+    struct timespec dt = timediff(tr->ts0, tr->ts1);
+    double us = dt.tv_sec * 1e6 + dt.tv_nsec / 1e3;
+    // TSC cycles per microsecond over the run
+    double cpu = us > 0 ? (tr->t1 - tr->t0) / us : 1;
+    const char *sep = "";
+    FILE *f;
+
+    if ((f = fopen(path, "w")) == NULL) return -1;
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (int w = 0; w < workers; w++) {
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,"
+                "\"args\":{\"name\":\"worker %d\"}}", sep, w, w);
+        sep = ",\n";
+        for (long i = 0; i < ring_len(tr, w); i++) {
+            graph_trace_rec_t *rec = ring_rec(tr, w, i);
+            fprintf(f, ",\n{\"name\":\"task %d\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,"
+                    "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"wait_us\":%.3f}}",
+                    rec->task, w, (rec->start - tr->t0) / cpu, (rec->end - rec->start) / cpu,
+                    (rec->start - max(rec->ready, tr->t0)) / cpu);
+        }
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    return fclose(f) == 0 ? 0 : -1;
+}
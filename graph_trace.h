@@ -0,0 +1,65 @@
+#ifndef GRAPH_TRACE_H
+#define GRAPH_TRACE_H
+
+#include <stdio.h>
+#include <time.h>
+#include "common.h"
+#include "graph_sched.h"
+
+// Scheduler timeline: every executed task leaves one record in the
+// ring of the worker that ran it. Only the last cap records of a
+// worker are kept.
+#define GRAPH_TRACE_RING (1 << 20)
+
+typedef struct graph_trace_rec {
+    uint64_t ready;  // indegree reached zero (run start for roots)
+    uint64_t start;  // dequeued, or taken from the bypass slot
+    uint64_t end;    // body returned, before the children are readied
+    int      task;
+} graph_trace_rec_t;
+
+typedef struct graph_trace_ring {
+    graph_trace_rec_t *recs;
+    long               n;    // records written, cap at most are kept
+} CACHELINE graph_trace_ring_t;
+
+struct graph_trace {
+    int                 nthreads;
+    long                cap;   // per worker, a power of two
+    graph_trace_ring_t *rings;
+    int                 workers; // threads of the traced run
+    // Bounds of the traced run, in TSC cycles and wall clock time
+    uint64_t            t0, t1;
+    struct timespec     ts0, ts1;
+};
+
+// Rings for up to nthreads workers of cap records each (rounded up
+// to a power of two). Attach with gs->trace = tr; graph_sched_run()
+// then clears it and records the run.
+graph_trace_t *graph_trace_create(int nthreads, long cap);
+void           graph_trace_destroy(graph_trace_t *tr);
+void           graph_trace_clear(graph_trace_t *tr);
+
+static inline void graph_trace_record(graph_trace_t *tr, int worker, int task,
+                                      uint64_t ready, uint64_t start, uint64_t end) {
+    graph_trace_ring_t *r;
+    graph_trace_rec_t *rec;
+
+    if (worker >= tr->nthreads) return;
+    r = &tr->rings[worker];
+    rec = &r->recs[r->n++ & (tr->cap - 1)];
+    rec->ready = ready;
+    rec->start = start;
+    rec->end = end;
+    rec->task = task;
+}
+
+// Histograms of the queue wait of the tasks, the gaps between the
+// tasks of each worker, and the critical-path slack of the tasks under
+// their measured run times. Slack needs a record of every task.
+void graph_trace_report(graph_trace_t *tr, graph_sched_t *gs, FILE *out);
+// Timeline in the Chrome trace event format (chrome://tracing,
+// Perfetto), one track per worker. Returns -1 if path cannot be written.
+int  graph_trace_dump_chrome(graph_trace_t *tr, const char *path);
+
+#endif
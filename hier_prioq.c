@@ -0,0 +1,198 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hier_prioq.h"
+#include "common.h"
+
+/* The calling thread's buffer, by its thread slot. A buffer left
+ * behind by an exited thread passes on with the slot. */
+static hier_buf_t *my_buf(hier_prioq_t *q) {
+    return &q->bufs[thread_slot()];
+}
+
+hier_prioq_t *hier_priq_init(int num_nodes, int max_offset, long node_cap) {
+    hier_prioq_t *q;
+
+    if (num_nodes < 1) num_nodes = 1;
+    if (num_nodes > MAX_NUMA_NODES) num_nodes = MAX_NUMA_NODES;
+
+    E_en(posix_memalign((void **)&q, CACHE_LINE_SIZE, sizeof(hier_prioq_t)));
+    memset(q, 0, sizeof(hier_prioq_t));
+    E_en(posix_memalign((void **)&q->bufs, CACHE_LINE_SIZE,
+                        HIER_MAX_THREADS * sizeof(hier_buf_t)));
+    memset(q->bufs, 0, HIER_MAX_THREADS * sizeof(hier_buf_t));
+
+    q->num_nodes = num_nodes;
+    q->node_cap = node_cap;
+    q->global = pq_init(max_offset);
+    for (int i = 0; i < num_nodes; i++)
+        q->queues[i] = pq_init(max_offset);
+
+    return q;
+}
+
+void hier_priq_destroy(hier_prioq_t *q) {
+    if (q == NULL) return;
+
+    for (int i = 0; i < q->num_nodes; i++)
+        pq_destroy(q->queues[i]);
+    pq_destroy(q->global);
+    free(q->bufs);
+    free(q);
+}
+
+/* Insert into the calling thread's node shard, or the global tier if
+ * the shard is full. */
+static int shared_insert(hier_prioq_t *q, int node, pkey_t key, pval_t value) {
+    numa_load_t *load = &q->global_load;
+    pq_t *pq = q->global;
+
+    if (q->load[node].n < q->node_cap) {
+        load = &q->load[node];
+        pq = q->queues[node];
+    }
+    if (!insert(pq, key, value))
+        return 0;
+    __sync_fetch_and_add(&load->n, 1);
+    return 1;
+}
+
+/* Sorted insert into a buffer that has room. */
+static void buf_put(hier_buf_t *b, pkey_t key, pval_t value) {
+    int i = b->n;
+
+    while (i > 0 && b->keys[i - 1] < key) {
+        b->keys[i] = b->keys[i - 1];
+        b->vals[i] = b->vals[i - 1];
+        i--;
+    }
+    b->keys[i] = key;
+    b->vals[i] = value;
+    b->n++;
+}
+
+/* Move the larger half of a full buffer down to the node shard. */
+static void buf_spill(hier_prioq_t *q, hier_buf_t *b, int node) {
+    int n = b->n - HIER_BATCH;
+
+    for (int i = 0; i < n; i++)
+        shared_insert(q, node, b->keys[i], b->vals[i]);
+    b->bound = b->keys[n - 1];
+    memmove(b->keys, b->keys + n, HIER_BATCH * sizeof(pkey_t));
+    memmove(b->vals, b->vals + n, HIER_BATCH * sizeof(pval_t));
+    b->n = HIER_BATCH;
+}
+
+int hier_priq_insert(hier_prioq_t *q, pkey_t key, pval_t value) {
+    hier_buf_t *b = my_buf(q);
+    int node = numa_priq_node_id(q->num_nodes);
+
+    if (key < b->bound) {
+        if (b->n == HIER_BUF)
+            buf_spill(q, b, node);
+        if (key < b->bound) {
+            buf_put(b, key, value);
+            return 1;
+        }
+    }
+    return shared_insert(q, node, key, value);
+}
+
+pkey_t hier_priq_peek_min(hier_prioq_t *q) {
+    hier_buf_t *b = my_buf(q);
+    int node = numa_priq_node_id(q->num_nodes);
+    pkey_t kn, kg;
+
+    if (b->n > 0)
+        return b->keys[b->n - 1];
+    kn = q->load[node].n > 0 ? peek_min_key(q->queues[node]) : SENTINEL_KEYMAX;
+    kg = q->global_load.n > 0 ? peek_min_key(q->global) : SENTINEL_KEYMAX;
+    return min(kn, kg);
+}
+
+int hier_priq_insert_node(hier_prioq_t *q, pkey_t key, pval_t value, int node) {
+    node %= q->num_nodes;
+    if (node == numa_priq_node_id(q->num_nodes))
+        return hier_priq_insert(q, key, value);
+    return shared_insert(q, node, key, value);
+}
+
+/* Take up to HIER_BATCH elements from pq into the (empty) buffer,
+ * stopping at the first key above limit, which is put back. */
+static int buf_fill(hier_buf_t *b, pq_t *pq, numa_load_t *load, pkey_t limit) {
+    pkey_t keys[HIER_BATCH];
+    pval_t vals[HIER_BATCH];
+    int got = 0;
+
+    while (got < HIER_BATCH && (vals[got] = deletemin_key(pq, &keys[got])) != NULL) {
+        if (got > 0 && keys[got] > limit) {
+            /* kept if pq has meanwhile taken the key again */
+            if (!insert(pq, keys[got], vals[got]))
+                got++;
+            break;
+        }
+        got++;
+    }
+    if (got == 0) return 0;
+    __sync_fetch_and_sub(&load->n, got);
+
+    for (int i = 0; i < got; i++) {
+        b->keys[i] = keys[got - 1 - i];
+        b->vals[i] = vals[got - 1 - i];
+    }
+    b->n = got;
+    b->bound = keys[got - 1];
+    return got;
+}
+
+/* Refill the buffer from the node shard or the global tier, whichever
+ * has the smaller head. The batch ends at the other tier's head, so
+ * the buffer never holds keys that are behind either of them. */
+static int refill(hier_prioq_t *q, hier_buf_t *b, int node) {
+    pkey_t kn, kg;
+    int victim;
+    long best;
+
+    kn = q->load[node].n > 0 ? peek_min_key(q->queues[node]) : SENTINEL_KEYMAX;
+    kg = q->global_load.n > 0 ? peek_min_key(q->global) : SENTINEL_KEYMAX;
+    if (kg < kn) {
+        if (buf_fill(b, q->global, &q->global_load, kn))
+            return 1;
+    } else if (kn < SENTINEL_KEYMAX) {
+        if (buf_fill(b, q->queues[node], &q->load[node], kg))
+            return 1;
+    }
+    if (buf_fill(b, q->queues[node], &q->load[node], SENTINEL_KEYMAX) ||
+        buf_fill(b, q->global, &q->global_load, SENTINEL_KEYMAX))
+        return 1;
+
+    /* most loaded other node first, then any of them */
+    victim = -1;
+    best = 0;
+    for (int i = 0; i < q->num_nodes; i++) {
+        if (i != node && q->load[i].n > best) {
+            best = q->load[i].n;
+            victim = i;
+        }
+    }
+    if (victim >= 0 &&
+        buf_fill(b, q->queues[victim], &q->load[victim], SENTINEL_KEYMAX))
+        return 1;
+    for (int i = 0; i < q->num_nodes; i++) {
+        if (i != node && buf_fill(b, q->queues[i], &q->load[i], SENTINEL_KEYMAX))
+            return 1;
+    }
+    return 0;
+}
+
+pval_t hier_priq_delete_min(hier_prioq_t *q) {
+    hier_buf_t *b = my_buf(q);
+    int node = numa_priq_node_id(q->num_nodes);
+
+    if (b->n == 0 && !refill(q, b, node)) {
+        b->bound = 0;
+        return NULL;
+    }
+    return b->vals[--b->n];
+}
@@ -0,0 +1,56 @@
+#ifndef HIER_PRIOQ_H
+#define HIER_PRIOQ_H
+
+#include "prioq.h"
+#include "numa_prioq.h"
+
+/* Capacity of the thread-private buffer, and the number of elements
+ * moved between tiers at a time. */
+#define HIER_BUF    16
+#define HIER_BATCH  (HIER_BUF / 2)
+#define HIER_MAX_THREADS THREAD_SLOTS
+
+/* Thread-private tier. Sorted in descending key order, so the
+ * minimum is at keys[n-1]. Only holds keys below bound, which is the
+ * largest key taken from the shared tiers at the last refill. */
+typedef struct {
+    int     n;
+    pkey_t  bound;
+    pkey_t  keys[HIER_BUF];
+    pval_t  vals[HIER_BUF];
+} CACHELINE hier_buf_t;
+
+/* Three-tier queue: thread buffer -> per-node pq_t -> global pq_t.
+ * A node shard takes inserts until it holds node_cap elements, after
+ * which they overflow to the global tier. A thread's delete_min is
+ * served from its buffer, which is refilled in batches from the node
+ * shard or the global tier, whichever has the smaller head, and
+ * finally from the most loaded other node. Elements in a buffer are
+ * only visible to its thread, which bounds the rank error of a
+ * delete_min by HIER_BUF per thread plus the usual node sharding. */
+typedef struct {
+    int          num_nodes;
+    long         node_cap;
+    pq_t        *global;
+    pq_t        *queues[MAX_NUMA_NODES];
+    numa_load_t  global_load;
+    numa_load_t  load[MAX_NUMA_NODES];
+    hier_buf_t  *bufs;
+} hier_prioq_t;
+
+hier_prioq_t *hier_priq_init(int num_nodes, int max_offset, long node_cap);
+void          hier_priq_destroy(hier_prioq_t *q);
+
+/* 0 if a shared tier dropped the key as a duplicate; a thread buffer
+ * takes any key */
+int    hier_priq_insert(hier_prioq_t *q, pkey_t key, pval_t value);
+pval_t hier_priq_delete_min(hier_prioq_t *q);
+/* Smallest key the caller's next delete_min would return, from its
+ * buffer or the heads of its node and the global tier.
+ * SENTINEL_KEYMAX if these are empty. */
+pkey_t hier_priq_peek_min(hier_prioq_t *q);
+/* Insert on behalf of node: the caller's buffer if node is its own,
+ * else that node's shard. */
+int    hier_priq_insert_node(hier_prioq_t *q, pkey_t key, pval_t value, int node);
+
+#endif
@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "lane_prioq.h"
+#include "common.h"
+
+#define SEQ_MASK ((1UL << LANE_SEQ_BITS) - 1)
+
+lane_prioq_t *lane_priq_init(int n_lanes, const int *weights, int max_offset) {
+    lane_prioq_t *q;
+
+    if (n_lanes < 1) n_lanes = 1;
+    if (n_lanes > LANE_MAX) n_lanes = LANE_MAX;
+
+    E_en(posix_memalign((void **)&q, CACHE_LINE_SIZE, sizeof(lane_prioq_t)));
+    memset(q, 0, sizeof(lane_prioq_t));
+    E_en(posix_memalign((void **)&q->lanes, CACHE_LINE_SIZE, n_lanes * sizeof(lane_t)));
+    memset(q->lanes, 0, n_lanes * sizeof(lane_t));
+
+    q->n_lanes = n_lanes;
+    for (int l = 0; l < n_lanes; l++) {
+        int w = weights && weights[l] > 0 ? weights[l] : 1;
+        q->lanes[l].pq = pq_init(max_offset);
+        q->lanes[l].stride = LANE_STRIDE / w;
+    }
+    q->epoch = read_tsc_p();
+
+    return q;
+}
+
+void lane_priq_destroy(lane_prioq_t *q) {
+    if (q == NULL) return;
+
+    for (int l = 0; l < q->n_lanes; l++)
+        pq_destroy(q->lanes[l].pq);
+    free(q->lanes);
+    free(q);
+}
+
+void lane_priq_insert(lane_prioq_t *q, int lane, uint64_t deadline, pval_t value) {
+    lane_t *L = &q->lanes[lane];
+    unsigned long bit = 1UL << lane, v, p;
+    uint64_t off;
+
+    assert(0 <= lane && lane < q->n_lanes);
+    off = deadline > q->epoch ? deadline - q->epoch : 0;
+    if (off > LANE_MAX_OFFSET) off = LANE_MAX_OFFSET;
+
+    /* The sequence number wraps, so the key can still be in the lane:
+     * retry with fresh ones, and once they have all been tried, one
+     * cycle later */
+    for (unsigned long tries = 1;
+         !insert(L->pq, (off << LANE_SEQ_BITS | (__sync_fetch_and_add(&L->seq, 1) & SEQ_MASK)) + 1,
+                 value);
+         tries++) {
+        if (tries % (SEQ_MASK + 1) == 0 && off < LANE_MAX_OFFSET)
+            off++;
+    }
+    __sync_fetch_and_add(&L->n, 1);
+
+    /* Newly busy: catch up with the lanes that were served meanwhile */
+    if (!(q->nonempty & bit) && !(__sync_fetch_and_or(&q->nonempty, bit) & bit)) {
+        v = q->vtime;
+        while ((long)(v - (p = L->pass)) > 0 &&
+               !__sync_bool_compare_and_swap(&L->pass, p, v))
+            ;
+    }
+}
+
+/* Lane l was found empty. Clear its bit, unless an insert has raced
+ * with us, in which case the element count shows it. */
+static void lane_idle(lane_prioq_t *q, int l) {
+    unsigned long bit = 1UL << l;
+
+    __sync_fetch_and_and(&q->nonempty, ~bit);
+    if (q->lanes[l].n > 0)
+        __sync_fetch_and_or(&q->nonempty, bit);
+}
+
+pval_t lane_priq_delete_min(lane_prioq_t *q, int *lane) {
+    unsigned long mask, tried = 0;
+    uint64_t deadline, now, late, m;
+    lane_t *L;
+    pkey_t key;
+    pval_t v;
+    int best;
+
+    /* Each lane is tried at most once, as a lagging element count can
+     * leave an empty lane's bit set for a while */
+    while ((mask = q->nonempty & ~tried) != 0) {
+        best = __builtin_ctzl(mask);
+        for (mask &= mask - 1; mask; mask &= mask - 1) {
+            int l = __builtin_ctzl(mask);
+            if ((long)(q->lanes[l].pass - q->lanes[best].pass) < 0)
+                best = l;
+        }
+        L = &q->lanes[best];
+        if ((v = deletemin_key(L->pq, &key)) == NULL) {
+            tried |= 1UL << best;
+            lane_idle(q, best);
+            continue;
+        }
+        __sync_fetch_and_sub(&L->n, 1);
+        q->vtime = __sync_fetch_and_add(&L->pass, L->stride);
+
+        deadline = q->epoch + ((key - 1) >> LANE_SEQ_BITS);
+        now = read_tsc_p();
+        __sync_fetch_and_add(&L->taken, 1);
+        if (now > deadline) {
+            late = now - deadline;
+            __sync_fetch_and_add(&L->missed, 1);
+            while (late > (m = L->max_late) &&
+                   !__sync_bool_compare_and_swap(&L->max_late, m, late))
+                ;
+        }
+        if (lane) *lane = best;
+        return v;
+    }
+    return NULL;
+}
+
+uint64_t lane_priq_peek_deadline(lane_prioq_t *q, int lane) {
+    pkey_t key;
+
+    if (q->lanes[lane].n <= 0) return 0;
+    key = peek_min_key(q->lanes[lane].pq);
+    if (key == SENTINEL_KEYMAX) return 0;
+    return q->epoch + ((key - 1) >> LANE_SEQ_BITS);
+}
@@ -0,0 +1,65 @@
+#ifndef LANE_PRIOQ_H
+#define LANE_PRIOQ_H
+
+#include "prioq.h"
+
+/* Multi-class queue: one pq_t per service class ("lane"), each in
+ * earliest-deadline-first order, shared between the lanes by weight.
+ *
+ * Deadlines are TSC values. A lane's keys are its deadlines relative
+ * to the queue's creation, shifted left by LANE_SEQ_BITS and tagged
+ * with a per-lane sequence number, so that elements with the same
+ * deadline are kept (pq_t drops duplicate keys) and leave in FIFO
+ * order. Deadlines in the past are keyed as due at creation. When the
+ * sequence number has wrapped onto a key still queued, the insert
+ * retries with the next ones, so FIFO order only holds among fewer
+ * than 2^LANE_SEQ_BITS elements with one deadline.
+ *
+ * Lanes share delete_mins by stride scheduling: every delete_min
+ * from a lane advances its pass by LANE_STRIDE / weight, and the
+ * non-empty lane with the smallest pass is served next. A lane that
+ * becomes non-empty starts from the pass of the last lane served, so
+ * it cannot save up credit while idle. Non-empty lanes are tracked in
+ * one bitmap word, which delete_min scans without taking a lock.
+ */
+#define LANE_MAX        64
+#define LANE_SEQ_BITS   16
+#define LANE_STRIDE     (1UL << 20)
+/* Largest deadline offset that fits in a key, about 13 hours at 3GHz */
+#define LANE_MAX_OFFSET ((1UL << (63 - LANE_SEQ_BITS)) - 1)
+
+typedef struct {
+    pq_t                  *pq;
+    unsigned long          stride;
+    volatile unsigned long pass;
+    volatile unsigned long seq;
+    volatile long          n;        /* estimate, as numa_load_t */
+    /* dequeue accounting */
+    volatile long          taken;
+    volatile long          missed;   /* taken after their deadline */
+    volatile uint64_t      max_late; /* largest lateness, cycles */
+} CACHELINE lane_t;
+
+typedef struct {
+    int                    n_lanes;
+    uint64_t               epoch;    /* TSC at creation */
+    volatile unsigned long nonempty; /* bit l: lane l may hold elements */
+    volatile unsigned long vtime;    /* pass of the lane served last */
+    lane_t                *lanes;
+} lane_prioq_t;
+
+/* n_lanes lanes (1 to LANE_MAX) with the given relative weights, all
+ * 1 if weights is NULL. */
+lane_prioq_t *lane_priq_init(int n_lanes, const int *weights, int max_offset);
+void          lane_priq_destroy(lane_prioq_t *q);
+
+void   lane_priq_insert(lane_prioq_t *q, int lane, uint64_t deadline, pval_t value);
+/* Earliest deadline of the lane due by weight. The lane it was taken
+ * from is stored in *lane unless that is NULL. NULL if all lanes are
+ * empty. */
+pval_t lane_priq_delete_min(lane_prioq_t *q, int *lane);
+/* Earliest deadline queued in lane, or 0 if it is empty. A snapshot,
+ * like peek_min_key. */
+uint64_t lane_priq_peek_deadline(lane_prioq_t *q, int lane);
+
+#endif
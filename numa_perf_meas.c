@@ -1,6 +1,9 @@
 /** 
  * NUMA-sharded priority queue test harness.
- * Based on perf_meas.c, adapted to use numa_prioq_t wrapper.
+ * Based on perf_meas.c, adapted to use numa_prioq_t wrapper. The
+ * pq_t, hierarchical and key-range sharded queues can be selected
+ * for comparison, and
+ * with -r the priority order quality of the queue is measured.
  *
  * Usage: ./numa_perf_meas [options] <num_nodes>
  *
@@ -18,11 +21,14 @@
 #include <math.h>
 
 #include <limits.h>
+#include <stddef.h>
 
 #include "gc/gc.h"
 
 #include "common.h"
 #include "numa_prioq.h"
+#include "hier_prioq.h"
+#include "range_prioq.h"
 
 /* check your cpu core numbering before pinning */
 #define PIN
@@ -32,6 +38,8 @@
 #define DEFAULT_OFFSET 32
 #define DEFAULT_SIZE 1<<15
 #define DEFAULT_NODES 2
+#define HIER_NODE_CAP (1 << 16)
+#define QUALITY_SAMPLES (1 << 20)
 #define EXPS 100000000
 
 #define THREAD_ARGS_FOREACH(_iter) \
@@ -44,16 +52,96 @@ unsigned long *exps;
 int exps_pos = 0;
 void gen_exps(unsigned long *arr, unsigned short rng[3], int len, int intensity);
 
+/* Quality measurement (-r SAMPLE). Queue values point to a record
+ * with the insert sequence number and time. Every SAMPLE:th inserted
+ * element is also added to an exact reference, a sorted array of the
+ * sampled keys. When a sampled element is dequeued, the number of
+ * sampled keys smaller than its own, times SAMPLE, estimates how many
+ * elements in the queue it overtook (its rank error). */
+typedef struct {
+    unsigned long key;
+    unsigned long seq;          /* global insert sequence number */
+    uint64_t      tsc;          /* insert time */
+} elem_t;
+
+/* per-thread samples, rank error, wait in cycles and in inserts */
+typedef struct {
+    long           n;
+    unsigned long *rank;
+    unsigned long *wait;
+    unsigned long *delay;
+    char           pad[128];
+} quality_t;
+
+int sample = 0;
+volatile unsigned long ins_seq = 0;
+quality_t *qs;
+unsigned long *ref;
+long ref_n = 0;
+pthread_mutex_t ref_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void put (void *pq, unsigned long key);
+static void take (void *pq);
+static void report_quality(void);
+
 /* the workloads */
-void work_exp (numa_prioq_t *pq);
-void work_uni (numa_prioq_t *pq);
+void work_exp (void *pq);
+void work_uni (void *pq);
+void work_prod (void *pq);
+void work_cons (void *pq);
 
 void *run (void *_args);
 
 
-void (* work)(numa_prioq_t *pq);
+/* the queue implementations */
+typedef struct {
+    const char *name;
+    void   *(*init)(int num_nodes, int offset);
+    void    (*destroy)(void *q);
+    int     (*insert)(void *q, pkey_t key, pval_t value);
+    pval_t  (*delete_min)(void *q);
+} backend_t;
+
+static void *numa_init(int n, int o) { return numa_priq_init(n, o); }
+static void numa_destroy(void *q) { numa_priq_destroy(q); }
+static int numa_insert(void *q, pkey_t k, pval_t v) { return numa_priq_insert(q, k, v); }
+static pval_t numa_delete_min(void *q) { return numa_priq_delete_min(q); }
+
+static void *pq_init_(int n, int o) { return pq_init(o); }
+static void pq_destroy_(void *q) { pq_destroy(q); }
+static int pq_insert(void *q, pkey_t k, pval_t v) { return insert(q, k, v); }
+static pval_t pq_delete_min(void *q) { return deletemin(q); }
+
+/* expected key range of the workload, for range partitioning */
+pkey_t key_lo, key_hi;
+
+static void *hier_init(int n, int o) { return hier_priq_init(n, o, HIER_NODE_CAP); }
+static void hier_destroy(void *q) { hier_priq_destroy(q); }
+static int hier_insert(void *q, pkey_t k, pval_t v) { return hier_priq_insert(q, k, v); }
+static pval_t hier_delete_min(void *q) { return hier_priq_delete_min(q); }
+
+static void *range_init(int n, int o) { return range_priq_init(n, o, key_lo, key_hi); }
+static void range_destroy(void *q) { range_priq_destroy(q); }
+static int range_insert(void *q, pkey_t k, pval_t v) { return range_priq_insert(q, k, v); }
+static pval_t range_delete_min(void *q) { return range_priq_delete_min(q); }
+
+backend_t backends[] = {
+    { "numa", numa_init, numa_destroy, numa_insert, numa_delete_min },
+    { "pq",   pq_init_,  pq_destroy_,  pq_insert,   pq_delete_min },
+    { "hier", hier_init, hier_destroy, hier_insert, hier_delete_min },
+    { "range", range_init, range_destroy, range_insert, range_delete_min },
+    { NULL }
+};
+
+void (* work)(void *pq);
 thread_args_t *ts;
-numa_prioq_t *pq;
+backend_t *be;
+void *pq;
+
+int nthreads;
+int num_nodes;
+/* threads with id < producers only insert, the rest only delete */
+int producers = 0;
 
 volatile int wait_barrier  = 0;
 volatile int loop  = 0;
@@ -80,6 +168,21 @@ usage(FILE *out, const char *argv0)
     fprintf(out, "\t-s SIZE\t\tInitialize queue with SIZE elements. "
 	    "Default: %i\n",
 	    DEFAULT_SIZE);
+    fprintf(out, "\t-b QUEUE\tQueue implementation: numa (sharded), pq "
+	    "\n\t\t\t(single skiplist) or hier (thread buffer, node "
+	    "\n\t\t\tshard and global tier) or range (shards own key "
+	    "\n\t\t\tranges that slide with the minimum). Default: numa\n");
+    fprintf(out, "\t-r SAMPLE\tMeasure rank error and wait time of dequeued "
+	    "\n\t\t\telements against an exact reference holding every "
+	    "\n\t\t\tSAMPLE:th element. Slows down all operations. "
+	    "\n\t\t\tDefault: off\n");
+    fprintf(out, "\t-p POLICY\tInsert placement: local, two (least loaded "
+	    "\n\t\t\tof local and a random shard) or range (key "
+	    "\n\t\t\trange partitioned). Default: local\n");
+    fprintf(out, "\t-P NUM\t\tProducer/consumer split: the first NUM threads "
+	    "\n\t\t\tonly insert, the others only delete. Threads are "
+	    "\n\t\t\tassigned to nodes in blocks, so producers share "
+	    "\n\t\t\tthe low nodes. Default: off\n");
     fprintf(out, "\t<num_nodes>\tNumber of NUMA nodes (shards). "
 	    "Default: %i\n",
 	    DEFAULT_NODES);
@@ -88,7 +191,7 @@ usage(FILE *out, const char *argv0)
 
 
 static inline unsigned long
-next_geometric (unsigned short seed[3], unsigned int p)
+next_geometric (unsigned short seed[3], double p)
 {
     /* inverse transform sampling */
     /* cf. https://en.wikipedia.org/wiki/Geometric_distribution */
@@ -110,22 +213,28 @@ main (int argc, char **argv)
     
     extern char *optarg;
     extern int optind, optopt;
-    int nthreads	= DEFAULT_NTHREADS;
     int offset		= DEFAULT_OFFSET;
     int secs		= DEFAULT_SECS;
     int exp		= 0;
     int init_size	= DEFAULT_SIZE;
-    int num_nodes	= DEFAULT_NODES;
     int concise         = 0;
+    char *policy        = "local";
+    char *queue         = "numa";
+    nthreads		= DEFAULT_NTHREADS;
+    num_nodes		= DEFAULT_NODES;
     work		= work_uni;
     
-    while ((opt = getopt(argc, argv, "t:n:o:s:hex")) >= 0) {
+    while ((opt = getopt(argc, argv, "t:n:o:s:b:p:P:r:hex")) >= 0) {
         switch (opt) {
         case 'n': nthreads	= atoi(optarg); break;
         case 't': secs		= atoi(optarg); break;
         case 'o': offset	= atoi(optarg); break;
         case 's': init_size	= atoi(optarg); break;
         case 'x': concise       = 1; break;
+        case 'b': queue         = optarg; break;
+        case 'p': policy        = optarg; break;
+        case 'P': producers     = atoi(optarg); break;
+        case 'r': sample        = atoi(optarg); break;
         case 'e': exp		= 1; work = work_exp; break;
         case 'h': usage(stdout, argv[0]); exit(EXIT_SUCCESS); break;
         }
@@ -153,22 +262,59 @@ main (int argc, char **argv)
 
     /* initialize garbage collection */
     _init_gc_subsystem();
-    pq = numa_priq_init(num_nodes, offset);
+    for (be = backends; be->name && strcmp(be->name, queue); be++)
+        ;
+    if (be->name == NULL) {
+        usage(stderr, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (num_nodes < 1) num_nodes = 1;
+    if (num_nodes > MAX_NUMA_NODES) num_nodes = MAX_NUMA_NODES;
 
     // if DES workload, pre-sample values/event times
     if (exp) {
         E_NULL(exps = (unsigned long *)malloc(sizeof(unsigned long) * EXPS));
         gen_exps(exps, rng, EXPS, 1000);
+        /* the keys live in a window that starts as the pre-filled
+         * ones and slides upwards */
+        key_lo = exps[0];
+        key_hi = exps[min(init_size, EXPS - 1)];
+    } else {
+        key_lo = 1;
+        key_hi = 1UL << 31;
     }
+
+    pq = be->init(num_nodes, offset);
     
+    if (be->init != numa_init) {
+        /* placement policies are specific to numa_prioq_t */
+    } else if (strcmp(policy, "two") == 0) {
+        numa_priq_set_insert_policy(pq, NUMA_INSERT_TWO_CHOICE, 0, 0);
+    } else if (strcmp(policy, "range") == 0) {
+        numa_priq_set_insert_policy(pq, NUMA_INSERT_KEY_RANGE, key_lo, key_hi);
+    } else if (strcmp(policy, "local") != 0) {
+        usage(stderr, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (sample > 0) {
+        E_NULL(qs = calloc(nthreads, sizeof(quality_t)));
+        for (int i = 0; i < nthreads; i++) {
+            E_NULL(qs[i].rank = malloc(QUALITY_SAMPLES * sizeof(unsigned long)));
+            E_NULL(qs[i].wait = malloc(QUALITY_SAMPLES * sizeof(unsigned long)));
+            E_NULL(qs[i].delay = malloc(QUALITY_SAMPLES * sizeof(unsigned long)));
+        }
+        E_NULL(ref = malloc(QUALITY_SAMPLES * sizeof(unsigned long)));
+    }
+
     /* pre-fill priority queue with elements */
     for (int i = 0; i < init_size; i++) {
         if (exp) {
             elem = exps[exps_pos++];
-            numa_priq_insert(pq, elem, (void *)elem);
+            put(pq, elem);
         } else {
             elem = nrand48(rng);
-            numa_priq_insert(pq, elem, (void *)elem);
+            put(pq, elem);
         }
     }
 
@@ -220,13 +366,47 @@ main (int argc, char **argv)
         printf("Min ops/t:\t%d\n", min);
         printf("Max ops/t:\t%d\n", max);
         printf("Nodes:\t\t%d\n", num_nodes);
+        printf("Queue:\t\t%s\n", be->name);
+        if (producers > 0)
+            printf("Producers:\t%d\n", producers);
+        if (be->init == numa_init) {
+            numa_prioq_t *nq = pq;
+            printf("Policy:\t\t%s\n", policy);
+            printf("Shard loads:\t");
+            for (int i = 0; i < num_nodes; i++)
+                printf("%ld ", nq->load[i].n);
+            printf("\n");
+            printf("Steals:\t\t%ld\n", nq->steals);
+            printf("Stolen:\t\t%ld\n", nq->stolen);
+            printf("Dropped:\t%ld\n", nq->dropped);
+        }
+        if (be->init == range_init) {
+            range_prioq_t *rq = pq;
+            printf("Shard loads:\t");
+            for (int i = 0; i < num_nodes; i++)
+                printf("%ld ", rq->load[(rq->base + i) % num_nodes].n);
+            printf("\n");
+            printf("Rotations:\t%ld\n", rq->rotations);
+            printf("Range width:\t%lu\n", rq->width);
+        }
+        if (sample > 0)
+            report_quality();
     } else {
         printf("%li\n", lround((double) sum / dt));
         
     }
     
     /* CLEANUP */
-    numa_priq_destroy(pq);
+    be->destroy(pq);
+    if (sample > 0) {
+        for (int i = 0; i < nthreads; i++) {
+            free(qs[i].rank);
+            free(qs[i].wait);
+            free(qs[i].delay);
+        }
+        free(qs);
+        free(ref);
+    }
     free (ts);
     _destroy_gc_subsystem();
 }
@@ -236,27 +416,175 @@ __thread thread_args_t *args;
 
 /* uniform workload */
 void
-work_uni (numa_prioq_t *pq)  
+work_uni (void *pq)  
 {
     unsigned long elem;
 
     if (erand48(args->rng) < 0.5) {
         elem = (unsigned long)1 + nrand48(args->rng);
-        numa_priq_insert(pq, elem, (void *)elem);
+        put(pq, elem);
     } else 
-        numa_priq_delete_min(pq);
+        take(pq);
+}
+
+/* producer half of the split workload */
+void
+work_prod (void *pq)
+{
+    unsigned long elem;
+
+    elem = (unsigned long)1 + nrand48(args->rng);
+    put(pq, elem);
+}
+
+/* consumer half of the split workload */
+void
+work_cons (void *pq)
+{
+    take(pq);
 }
 
 /* DES workload */
 void
-work_exp (numa_prioq_t *pq)  
+work_exp (void *pq)  
 {
     int pos;
     unsigned long elem;
-    numa_priq_delete_min(pq);
+    take(pq);
     pos = __sync_fetch_and_add(&exps_pos, 1);
     elem = exps[pos];
-    numa_priq_insert(pq, elem, (void *)elem);
+    put(pq, elem);
+}
+
+
+/* number of reference keys smaller than key */
+static long
+ref_rank (unsigned long key)
+{
+    long lo = 0, hi = ref_n;
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        if (ref[mid] < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void
+put (void *pq, unsigned long key)
+{
+    elem_t *e;
+    long pos;
+    int added = 0;
+
+    if (sample == 0) {
+        be->insert(pq, key, (void *)key);
+        return;
+    }
+
+    E_NULL(e = malloc(sizeof(elem_t)));
+    e->key = key;
+    e->seq = __sync_fetch_and_add(&ins_seq, 1);
+    e->tsc = read_tsc_p();
+    if (e->seq % sample == 0) {
+        pthread_mutex_lock(&ref_lock);
+        if (ref_n < QUALITY_SAMPLES) {
+            pos = ref_rank(key);
+            memmove(&ref[pos + 1], &ref[pos], (ref_n - pos) * sizeof(unsigned long));
+            ref[pos] = key;
+            ref_n++;
+            added = 1;
+        }
+        pthread_mutex_unlock(&ref_lock);
+    }
+    if (be->insert(pq, key, e))
+        return;
+
+    /* the queue dropped the key as a duplicate */
+    if (added) {
+        pthread_mutex_lock(&ref_lock);
+        pos = ref_rank(key);
+        if (pos < ref_n && ref[pos] == key) {
+            memmove(&ref[pos], &ref[pos + 1], (ref_n - pos - 1) * sizeof(unsigned long));
+            ref_n--;
+        }
+        pthread_mutex_unlock(&ref_lock);
+    }
+    free(e);
+}
+
+static void
+take (void *pq)
+{
+    elem_t *e;
+    quality_t *q;
+    long pos;
+
+    e = be->delete_min(pq);
+    if (sample == 0 || e == NULL) return;
+
+    if (e->seq % sample == 0) {
+        q = &qs[args->id];
+        pthread_mutex_lock(&ref_lock);
+        pos = ref_rank(e->key);
+        if (pos < ref_n && ref[pos] == e->key) {
+            memmove(&ref[pos], &ref[pos + 1], (ref_n - pos - 1) * sizeof(unsigned long));
+            ref_n--;
+        }
+        pthread_mutex_unlock(&ref_lock);
+        if (q->n < QUALITY_SAMPLES) {
+            q->rank[q->n] = pos * sample;
+            q->wait[q->n] = read_tsc_p() - e->tsc;
+            q->delay[q->n] = ins_seq - e->seq;
+            q->n++;
+        }
+    }
+    free(e);
+}
+
+static int
+cmp_ulong (const void *a, const void *b)
+{
+    unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+    return (x > y) - (x < y);
+}
+
+/* merge the per-thread samples of one measure and print mean, p99 and
+ * max */
+static void
+print_dist (const char *name, unsigned long *all, long n, size_t off)
+{
+    double sum = 0;
+    long k = 0;
+
+    for (int i = 0; i < nthreads; i++) {
+        unsigned long *v = *(unsigned long **)((char *)&qs[i] + off);
+        memcpy(&all[k], v, qs[i].n * sizeof(unsigned long));
+        k += qs[i].n;
+    }
+    qsort(all, n, sizeof(unsigned long), cmp_ulong);
+    for (long i = 0; i < n; i++)
+        sum += all[i];
+    printf("%s\tmean %.1f\tp99 %lu\tmax %lu\n", name,
+           sum / n, all[(long)(0.99 * (n - 1))], all[n - 1]);
+}
+
+static void
+report_quality (void)
+{
+    unsigned long *all;
+    long n = 0;
+
+    for (int i = 0; i < nthreads; i++)
+        n += qs[i].n;
+    printf("Samples:\t%ld (1/%d)\n", n, sample);
+    if (n == 0) return;
+
+    E_NULL(all = malloc(n * sizeof(unsigned long)));
+    print_dist("Rank error:", all, n, offsetof(quality_t, rank));
+    print_dist("Wait cycles:", all, n, offsetof(quality_t, wait));
+    print_dist("Wait inserts:", all, n, offsetof(quality_t, delay));
+    free(all);
 }
 
 
@@ -265,6 +593,12 @@ run (void *_args)
 {
     args = (thread_args_t *)_args;
     int cnt = 0;
+    void (* my_work)(void *pq) = work;
+
+    /* block assignment of threads to nodes */
+    numa_priq_set_local_node(args->id * num_nodes / nthreads);
+    if (producers > 0)
+        my_work = args->id < producers ? work_prod : work_cons;
 
 
 #if defined(PIN) && defined(__linux__)
@@ -280,7 +614,7 @@ run (void *_args)
     while (!loop);
     /* start benchmark execution */
     do {
-	work(pq);
+	my_work(pq);
         cnt++;
     } while (loop);
     /* end of measured execution */
@@ -298,7 +632,7 @@ gen_exps(unsigned long *arr, unsigned short rng[3], int len, int intensity)
     arr[0] = 2;
     while (++i < len)
 	arr[i] = arr[i-1] + 
-	    next_geometric(rng, intensity);
+	    next_geometric(rng, 1.0 / intensity);
 }
 
 
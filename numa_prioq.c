@@ -1,14 +1,38 @@
+#define _GNU_SOURCE
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include "numa_prioq.h"
 #include "common.h"
 
-/* Pseudo-NUMA helper: maps thread to a node ID based on pthread_self() */
+/* Pseudo-NUMA helper: maps thread to a node ID. pthread_self() values
+ * are page aligned, so hashing them put every thread on node 0;
+ * instead, threads are handed out slots round-robin on first use. */
+static __thread int local_node = -1;
+static volatile int next_node = 0;
+
+/* xorshift state for the two-choice placement */
+static __thread unsigned int place_rand;
+
+/* earliest TSC value at which this thread may batch steal again */
+static __thread uint64_t next_steal;
+
 static int get_pseudo_node_id(int num_nodes) {
-    pthread_t tid = pthread_self();
-    unsigned long x = (unsigned long)tid;
-    return (int)(x % num_nodes);
+    if (local_node < 0)
+        local_node = __sync_fetch_and_add(&next_node, 1);
+    return local_node % num_nodes;
+}
+
+int numa_priq_node_id(int num_nodes) {
+    return get_pseudo_node_id(num_nodes);
+}
+
+void numa_priq_set_local_node(int node) {
+    local_node = node;
+}
+
+int numa_priq_local_node(numa_prioq_t *q) {
+    return get_pseudo_node_id(q->num_nodes);
 }
 
 numa_prioq_t *numa_priq_init(int num_nodes, int max_offset) {
@@ -18,8 +42,8 @@ numa_prioq_t *numa_priq_init(int num_nodes, int max_offset) {
     if (num_nodes < 1) num_nodes = 1;
     if (num_nodes > MAX_NUMA_NODES) num_nodes = MAX_NUMA_NODES;
     
-    /* Allocate wrapper structure */
-    E_NULL(q = (numa_prioq_t *)malloc(sizeof(numa_prioq_t)));
+    /* Allocate wrapper structure, load counters on separate lines */
+    E_en(posix_memalign((void **)&q, CACHE_LINE_SIZE, sizeof(numa_prioq_t)));
     memset(q, 0, sizeof(numa_prioq_t));
     
     q->num_nodes = num_nodes;
@@ -53,27 +77,173 @@ void numa_priq_destroy(numa_prioq_t *q) {
     free(q);
 }
 
-void numa_priq_insert(numa_prioq_t *q, pkey_t key, pval_t value) {
+void numa_priq_set_insert_policy(numa_prioq_t *q, numa_insert_policy_t policy,
+                                 pkey_t key_lo, pkey_t key_hi) {
+    q->insert_policy = policy;
+    q->key_lo = key_lo;
+    q->key_width = key_hi > key_lo ? (key_hi - key_lo) / q->num_nodes + 1 : 1;
+}
+
+/* Shard an element with key is inserted into, based on the published
+ * loads for NUMA_INSERT_TWO_CHOICE. */
+static int place(numa_prioq_t *q, pkey_t key) {
+    int node = get_pseudo_node_id(q->num_nodes);
+    int other;
+    pkey_t slot;
+
+    switch (q->insert_policy) {
+    case NUMA_INSERT_TWO_CHOICE:
+        if (q->num_nodes == 1) break;
+        if (place_rand == 0) place_rand = 2654435761u * (local_node + 1);
+        place_rand ^= place_rand << 13;
+        place_rand ^= place_rand >> 17;
+        place_rand ^= place_rand << 5;
+        other = place_rand % q->num_nodes;
+        if (q->load[other].n < q->load[node].n) node = other;
+        break;
+    case NUMA_INSERT_KEY_RANGE:
+        slot = key > q->key_lo ? (key - q->key_lo) / q->key_width : 0;
+        node = slot < (pkey_t)q->num_nodes ? (int)slot : q->num_nodes - 1;
+        break;
+    case NUMA_INSERT_LOCAL:
+        break;
+    }
+    return node;
+}
+
+int numa_priq_insert(numa_prioq_t *q, pkey_t key, pval_t value) {
+    return numa_priq_insert_node(q, key, value, place(q, key));
+}
+
+int numa_priq_insert_node(numa_prioq_t *q, pkey_t key, pval_t value, int node) {
+    node %= q->num_nodes;
+    if (!insert(q->queues[node], key, value))
+        return 0;
+    __sync_fetch_and_add(&q->load[node].n, 1);
+    return 1;
+}
+
+void numa_priq_insert_batch(numa_prioq_t *q, const pkey_t *keys, const pval_t *vals,
+                            int n, int node) {
+    int added = 0;
+
+    if (node < 0) {
+        for (int i = 0; i < n; i++)
+            numa_priq_insert(q, keys[i], vals[i]);
+        return;
+    }
+    node %= q->num_nodes;
+    for (int i = 0; i < n; i++)
+        added += insert(q->queues[node], keys[i], vals[i]);
+    __sync_fetch_and_add(&q->load[node].n, added);
+}
+
+pkey_t numa_priq_peek_min(numa_prioq_t *q) {
     int node = get_pseudo_node_id(q->num_nodes);
-    insert(q->queues[node], key, value);
+    pkey_t k, m;
+
+    if ((k = peek_min_key(q->queues[node])) < SENTINEL_KEYMAX)
+        return k;
+    for (int i = 0; i < q->num_nodes; i++) {
+        if (i != node && q->load[i].n > 0 && (m = peek_min_key(q->queues[i])) < k)
+            k = m;
+    }
+    return k;
+}
+
+/* Most loaded shard other than node, or -1 if all look empty. */
+static int pick_victim(numa_prioq_t *q, int node) {
+    int victim = -1;
+    long best = 0;
+
+    for (int i = 0; i < q->num_nodes; i++) {
+        if (i == node) continue;
+        if (q->load[i].n > best) {
+            best = q->load[i].n;
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+/* Move half of the victim's first STEAL_BATCH elements to the local
+ * shard in one go, and return the smallest of them to the caller.
+ * Moved elements keep their keys. One whose key the local shard
+ * already holds would be dropped there, so it goes back to the victim,
+ * or failing that to the next shards in turn. If all of them hold the
+ * key, because other threads keep inserting it, the element is
+ * dropped as by insert() and counted in q->dropped. */
+static pval_t steal_batch(numa_prioq_t *q, int node, int victim) {
+    pkey_t keys[STEAL_BATCH / 2];
+    pval_t vals[STEAL_BATCH / 2];
+    long n, got = 0, moved = 0;
+    int s;
+
+    n = min(q->load[victim].n, (long)STEAL_BATCH) / 2;
+    if (n < 1) n = 1;
+
+    while (got < n && (vals[got] = deletemin_key(q->queues[victim], &keys[got])) != NULL)
+        got++;
+    if (got == 0) return NULL;
+    __sync_fetch_and_sub(&q->load[victim].n, got);
+
+    /* the smallest element is handed out directly */
+    for (long i = 1; i < got; i++) {
+        if (insert(q->queues[node], keys[i], vals[i])) {
+            moved++;
+            continue;
+        }
+        for (s = 0; s < q->num_nodes && !numa_priq_insert_node(q, keys[i], vals[i], victim + s); s++)
+            ;
+        if (s == q->num_nodes)
+            __sync_fetch_and_add(&q->dropped, 1);
+    }
+    __sync_fetch_and_add(&q->load[node].n, moved);
+
+    __sync_fetch_and_add(&q->steals, 1);
+    __sync_fetch_and_add(&q->stolen, moved + 1);
+    return vals[0];
 }
 
 pval_t numa_priq_delete_min(numa_prioq_t *q) {
     int node = get_pseudo_node_id(q->num_nodes);
+    int victim;
+    uint64_t now;
     pval_t result;
     
     /* Try local queue first */
     result = deletemin(q->queues[node]);
     if (result != NULL) {
+        __sync_fetch_and_sub(&q->load[node].n, 1);
         return result;
     }
     
-    /* If local queue is empty, try other queues */
+    /* Local queue is empty, steal from the most loaded remote shard.
+     * Batch steals are rate limited per thread, in between a single
+     * element is taken. */
+    victim = pick_victim(q, node);
+    if (victim >= 0) {
+        now = read_tsc_p();
+        if (now >= next_steal) {
+            next_steal = now + STEAL_INTERVAL;
+            result = steal_batch(q, node, victim);
+        } else {
+            result = deletemin(q->queues[victim]);
+            if (result != NULL)
+                __sync_fetch_and_sub(&q->load[victim].n, 1);
+        }
+        if (result != NULL) {
+            return result;
+        }
+    }
+
+    /* Published loads may lag behind, walk all other queues */
     for (int i = 0; i < q->num_nodes; i++) {
         if (i == node) continue; /* Already tried local queue */
         
         result = deletemin(q->queues[i]);
         if (result != NULL) {
+            __sync_fetch_and_sub(&q->load[i].n, 1);
             return result;
         }
     }
@@ -81,3 +251,19 @@ pval_t numa_priq_delete_min(numa_prioq_t *q) {
     /* All queues are empty */
     return NULL;
 }
+
+int numa_priq_delete_min_batch(numa_prioq_t *q, pval_t *vals, int max) {
+    int node = get_pseudo_node_id(q->num_nodes);
+    int got = 0;
+
+    while (got < max && (vals[got] = deletemin(q->queues[node])) != NULL)
+        got++;
+    if (got > 0) {
+        __sync_fetch_and_sub(&q->load[node].n, got);
+        return got;
+    }
+    /* local shard empty: a single element, stealing as delete_min */
+    if (max > 0 && (vals[0] = numa_priq_delete_min(q)) != NULL)
+        return 1;
+    return 0;
+}
@@ -5,15 +5,71 @@
 
 #define MAX_NUMA_NODES 8
 
+/* A local shard that runs dry steals half of the first STEAL_BATCH
+ * elements of the most loaded remote shard in one operation. */
+#define STEAL_BATCH 32
+/* Minimum distance (in TSC cycles) between two batch steals from the
+ * same thread. Throttled steals take a single element. */
+#define STEAL_INTERVAL 20000
+
+/* Published per-shard element count. Only an estimate: updated after
+ * the operation on the shard itself has completed. */
+typedef struct {
+    volatile long n;
+    char          pad[CACHE_LINE_SIZE - sizeof(long)];
+} numa_load_t;
+
+/* Where numa_priq_insert() places a new element. */
+typedef enum {
+    NUMA_INSERT_LOCAL,          /* caller's shard */
+    NUMA_INSERT_TWO_CHOICE,     /* less loaded of local and one random shard */
+    NUMA_INSERT_KEY_RANGE,      /* shard owning the key's slice of the key range */
+} numa_insert_policy_t;
+
 typedef struct {
-    int      num_nodes;
-    pq_t    *queues[MAX_NUMA_NODES];
+    int          num_nodes;
+    numa_insert_policy_t insert_policy;
+    pkey_t       key_lo;       /* NUMA_INSERT_KEY_RANGE: lowest key, */
+    pkey_t       key_width;    /* and width of each shard's slice */
+    pq_t        *queues[MAX_NUMA_NODES];
+    numa_load_t  load[MAX_NUMA_NODES];
+    long         steals;       /* batch steals performed */
+    long         stolen;       /* elements moved by batch steals */
+    long         dropped;      /* stolen elements whose key every shard held */
 } numa_prioq_t;
 
 numa_prioq_t *numa_priq_init(int num_nodes, int max_offset);
 void          numa_priq_destroy(numa_prioq_t *q);
 
-void numa_priq_insert(numa_prioq_t *q, pkey_t key, pval_t value);
+/* The inserts return 0 if the shard already held the key, which is
+ * dropped as by insert(). */
+int  numa_priq_insert(numa_prioq_t *q, pkey_t key, pval_t value);
 pval_t numa_priq_delete_min(numa_prioq_t *q);
+/* Smallest key the caller's next delete_min would look at: that of
+ * its local shard, or, if that is empty, of the other shards.
+ * SENTINEL_KEYMAX if all are empty. A snapshot, like peek_min_key. */
+pkey_t numa_priq_peek_min(numa_prioq_t *q);
+/* Insert into shard node (modulo num_nodes), whatever the policy. */
+int  numa_priq_insert_node(numa_prioq_t *q, pkey_t key, pval_t value, int node);
+/* Insert n elements into shard node with a single load update, or
+ * each by the insert policy if node is negative. */
+void numa_priq_insert_batch(numa_prioq_t *q, const pkey_t *keys, const pval_t *vals,
+                            int n, int node);
+/* Take up to max elements from the local shard, in key order, with a
+ * single load update. Falls back to one delete_min if the shard is
+ * empty. Returns the number taken. */
+int  numa_priq_delete_min_batch(numa_prioq_t *q, pval_t *vals, int max);
+
+/* Select the insert placement policy. key_lo and key_hi give the
+ * expected key range, and are only used by NUMA_INSERT_KEY_RANGE. */
+void numa_priq_set_insert_policy(numa_prioq_t *q, numa_insert_policy_t policy,
+                                 pkey_t key_lo, pkey_t key_hi);
+
+/* Bind the calling thread to shard node (modulo num_nodes). Threads
+ * that never call this are assigned shards round-robin. */
+void numa_priq_set_local_node(int node);
+int  numa_priq_local_node(numa_prioq_t *q);
+/* Node of the calling thread, for other sharded structures. */
+int  numa_priq_node_id(int num_nodes);
 
 #endif
@@ -0,0 +1,350 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pdes.h"
+#include "common.h"
+
+/* Keys are the timestamp over a per-thread sequence number, unique
+ * until it wraps: pq_t drops duplicate keys. An event that goes back
+ * into the queue gets a new key, as its old one may still be on a
+ * logically deleted node. */
+#define TS_SHIFT 32
+#define KEY_TS(k) (((k) - 1) >> TS_SHIFT)
+
+static __thread pdes_worker_t *self;
+
+static pkey_t event_key(pdes_t *sim, pdes_worker_t *w, uint64_t ts) {
+    uint64_t seq;
+
+    if (w)
+        seq = w->seq++ * PDES_MAX_THREADS + w->id;
+    else
+        seq = sim->seq++ * PDES_MAX_THREADS + PDES_MAX_THREADS - 1;
+    return (ts << TS_SHIFT | (seq & ((1UL << TS_SHIFT) - 1))) + 1;
+}
+
+static void enqueue(pdes_t *sim, pdes_worker_t *w, pdes_event_t *ev) {
+    pkey_t key = event_key(sim, w, ev->ts);
+
+    if (sim->use_numa)
+        numa_priq_insert(sim->q, key, ev);
+    else
+        insert(sim->q, key, ev);
+}
+
+static pdes_event_t *dequeue(pdes_t *sim) {
+    if (sim->use_numa)
+        return numa_priq_delete_min(sim->q);
+    return deletemin(sim->q);
+}
+
+/* Smallest key queued. Only exact while no thread is running. */
+static pkey_t min_key(pdes_t *sim) {
+    numa_prioq_t *nq = sim->q;
+    pkey_t m = SENTINEL_KEYMAX, k;
+
+    if (!sim->use_numa)
+        return peek_min_key(sim->q);
+    for (int i = 0; i < nq->num_nodes; i++)
+        if ((k = peek_min_key(nq->queues[i])) < m)
+            m = k;
+    return m;
+}
+
+static pdes_event_t *new_event(pdes_worker_t *w, int lp, uint64_t ts) {
+    pdes_event_t *ev;
+
+    if (w && (ev = w->free) != NULL)
+        w->free = ev->sibling;
+    else
+        E_en(posix_memalign((void **)&ev, CACHE_LINE_SIZE, sizeof(pdes_event_t)));
+    ev->ts = ts;
+    ev->lp = lp;
+    ev->cancelled = 0;
+    ev->sent = NULL;
+    ev->sibling = NULL;
+    return ev;
+}
+
+static void free_event(pdes_worker_t *w, pdes_event_t *ev) {
+    ev->sibling = w->free;
+    w->free = ev;
+}
+
+pdes_t *pdes_init(const char *queue, int num_nodes, int n_lps, uint64_t lookahead,
+                  pdes_handler_t handler, void *arg) {
+    pdes_t *sim;
+    int use_numa;
+
+    if (strcmp(queue, "numa") == 0)
+        use_numa = 1;
+    else if (strcmp(queue, "pq") == 0)
+        use_numa = 0;
+    else
+        return NULL;
+    if (lookahead == 0 || n_lps < 1) return NULL;
+
+    E_NULL(sim = calloc(1, sizeof(pdes_t)));
+    E_en(posix_memalign((void **)&sim->lps, CACHE_LINE_SIZE, n_lps * sizeof(pdes_lp_t)));
+    memset(sim->lps, 0, n_lps * sizeof(pdes_lp_t));
+    for (int i = 0; i < n_lps; i++)
+        sim->lps[i].id = i;
+
+    sim->n_lps = n_lps;
+    sim->lookahead = lookahead;
+    sim->handler = handler;
+    sim->arg = arg;
+    sim->use_numa = use_numa;
+    sim->num_nodes = use_numa ? (num_nodes < 1 ? 1 : num_nodes) : 1;
+    if (sim->num_nodes > MAX_NUMA_NODES) sim->num_nodes = MAX_NUMA_NODES;
+    sim->q = use_numa ? (void *)numa_priq_init(sim->num_nodes, 32) : (void *)pq_init(32);
+
+    return sim;
+}
+
+static void free_list(pdes_event_t *ev) {
+    pdes_event_t *next;
+
+    for (; ev; ev = next) {
+        next = ev->sibling;
+        free(ev);
+    }
+}
+
+void pdes_destroy(pdes_t *sim) {
+    pdes_event_t *ev;
+
+    if (sim == NULL) return;
+
+    while ((ev = dequeue(sim)) != NULL)
+        free(ev);
+    if (sim->workers) {
+        for (int t = 0; t < sim->nthreads; t++) {
+            free_list(sim->workers[t].free);
+            free(sim->workers[t].dirty);
+        }
+        free(sim->workers);
+    }
+    for (int i = 0; i < sim->n_lps; i++)
+        free(sim->lps[i].log);
+    if (sim->use_numa)
+        numa_priq_destroy(sim->q);
+    else
+        pq_destroy(sim->q);
+    free(sim->lps);
+    free(sim);
+}
+
+void pdes_schedule(pdes_t *sim, int lp, uint64_t ts) {
+    assert(0 <= lp && lp < sim->n_lps);
+    if (ts > PDES_MAX_TS) ts = PDES_MAX_TS;
+    enqueue(sim, NULL, new_event(NULL, lp, ts));
+    sim->scheduled++;
+}
+
+pdes_event_t *pdes_send(pdes_t *sim, pdes_event_t *cause, int lp, uint64_t ts) {
+    pdes_worker_t *w = self;
+    pdes_event_t *ev;
+
+    assert(w != NULL && 0 <= lp && lp < sim->n_lps);
+    assert(ts >= cause->ts + sim->lookahead);
+    if (ts > PDES_MAX_TS) ts = PDES_MAX_TS;
+
+    ev = new_event(w, lp, ts);
+    ev->sibling = cause->sent;
+    cause->sent = ev;
+    w->sent++;
+    enqueue(sim, w, ev);
+    return ev;
+}
+
+static void lp_lock(pdes_lp_t *lp) {
+    while (lp->lock || __sync_lock_test_and_set(&lp->lock, 1))
+        ;
+}
+
+static void lp_unlock(pdes_lp_t *lp) {
+    __sync_lock_release(&lp->lock);
+}
+
+/* Undo the events lp processed after ts, newest first. Their sent
+ * events are still queued beyond the window, so flagging them is
+ * enough. */
+static void rollback(pdes_t *sim, pdes_worker_t *w, pdes_lp_t *lp, uint64_t ts) {
+    pdes_log_t *e;
+    pdes_event_t *s;
+
+    w->rollbacks++;
+    while (lp->n_log > 0 && (e = &lp->log[lp->n_log - 1])->ev->ts > ts) {
+        lp->lvt = e->lvt;
+        memcpy(lp->state, e->state, sizeof(lp->state));
+        for (s = e->ev->sent; s; s = s->sibling) {
+            s->cancelled = 1;
+            w->cancelled++;
+        }
+        e->ev->sent = NULL;
+        enqueue(sim, w, e->ev);
+        lp->n_log--;
+        w->rolled_back++;
+    }
+}
+
+static void execute(pdes_t *sim, pdes_worker_t *w, pdes_event_t *ev) {
+    pdes_lp_t *lp = &sim->lps[ev->lp];
+    pdes_log_t *e;
+
+    lp_lock(lp);
+    if (ev->ts < lp->lvt)
+        rollback(sim, w, lp, ev->ts);
+
+    if (lp->n_log == lp->cap_log) {
+        lp->cap_log = lp->cap_log ? 2 * lp->cap_log : 8;
+        E_NULL(lp->log = realloc(lp->log, lp->cap_log * sizeof(pdes_log_t)));
+    }
+    e = &lp->log[lp->n_log++];
+    e->ev = ev;
+    e->lvt = lp->lvt;
+    memcpy(e->state, lp->state, sizeof(lp->state));
+
+    if (!lp->dirty) {
+        lp->dirty = 1;
+        if (w->n_dirty == w->cap_dirty) {
+            w->cap_dirty = w->cap_dirty ? 2 * w->cap_dirty : 64;
+            E_NULL(w->dirty = realloc(w->dirty, w->cap_dirty * sizeof(int)));
+        }
+        w->dirty[w->n_dirty++] = lp->id;
+    }
+
+    lp->lvt = ev->ts;
+    sim->handler(sim, lp, ev);
+    w->processed++;
+    lp_unlock(lp);
+}
+
+/* The window is over: its events can no longer be undone */
+static void commit(pdes_worker_t *w) {
+    pdes_t *sim = w->sim;
+
+    for (long i = 0; i < w->n_dirty; i++) {
+        pdes_lp_t *lp = &sim->lps[w->dirty[i]];
+        for (long j = 0; j < lp->n_log; j++)
+            free_event(w, lp->log[j].ev);
+        w->committed += lp->n_log;
+        lp->n_log = 0;
+        lp->dirty = 0;
+    }
+    w->n_dirty = 0;
+}
+
+/* Run by one thread while the others wait: go over the window again
+ * if rollbacks have put events back into it, or move on. */
+static void next_window(pdes_t *sim) {
+    pkey_t m = min_key(sim);
+    uint64_t ts = m == SENTINEL_KEYMAX ? PDES_MAX_TS : KEY_TS(m);
+
+    sim->rounds++;
+    if (ts < sim->hi) {
+        sim->phase = PDES_AGAIN;
+        return;
+    }
+    sim->windows++;
+    if (ts >= sim->end_time) {
+        sim->phase = PDES_DONE;
+        return;
+    }
+    sim->lo = ts;
+    sim->hi = ts + sim->lookahead < sim->end_time ? ts + sim->lookahead : sim->end_time;
+    sim->phase = PDES_NEXT;
+}
+
+static void *run_worker(void *arg) {
+    pdes_worker_t *w = arg;
+    pdes_t *sim = w->sim;
+    pdes_event_t *ev;
+
+    self = w;
+    pin(gettid(), w->id % sysconf(_SC_NPROCESSORS_ONLN));
+    if (sim->use_numa)
+        numa_priq_set_local_node(w->id);
+
+    for (;;) {
+        while ((ev = dequeue(sim)) != NULL) {
+            if (ev->ts >= sim->hi) {
+                enqueue(sim, w, ev);
+                break;
+            }
+            if (ev->cancelled)
+                free_event(w, ev);
+            else
+                execute(sim, w, ev);
+        }
+
+        if (pthread_barrier_wait(&sim->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+            next_window(sim);
+        pthread_barrier_wait(&sim->barrier);
+        if (sim->phase == PDES_AGAIN)
+            continue;
+        commit(w);
+        if (sim->phase == PDES_DONE)
+            break;
+        /* No LP of the new window before every log is cleared */
+        pthread_barrier_wait(&sim->barrier);
+    }
+    self = NULL;
+    return NULL;
+}
+
+int pdes_run(pdes_t *sim, int nthreads, uint64_t end_time) {
+    pkey_t m;
+
+    if (nthreads < 1 || nthreads >= PDES_MAX_THREADS) return -1;
+    if (sim->use_numa && nthreads < sim->num_nodes) return -1;
+    if (end_time > PDES_MAX_TS) return -1;
+
+    if (sim->workers) {
+        for (int t = 0; t < sim->nthreads; t++) {
+            free_list(sim->workers[t].free);
+            free(sim->workers[t].dirty);
+        }
+        free(sim->workers);
+    }
+    E_en(posix_memalign((void **)&sim->workers, CACHE_LINE_SIZE,
+                        nthreads * sizeof(pdes_worker_t)));
+    memset(sim->workers, 0, nthreads * sizeof(pdes_worker_t));
+    for (int t = 0; t < nthreads; t++)
+        sim->workers[t].seq = sim->seq;
+    sim->nthreads = nthreads;
+    sim->end_time = end_time;
+
+    m = min_key(sim);
+    sim->lo = m == SENTINEL_KEYMAX ? end_time : KEY_TS(m);
+    if (sim->lo >= end_time) return 0;
+    sim->hi = sim->lo + sim->lookahead < end_time ? sim->lo + sim->lookahead : end_time;
+
+    E_en(pthread_barrier_init(&sim->barrier, NULL, nthreads));
+    for (int t = 0; t < nthreads; t++) {
+        sim->workers[t].id = t;
+        sim->workers[t].sim = sim;
+        E_en(pthread_create(&sim->workers[t].thread, NULL, run_worker, &sim->workers[t]));
+    }
+    for (int t = 0; t < nthreads; t++)
+        E_en(pthread_join(sim->workers[t].thread, NULL));
+    pthread_barrier_destroy(&sim->barrier);
+
+    for (int t = 0; t < nthreads; t++) {
+        pdes_worker_t *w = &sim->workers[t];
+        if (w->seq > sim->seq) sim->seq = w->seq;
+        sim->processed += w->processed;
+        sim->rolled_back += w->rolled_back;
+        sim->rollbacks += w->rollbacks;
+        sim->committed += w->committed;
+        sim->sent += w->sent;
+        sim->cancelled += w->cancelled;
+    }
+    return 0;
+}
+
+long pdes_pending(pdes_t *sim) {
+    return sim->scheduled + sim->sent - sim->committed - sim->cancelled;
+}
@@ -0,0 +1,127 @@
+#ifndef PDES_H
+#define PDES_H
+
+#include <pthread.h>
+#include "prioq.h"
+#include "numa_prioq.h"
+
+/* Parallel discrete event simulation on the priority queues.
+ *
+ * Logical processes (LPs) exchange timestamped events through one
+ * shared queue, pq_t or numa_prioq_t. An event may only schedule
+ * events at least lookahead after its own time, so the events in
+ * [lo, lo + lookahead), where lo is the smallest pending timestamp,
+ * cannot be affected by anything outside that window. Each window is
+ * run as one batch: all threads take its events from the queue in
+ * parallel, and the window is committed once it is empty.
+ *
+ * Within a window processing is optimistic. Concurrent threads, and
+ * relaxed queues, can hand an LP its events out of timestamp order;
+ * an event older than the last one its LP processed rolls the LP
+ * back: the later events are undone from a per-LP log, which restores
+ * the LP's state words, cancels the events they scheduled, and puts
+ * them back in the queue. Scheduled events always lie beyond the
+ * window, so a cancelled event has never run: it is only flagged,
+ * and dropped when it is dequeued. Simultaneous events of an LP run
+ * in dequeue order.
+ */
+#define PDES_LP_WORDS   4
+#define PDES_MAX_TS     ((1UL << 31) - 1)
+#define PDES_MAX_THREADS 256
+
+typedef struct pdes_event {
+    uint64_t            ts;
+    int                 lp;
+    volatile int        cancelled;
+    struct pdes_event  *sent;      /* events scheduled when processed */
+    struct pdes_event  *sibling;   /* next in the sender's sent list */
+} pdes_event_t;
+
+typedef struct {
+    pdes_event_t *ev;
+    uint64_t      lvt;
+    uint64_t      state[PDES_LP_WORDS];
+} pdes_log_t;
+
+typedef struct {
+    int           id;
+    volatile int  lock;
+    int           dirty;           /* logged in this window */
+    uint64_t      lvt;             /* time of the last event processed */
+    uint64_t      state[PDES_LP_WORDS]; /* model state, saved in the log */
+    pdes_log_t   *log;
+    long          n_log, cap_log;
+} CACHELINE pdes_lp_t;
+
+typedef struct pdes pdes_t;
+
+/* Event handler: may change lp->state and schedule with pdes_send() */
+typedef void (*pdes_handler_t)(pdes_t *sim, pdes_lp_t *lp, pdes_event_t *ev);
+
+typedef struct {
+    pthread_t     thread;
+    int           id;
+    pdes_t       *sim;
+    pdes_event_t *free;            /* recycled event records */
+    int          *dirty;           /* LPs logged in this window */
+    long          n_dirty, cap_dirty;
+    unsigned long seq;             /* key tie-breaker */
+    long          processed;       /* handler calls, including undone ones */
+    long          rolled_back;     /* events undone */
+    long          rollbacks;       /* stragglers that caused undos */
+    long          committed;
+    long          sent;
+    long          cancelled;
+    char          pad[128];
+} pdes_worker_t;
+
+typedef enum { PDES_AGAIN, PDES_NEXT, PDES_DONE } pdes_phase_t;
+
+struct pdes {
+    int               n_lps;
+    pdes_lp_t        *lps;
+    uint64_t          lookahead;
+    pdes_handler_t    handler;
+    void             *arg;         /* for the model */
+
+    int               use_numa;
+    int               num_nodes;
+    void             *q;
+
+    /* current window [lo, hi), and the time events stop at */
+    uint64_t          lo, hi, end_time;
+    volatile pdes_phase_t phase;
+    pthread_barrier_t barrier;
+    int               nthreads;
+    pdes_worker_t    *workers;
+
+    unsigned long     seq;         /* key tie-breaker outside workers */
+
+    /* totals over all runs */
+    long              windows;
+    long              rounds;      /* passes over windows, >= windows */
+    long              processed, rolled_back, rollbacks, committed;
+    long              scheduled;   /* events added before the run */
+    long              sent, cancelled;
+};
+
+/* A simulation of n_lps LPs on the queue named "pq" or "numa" (with
+ * num_nodes shards). NULL if the queue is unknown or lookahead is 0. */
+pdes_t *pdes_init(const char *queue, int num_nodes, int n_lps, uint64_t lookahead,
+                  pdes_handler_t handler, void *arg);
+void    pdes_destroy(pdes_t *sim);
+
+/* Initial event, before pdes_run() */
+void    pdes_schedule(pdes_t *sim, int lp, uint64_t ts);
+/* From a handler: event for lp at ts, which must be at least the
+ * lookahead after cause. Times past PDES_MAX_TS are clamped to it. */
+pdes_event_t *pdes_send(pdes_t *sim, pdes_event_t *cause, int lp, uint64_t ts);
+
+/* Run nthreads threads until no event before end_time is left.
+ * Returns 0, or -1 if there are fewer threads than numa shards, not
+ * fewer than PDES_MAX_THREADS, or end_time is past PDES_MAX_TS. */
+int     pdes_run(pdes_t *sim, int nthreads, uint64_t end_time);
+/* Events left in the queue that have not been cancelled */
+long    pdes_pending(pdes_t *sim);
+
+#endif
@@ -0,0 +1,272 @@
+/**
+ * PHOLD on the parallel discrete event simulation engine (pdes.h).
+ * Every LP starts with a number of events; processing an event
+ * schedules one new event, at the lookahead plus an exponentially
+ * distributed delay later, for a random other LP with the remote
+ * probability and for the LP itself otherwise. The event population
+ * is therefore constant, and the LPs' event counters, which
+ * rollbacks restore, add up to the committed events: the check
+ * verifies both.
+ *
+ * Committed events per second, rollbacks and the number of windows
+ * are reported for one thread count, or for 1, 2, 4, ... threads.
+ *
+ * Usage: ./pdes_perf_meas [options]
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "gc/gc.h"
+
+#include "common.h"
+#include "pdes.h"
+
+#define DEFAULT_NTHREADS 1
+#define DEFAULT_NODES 2
+#define DEFAULT_LPS 1024
+#define DEFAULT_EVENTS 16
+#define DEFAULT_REMOTE 0.5
+#define DEFAULT_LOOKAHEAD 100
+#define DEFAULT_MEAN 1000
+#define DEFAULT_END 100000
+#define DEFAULT_SEED 1
+
+/* LP state words */
+#define RNG     0
+#define COUNT   1
+
+int n_lps;
+double remote;
+uint64_t lookahead;
+double mean;
+uint64_t work;
+
+
+/* splitmix64 step on an LP's generator */
+static uint64_t
+next_rand (uint64_t *s)
+{
+    uint64_t z = (*s += 0x9e3779b97f4a7c15UL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+    return z ^ (z >> 31);
+}
+
+/* uniform in (0, 1] */
+static double
+next_unit (uint64_t *s)
+{
+    return ((next_rand(s) >> 11) + 1) * (1.0 / (1UL << 53));
+}
+
+static uint64_t
+next_delay (uint64_t *s)
+{
+    return (uint64_t)(-mean * log(next_unit(s)));
+}
+
+static void
+spin (uint64_t cycles)
+{
+    uint64_t until = read_tsc_p() + cycles;
+    while (read_tsc_p() < until)
+	;
+}
+
+
+static void
+phold (pdes_t *sim, pdes_lp_t *lp, pdes_event_t *ev)
+{
+    uint64_t *rng = &lp->state[RNG];
+    int dest = lp->id;
+
+    if (work) spin(work);
+    if (n_lps > 1 && next_unit(rng) <= remote)
+	dest = (lp->id + 1 + next_rand(rng) % (n_lps - 1)) % n_lps;
+    lp->state[COUNT]++;
+    pdes_send(sim, ev, dest, ev->ts + lookahead + next_delay(rng));
+}
+
+
+static void
+usage(FILE *out, const char *argv0)
+{
+    fprintf(out, "Usage: %s [OPTION]...\n"
+	    "\n"
+	    "Options:\n", argv0);
+
+    fprintf(out, "\t-h\t\tDisplay usage.\n");
+    fprintf(out, "\t-n NUM\t\tUse NUM threads. "
+	    "Default: %i\n",
+	    DEFAULT_NTHREADS);
+    fprintf(out, "\t-b QUEUE\tQueue implementation: numa (sharded) or pq "
+	    "\n\t\t\t(single skiplist). Default: numa\n");
+    fprintf(out, "\t-m NODES\tShards of the numa queue, at most the threads. "
+	    "Default: %i\n",
+	    DEFAULT_NODES);
+    fprintf(out, "\t-l LPS\t\tLogical processes. "
+	    "Default: %i\n",
+	    DEFAULT_LPS);
+    fprintf(out, "\t-e NUM\t\tInitial events per LP. "
+	    "Default: %i\n",
+	    DEFAULT_EVENTS);
+    fprintf(out, "\t-r PROB\t\tProbability that an event goes to another LP. "
+	    "Default: %.1f\n",
+	    DEFAULT_REMOTE);
+    fprintf(out, "\t-L TIME\t\tLookahead, the smallest event delay and the "
+	    "\n\t\t\twindow length. Default: %i\n",
+	    DEFAULT_LOOKAHEAD);
+    fprintf(out, "\t-M TIME\t\tMean exponential delay on top of the lookahead. "
+	    "Default: %i\n",
+	    DEFAULT_MEAN);
+    fprintf(out, "\t-T TIME\t\tSimulated time to run. "
+	    "Default: %i\n",
+	    DEFAULT_END);
+    fprintf(out, "\t-w CYCLES\tBusy work per event. Default: 0\n");
+    fprintf(out, "\t-S SEED\t\tSeed of the LPs' generators. "
+	    "Default: %i\n",
+	    DEFAULT_SEED);
+    fprintf(out, "\t-x\t\tScalability: run with 1, 2, 4, ... up to NUM "
+	    "\n\t\t\tthreads, one line each\n");
+}
+
+
+/* A new simulation with its initial events, NULL if the queue is
+ * unknown */
+static pdes_t *
+setup (const char *queue, int num_nodes, int events, unsigned long seed)
+{
+    pdes_t *sim;
+
+    if ((sim = pdes_init(queue, num_nodes, n_lps, lookahead, phold, NULL)) == NULL)
+	return NULL;
+    for (int i = 0; i < n_lps; i++) {
+	pdes_lp_t *lp = &sim->lps[i];
+	lp->state[RNG] = seed * 0x9e3779b97f4a7c15UL + i;
+	for (int e = 0; e < events; e++)
+	    pdes_schedule(sim, i, next_delay(&lp->state[RNG]));
+    }
+    return sim;
+}
+
+
+int
+main (int argc, char **argv)
+{
+    int opt;
+    extern char *optarg;
+    extern int optind;
+    int nthreads	= DEFAULT_NTHREADS;
+    int num_nodes	= DEFAULT_NODES;
+    int events		= DEFAULT_EVENTS;
+    uint64_t end_time	= DEFAULT_END;
+    unsigned long seed	= DEFAULT_SEED;
+    int sweep		= 0;
+    char *queue		= "numa";
+    struct timespec start, end, elapsed;
+    pdes_t *sim;
+    double dt, rate, base = 0;
+    long counted;
+    int max_threads, ok, match;
+    n_lps		= DEFAULT_LPS;
+    remote		= DEFAULT_REMOTE;
+    lookahead		= DEFAULT_LOOKAHEAD;
+    mean		= DEFAULT_MEAN;
+    work		= 0;
+
+    while ((opt = getopt(argc, argv, "n:b:m:l:e:r:L:M:T:w:S:xh")) >= 0) {
+	switch (opt) {
+	case 'n': nthreads	= atoi(optarg); break;
+	case 'b': queue		= optarg; break;
+	case 'm': num_nodes	= atoi(optarg); break;
+	case 'l': n_lps		= atoi(optarg); break;
+	case 'e': events	= atoi(optarg); break;
+	case 'r': remote	= atof(optarg); break;
+	case 'L': lookahead	= strtoul(optarg, NULL, 0); break;
+	case 'M': mean		= atof(optarg); break;
+	case 'T': end_time	= strtoul(optarg, NULL, 0); break;
+	case 'w': work		= strtoul(optarg, NULL, 0); break;
+	case 'S': seed		= strtoul(optarg, NULL, 0); break;
+	case 'x': sweep		= 1; break;
+	case 'h': usage(stdout, argv[0]); exit(EXIT_SUCCESS); break;
+	default:  usage(stderr, argv[0]); exit(EXIT_FAILURE);
+	}
+    }
+    if (argc != optind || nthreads < 1 || nthreads >= PDES_MAX_THREADS ||
+	n_lps < 1 || events < 1 || remote < 0 || remote > 1 || lookahead < 1 ||
+	mean < 0 || end_time > PDES_MAX_TS ||
+	(strcmp(queue, "numa") && strcmp(queue, "pq"))) {
+	usage(stderr, argv[0]);
+	exit(EXIT_FAILURE);
+    }
+    if (num_nodes < 1) num_nodes = 1;
+    if (num_nodes > MAX_NUMA_NODES) num_nodes = MAX_NUMA_NODES;
+    max_threads = nthreads;
+
+    _init_gc_subsystem();
+
+    printf("Model:\t\tPHOLD, %d LPs, %d events each, remote %.2f\n",
+	   n_lps, events, remote);
+    printf("Time:\t\tlookahead %lu, mean delay %.0f, end %lu\n",
+	   lookahead, mean, end_time);
+    printf("Queue:\t\t%s\n", queue);
+    if (strcmp(queue, "numa") == 0)
+	printf("Nodes:\t\t%d, at most one per thread\n", num_nodes);
+    if (sweep)
+	printf("Threads\tTime (s)\tEvents/s\tSpeedup\tRollback\tEv/window\tCheck\n");
+
+    ok = 1;
+    for (nthreads = sweep ? 1 : max_threads; ; nthreads = min(nthreads * 2, max_threads)) {
+	sim = setup(queue, min(num_nodes, nthreads), events, seed);
+
+	gettime(&start);
+	if (pdes_run(sim, nthreads, end_time) < 0) {
+	    fprintf(stderr, "Error: could not run the simulation\n");
+	    exit(EXIT_FAILURE);
+	}
+	gettime(&end);
+	elapsed = timediff(start, end);
+	dt = elapsed.tv_sec + (double)elapsed.tv_nsec / 1000000000.0;
+	rate = sim->committed / dt;
+	if (base == 0) base = rate;
+
+	/* Every committed event replaced itself with exactly one */
+	counted = 0;
+	for (int i = 0; i < n_lps; i++)
+	    counted += sim->lps[i].state[COUNT];
+	match = pdes_pending(sim) == (long)n_lps * events && counted == sim->committed;
+	ok &= match;
+
+	if (sweep) {
+	    printf("%d\t%1.6f\t%.0f\t\t%.2f\t%.2f%%\t\t%.1f\t\t%s\n", nthreads, dt, rate,
+		   rate / base,
+		   sim->processed ? 100.0 * sim->rolled_back / sim->processed : 0.0,
+		   sim->windows ? (double)sim->committed / sim->windows : 0.0,
+		   match ? "ok" : "WRONG");
+	} else {
+	    printf("Threads:\t%d\n", nthreads);
+	    printf("Total time:\t%1.8f s\n", dt);
+	    printf("Committed:\t%ld events (%.0f events/s)\n", sim->committed, rate);
+	    printf("Processed:\t%ld events\n", sim->processed);
+	    printf("Rolled back:\t%ld events (%.2f%%) in %ld rollbacks\n",
+		   sim->rolled_back,
+		   sim->processed ? 100.0 * sim->rolled_back / sim->processed : 0.0,
+		   sim->rollbacks);
+	    printf("Cancelled:\t%ld events\n", sim->cancelled);
+	    printf("Windows:\t%ld (%.1f events each, %ld passes)\n", sim->windows,
+		   sim->windows ? (double)sim->committed / sim->windows : 0.0,
+		   sim->rounds);
+	    printf("Check:\t\t%s\n", match ? "ok" : "WRONG");
+	}
+	pdes_destroy(sim);
+	if (nthreads == max_threads) break;
+    }
+
+    _destroy_gc_subsystem();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
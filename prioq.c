@@ -71,24 +71,28 @@ static inline void record_retry(void) {
 long prioq_get_retry_counter(void) { return retry_counter; }
 int  prioq_get_adaptive_mode(void) { return adaptive_mode; }
 
-static int random_level_adaptive(void) {
+/* Geometric level from the high bits of an lcg step. The low bits of
+ * an lcg have short periods (bit 0 alternates), which correlates the
+ * levels of successive inserts: with keys alternating between two
+ * regions, every node of one region stays at the bottom level. */
+static int lcg_level(void) {
     /* crappy lcg rng */
     unsigned int r = ptst->rand;
     ptst->rand = r * 1103515245 + 12345;
-    r &= (1u << (NUM_LEVELS - 1)) - 1;
-    
+    r |= 1u << (32 - (NUM_LEVELS - 1));
+    return __builtin_clz(r) + 1;
+}
+
+static int random_level_adaptive(void) {
     int level;
     if (adaptive_mode == 0) {
         /* uniformly distributed bits => geom. dist. level, p = 0.5 */
-        level = __builtin_ctz(r) + 1;
+        level = lcg_level();
     } else {
         /* increased average height: p = 0.75 for promotion roughly? 
          * Or just use two numbers and take the max to skew towards higher values. */
-        unsigned int r2 = ptst->rand;
-        ptst->rand = r2 * 1103515245 + 12345;
-        r2 &= (1u << (NUM_LEVELS - 1)) - 1;
-        int l1 = __builtin_ctz(r) + 1;
-        int l2 = __builtin_ctz(r2) + 1;
+        int l1 = lcg_level();
+        int l2 = lcg_level();
         level = (l1 > l2) ? l1 : l2;
     }
     
@@ -185,18 +189,19 @@ locate_preds(pq_t * restrict pq, pkey_t k, node_t ** restrict preds, node_t ** r
 /***** insert *****
  * Insert a new node n with key k and value v.
  * The node will not be inserted if another node with key k is already
- * present in the list.
+ * present in the list. Returns whether it was inserted.
  *
  * The predecessors, preds, and successors, succs, at all levels are
  * recorded, after which the node n is inserted from bottom to
  * top. Conditioned on that succs[i] is still the successor of
  * preds[i], n will be spliced in on level i.
  */
-void 
+int
 insert(pq_t *pq, pkey_t k, pval_t v)
 {
     node_t *preds[NUM_LEVELS], *succs[NUM_LEVELS];
     node_t *new = NULL, *del = NULL;
+    int inserted = 1;
     
     assert(SENTINEL_KEYMIN < k && k < SENTINEL_KEYMAX);
     critical_enter();
@@ -215,6 +220,7 @@ insert(pq_t *pq, pkey_t k, pval_t v)
     if (succs[0]->k == k && !is_marked_ref(preds[0]->next[0]) && preds[0]->next[0] == succs[0]) {
         new->inserting = 0;
         free_node(new);
+        inserted = 0;
         goto out;
     }
     new->next[0] = succs[0];
@@ -266,6 +272,7 @@ insert(pq_t *pq, pkey_t k, pval_t v)
     
  out:
     critical_exit();
+    return inserted;
 }
 
 
@@ -323,16 +330,17 @@ restructure(pq_t *pq)
 }
 
 
-/* deletemin
+/* deletemin_key
  *
- * Delete element with smallest key in queue.
- * Try to update the head node's pointers, if offset > max_offset.
+ * Delete element with smallest key in queue, and store its key in
+ * *key (if key is non-NULL). Try to update the head node's pointers,
+ * if offset > max_offset.
  *
  * Traverse level 0 next pointers until one is found that does
  * not have the delete bit set. 
  */
 pval_t
-deletemin(pq_t *pq)
+deletemin_key(pq_t *pq, pkey_t *key)
 {
     pval_t   v = NULL;
     node_t *x, *nxt, *obs_head = NULL, *newhead, *cur;
@@ -374,6 +382,7 @@ deletemin(pq_t *pq)
     assert(!is_marked_ref(x));
 
     v = x->v;
+    if (key) *key = x->k;
 
     
     /* If no inserting node was traversed, then use the latest 
@@ -413,6 +422,36 @@ deletemin(pq_t *pq)
     return v;
 }
 
+pval_t
+deletemin(pq_t *pq)
+{
+    return deletemin_key(pq, NULL);
+}
+
+/* peek_min_key
+ *
+ * Key of the first non-deleted node, or SENTINEL_KEYMAX if the queue
+ * is empty. Only a snapshot: the node may be deleted, or a smaller
+ * key inserted, right after it has been read.
+ */
+pkey_t
+peek_min_key(pq_t *pq)
+{
+    node_t *x;
+    pkey_t k;
+
+    /* a node is deleted when its predecessor's next[0] is marked */
+    critical_enter();
+    x = pq->head;
+    while (x != pq->tail && is_marked_ref(x->next[0]))
+        x = get_unmarked_ref(x->next[0]);
+    if (x != pq->tail)
+        x = get_unmarked_ref(x->next[0]);
+    k = x->k;
+    critical_exit();
+    return k;
+}
+
 /*
  * Init structure, setup sentinel head and tail nodes.
  */
@@ -43,10 +43,15 @@ extern pq_t *pq_init(int max_offset);
 
 extern void pq_destroy(pq_t *pq);
 
-extern void insert(pq_t *pq, pkey_t k, pval_t v);
+/* 0 if k is already present: duplicate keys are dropped */
+extern int insert(pq_t *pq, pkey_t k, pval_t v);
 
 extern pval_t deletemin(pq_t *pq);
 
+extern pval_t deletemin_key(pq_t *pq, pkey_t *key);
+
+extern pkey_t peek_min_key(pq_t *pq);
+
 extern void sequential_length(pq_t *pq);
 
 extern long prioq_get_retry_counter(void);
@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "range_prioq.h"
+#include "common.h"
+
+range_prioq_t *range_priq_init(int num_nodes, int max_offset,
+                               pkey_t key_lo, pkey_t key_hi) {
+    range_prioq_t *q;
+
+    if (num_nodes < 1) num_nodes = 1;
+    if (num_nodes > MAX_NUMA_NODES) num_nodes = MAX_NUMA_NODES;
+
+    E_en(posix_memalign((void **)&q, CACHE_LINE_SIZE, sizeof(range_prioq_t)));
+    memset(q, 0, sizeof(range_prioq_t));
+
+    q->num_nodes = num_nodes;
+    q->lo = key_lo;
+    q->width = key_hi > key_lo ? (key_hi - key_lo) / num_nodes + 1 : 1;
+    q->max_key = key_lo;
+    for (int i = 0; i < num_nodes; i++)
+        q->queues[i] = pq_init(max_offset);
+
+    return q;
+}
+
+void range_priq_destroy(range_prioq_t *q) {
+    if (q == NULL) return;
+
+    for (int i = 0; i < q->num_nodes; i++)
+        pq_destroy(q->queues[i]);
+    free(q);
+}
+
+/* Consistent copy of the window. */
+static void snapshot(range_prioq_t *q, int *base, pkey_t *lo, pkey_t *width) {
+    unsigned long s;
+
+    do {
+        while ((s = q->seq) & 1)
+            ;
+        CMB();
+        *base = q->base;
+        *lo = q->lo;
+        *width = q->width;
+        CMB();
+    } while (q->seq != s);
+}
+
+static int position(range_prioq_t *q, pkey_t key, pkey_t lo, pkey_t width) {
+    pkey_t p;
+
+    if (key < lo) return 0;
+    p = (key - lo) / width;
+    return p < (pkey_t)q->num_nodes ? (int)p : q->num_nodes - 1;
+}
+
+int range_priq_insert(range_prioq_t *q, pkey_t key, pval_t value) {
+    int base, shard;
+    pkey_t lo, width, m;
+
+    snapshot(q, &base, &lo, &width);
+    shard = (base + position(q, key, lo, width)) % q->num_nodes;
+    if (!insert(q->queues[shard], key, value))
+        return 0;
+    __sync_fetch_and_add(&q->load[shard].n, 1);
+
+    while (key > (m = q->max_key) &&
+           !__sync_bool_compare_and_swap(&q->max_key, m, key))
+        ;
+    return 1;
+}
+
+/* Rebalance: the lowest steps ring positions were seen empty while a
+ * higher one had elements. Unless the window has moved since the
+ * caller's snapshot, rotate the empty shards to the top, advance lo
+ * past them, and resize the ranges so that they span from lo to the
+ * largest key seen, by at most a factor two per slide. Inserts racing
+ * with a slide may put a key in a shard that has just changed range;
+ * it is still found by the scan in delete_min, only later. */
+static void slide(range_prioq_t *q, int base, int steps) {
+    pkey_t lo, w, width;
+
+    if (__sync_lock_test_and_set(&q->rotating, 1)) return;
+    if (q->base != base) goto out;
+
+    q->seq++;
+    IWMB();
+    width = q->width;
+    lo = q->lo + steps * width;
+    w = q->max_key > lo ? (q->max_key - lo) / q->num_nodes + 1 : 1;
+    w = max(w, width / 2);
+    w = min(w, width * 2);
+    q->lo = lo;
+    q->width = max(w, 1UL);
+    q->base = (base + steps) % q->num_nodes;
+    IWMB();
+    q->seq++;
+    q->rotations++;
+ out:
+    __sync_lock_release(&q->rotating);
+}
+
+pval_t range_priq_delete_min(range_prioq_t *q) {
+    int base, shard;
+    pkey_t lo, width;
+    pval_t result;
+
+    snapshot(q, &base, &lo, &width);
+
+    /* lowest non-empty range first */
+    for (int p = 0; p < q->num_nodes; p++) {
+        shard = (base + p) % q->num_nodes;
+        if (q->load[shard].n <= 0) continue;
+        result = deletemin(q->queues[shard]);
+        if (result != NULL) {
+            __sync_fetch_and_sub(&q->load[shard].n, 1);
+            if (p > 0) slide(q, base, p);
+            return result;
+        }
+    }
+
+    /* Published loads may lag behind, try every shard */
+    for (int i = 0; i < q->num_nodes; i++) {
+        result = deletemin(q->queues[i]);
+        if (result != NULL) {
+            __sync_fetch_and_sub(&q->load[i].n, 1);
+            return result;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,42 @@
+#ifndef RANGE_PRIOQ_H
+#define RANGE_PRIOQ_H
+
+#include "prioq.h"
+#include "numa_prioq.h"
+
+/* Key-range sharded priority queue. The key space is cut into
+ * num_nodes consecutive ranges of equal width, each owned by one pq_t
+ * shard. Shards form a ring: ring position 0 owns the lowest range
+ * [lo, lo + width), position 1 the next, and so on. Keys below lo go
+ * to position 0, keys above the last range to the last position.
+ *
+ * delete_min scans the positions from the lowest one, and takes the
+ * first element it finds. When it had to pass empty positions, the
+ * window slides: the empty shards are rotated to the top of the ring
+ * and lo advances past them. At the same time the width is adapted to
+ * the largest key seen, so the ranges keep covering the live keys.
+ */
+typedef struct {
+    int            num_nodes;
+    pq_t          *queues[MAX_NUMA_NODES];
+    numa_load_t    load[MAX_NUMA_NODES];
+
+    /* window, read optimistically under a sequence lock */
+    volatile unsigned long seq;     /* odd while the window moves */
+    volatile int   base;            /* shard at ring position 0 */
+    volatile pkey_t lo;
+    volatile pkey_t width;
+    volatile pkey_t max_key;        /* largest key inserted */
+    volatile int   rotating;
+    long           rotations;
+} range_prioq_t;
+
+range_prioq_t *range_priq_init(int num_nodes, int max_offset,
+                               pkey_t key_lo, pkey_t key_hi);
+void           range_priq_destroy(range_prioq_t *q);
+
+/* 0 if the shard already held the key, as for insert() */
+int    range_priq_insert(range_prioq_t *q, pkey_t key, pval_t value);
+pval_t range_priq_delete_min(range_prioq_t *q);
+
+#endif
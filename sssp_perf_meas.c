@@ -0,0 +1,408 @@
+/**
+ * Parallel single-source shortest paths on the priority queues.
+ * Dijkstra with lazy deletion: a relaxation that lowers a vertex's
+ * distance inserts a new entry instead of decreasing the key of the
+ * old one, which stays in the queue and is skipped when it comes out.
+ * With several threads, or a relaxed queue, vertices can be expanded
+ * before their distance is final; every such expansion, and the
+ * relaxations it makes, is work a sequential Dijkstra does not do.
+ *
+ * The graphs are task graph files or generators (graph_sched.h), with
+ * edge weights drawn per edge from the seed.
+ *
+ * Usage: ./sssp_perf_meas [options] <file>
+ *        ./sssp_perf_meas [options] -g <gen> <n_vertices> <degree>
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <assert.h>
+
+#include "gc/gc.h"
+
+#include "common.h"
+#include "numa_prioq.h"
+#include "graph_sched.h"
+
+#define DEFAULT_NTHREADS 1
+#define DEFAULT_OFFSET 32
+#define DEFAULT_NODES 2
+#define DEFAULT_MAXW 100
+
+#define INF (~0UL)
+
+/* Entries are keyed by distance, then vertex, which keeps them
+ * unique; distances stay below 2^31 so that keys fit. */
+#define KEY(d, v)   ((((pkey_t)(d)) << 32 | (pkey_t)(v)) + 1)
+#define KEY_D(k)    (((k) - 1) >> 32)
+#define KEY_V(k)    ((int)(((k) - 1) & 0xffffffffUL))
+
+/* the queue implementations */
+typedef struct {
+    const char *name;
+    void   *(*init)(int num_nodes, int offset);
+    void    (*destroy)(void *q);
+    void    (*insert)(void *q, pkey_t key, pval_t value);
+    pval_t  (*delete_min)(void *q);
+} backend_t;
+
+static void *numa_init(int n, int o) { return numa_priq_init(n, o); }
+static void numa_destroy(void *q) { numa_priq_destroy(q); }
+static void numa_insert(void *q, pkey_t k, pval_t v) { numa_priq_insert(q, k, v); }
+static pval_t numa_delete_min(void *q) { return numa_priq_delete_min(q); }
+
+static void *pq_init_(int n, int o) { return pq_init(o); }
+static void pq_destroy_(void *q) { pq_destroy(q); }
+static void pq_insert(void *q, pkey_t k, pval_t v) { insert(q, k, v); }
+static pval_t pq_delete_min(void *q) { return deletemin(q); }
+
+backend_t backends[] = {
+    { "numa", numa_init, numa_destroy, numa_insert, numa_delete_min },
+    { "pq",   pq_init_,  pq_destroy_,  pq_insert,   pq_delete_min },
+    { NULL }
+};
+
+typedef struct {
+    pthread_t thread;
+    int       id;
+    long      pops;         /* entries taken */
+    long      stale;        /* skipped: the vertex had a lower distance */
+    long      expanded;     /* vertices expanded */
+    long      relaxed;      /* distances lowered */
+    char      pad[128];
+} sssp_thread_t;
+
+graph_sched_t *gs;
+unsigned long *weights;     /* per edge, in CSR order */
+volatile unsigned long *dist;
+unsigned long *ref;         /* sequential distances */
+long seq_relaxed;           /* and the relaxations it took */
+backend_t *be;
+void *pq;
+int nthreads;
+int num_nodes;
+
+/* Termination: every entry inserted has been taken and processed.
+ * An entry is counted in inserted before it is in the queue, and its
+ * parent is counted in done only after that, so done == inserted,
+ * with done read first, means that nothing is queued or expanded. */
+volatile long inserted, done;
+volatile int wait_barrier = 0;
+volatile int go = 0;
+
+
+static void
+usage(FILE *out, const char *argv0)
+{
+    fprintf(out, "Usage: %s [OPTION]... <file>\n"
+	    "       %s [OPTION]... -g GEN <n_vertices> <degree>\n"
+	    "\n"
+	    "Options:\n", argv0, argv0);
+
+    fprintf(out, "\t-h\t\tDisplay usage.\n");
+    fprintf(out, "\t-n NUM\t\tUse NUM threads. "
+	    "Default: %i\n",
+	    DEFAULT_NTHREADS);
+    fprintf(out, "\t-b QUEUE\tQueue implementation: numa (sharded) or pq "
+	    "\n\t\t\t(single skiplist). Default: numa\n");
+    fprintf(out, "\t-m NODES\tShards of the numa queue. "
+	    "Default: %i\n",
+	    DEFAULT_NODES);
+    fprintf(out, "\t-o OFFSET\tUse an offset of OFFSET nodes. "
+	    "Default: %i\n",
+	    DEFAULT_OFFSET);
+    fprintf(out, "\t-g GEN\t\tGenerate the graph: random, layered, wavefront, "
+	    "\n\t\t\tforkjoin, cholesky, lu or powerlaw\n");
+    fprintf(out, "\t-S SEED\t\tSeed of the generator and the weights. "
+	    "Default: %i\n",
+	    GRAPH_GEN_SEED);
+    fprintf(out, "\t-w MAXW\t\tEdge weights are drawn from 1..MAXW. "
+	    "Default: %i\n",
+	    DEFAULT_MAXW);
+    fprintf(out, "\t-s VERTEX\tSource vertex. Default: 0\n");
+    fprintf(out, "\t-x\t\tScalability: solve with 1, 2, 4, ... up to NUM "
+	    "\n\t\t\tthreads, one line each\n");
+}
+
+
+/* splitmix64 of the seed and the edge index */
+static unsigned long
+edge_weight (unsigned long seed, long e, int maxw)
+{
+    uint64_t z = seed + (uint64_t)(e + 1) * 0x9e3779b97f4a7c15UL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+    return 1 + (z ^ (z >> 31)) % maxw;
+}
+
+
+/* Sequential reference: lazy deletion Dijkstra on a binary heap */
+static double
+solve_seq (int src)
+{
+    struct timespec start, end, elapsed;
+    pkey_t *heap, k, t;
+    long n = 0, cap = 1024, i, c;
+    unsigned long d, nd;
+    int u, v;
+
+    gettime(&start);
+    E_NULL(heap = malloc(cap * sizeof(pkey_t)));
+    for (i = 0; i < gs->n_tasks; i++)
+	ref[i] = INF;
+    ref[src] = 0;
+    heap[n++] = KEY(0, src);
+    while (n > 0) {
+	k = heap[0];
+	heap[0] = heap[--n];
+	for (i = 0; (c = 2 * i + 1) < n; i = c) {
+	    if (c + 1 < n && heap[c + 1] < heap[c]) c++;
+	    if (heap[i] <= heap[c]) break;
+	    t = heap[i]; heap[i] = heap[c]; heap[c] = t;
+	}
+	d = KEY_D(k);
+	u = KEY_V(k);
+	if (d > ref[u]) continue;
+	for (long e = gs->offsets[u]; e < gs->offsets[u + 1]; e++) {
+	    v = gs->edges[e];
+	    nd = d + weights[e];
+	    if (nd >= ref[v]) continue;
+	    ref[v] = nd;
+	    seq_relaxed++;
+	    if (n == cap) {
+		cap *= 2;
+		E_NULL(heap = realloc(heap, cap * sizeof(pkey_t)));
+	    }
+	    heap[n] = KEY(nd, v);
+	    for (i = n++; i > 0 && heap[(i - 1) / 2] > heap[i]; i = (i - 1) / 2) {
+		t = heap[i]; heap[i] = heap[(i - 1) / 2]; heap[(i - 1) / 2] = t;
+	    }
+	}
+    }
+    free(heap);
+    gettime(&end);
+    elapsed = timediff(start, end);
+    return elapsed.tv_sec + (double)elapsed.tv_nsec / 1000000000.0;
+}
+
+
+void *
+run (void *_args)
+{
+    sssp_thread_t *t = (sssp_thread_t *)_args;
+    unsigned long d, nd, old;
+    pval_t val;
+    pkey_t k;
+    long n;
+    int u, v;
+
+    numa_priq_set_local_node(t->id * num_nodes / nthreads);
+#if defined(__linux__)
+    pin (gettid(), t->id % sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+
+    __sync_fetch_and_add(&wait_barrier, 1);
+    while (!go);
+
+    for (;;) {
+	if ((val = be->delete_min(pq)) == NULL) {
+	    n = done;
+	    __sync_synchronize();
+	    if (n == inserted) break;
+	    __asm__ __volatile__ ("pause");
+	    continue;
+	}
+	t->pops++;
+	k = (pkey_t)val;
+	d = KEY_D(k);
+	u = KEY_V(k);
+	if (d > dist[u]) {
+	    t->stale++;
+	} else {
+	    t->expanded++;
+	    for (long e = gs->offsets[u]; e < gs->offsets[u + 1]; e++) {
+		v = gs->edges[e];
+		nd = d + weights[e];
+		while (nd < (old = dist[v])) {
+		    if (__sync_bool_compare_and_swap(&dist[v], old, nd)) {
+			__sync_fetch_and_add(&inserted, 1);
+			be->insert(pq, KEY(nd, v), (pval_t)KEY(nd, v));
+			t->relaxed++;
+			break;
+		    }
+		}
+	    }
+	}
+	__sync_fetch_and_add(&done, 1);
+    }
+    return NULL;
+}
+
+
+/* One parallel solve from src; fills ts and returns its time */
+static double
+solve (int src, int offset, sssp_thread_t *ts)
+{
+    struct timespec start, end, elapsed;
+
+    for (long i = 0; i < gs->n_tasks; i++)
+	dist[i] = INF;
+    dist[src] = 0;
+    inserted = done = 0;
+    wait_barrier = 0;
+    go = 0;
+    pq = be->init(num_nodes, offset);
+
+    memset(ts, 0, nthreads * sizeof(sssp_thread_t));
+    for (int i = 0; i < nthreads; i++) {
+	ts[i].id = i;
+	E_en(pthread_create(&ts[i].thread, NULL, run, &ts[i]));
+    }
+    while (wait_barrier != nthreads) ;
+    IRMB();
+    gettime(&start);
+    inserted = 1;
+    be->insert(pq, KEY(0, src), (pval_t)KEY(0, src));
+    IWMB();
+    go = 1;
+    for (int i = 0; i < nthreads; i++)
+	pthread_join(ts[i].thread, NULL);
+    gettime(&end);
+
+    be->destroy(pq);
+    elapsed = timediff(start, end);
+    return elapsed.tv_sec + (double)elapsed.tv_nsec / 1000000000.0;
+}
+
+
+int
+main (int argc, char **argv)
+{
+    int opt;
+    extern char *optarg;
+    extern int optind;
+    int offset		= DEFAULT_OFFSET;
+    int maxw		= DEFAULT_MAXW;
+    int src		= 0;
+    int sweep		= 0;
+    unsigned long seed	= GRAPH_GEN_SEED;
+    char *queue		= "numa";
+    char *gen		= NULL;
+    graph_gen_kind_t kind;
+    sssp_thread_t *ts;
+    long reached = 0, pops, stale, expanded, relaxed;
+    double t_seq, dt;
+    int max_threads, ok, match;
+    nthreads		= DEFAULT_NTHREADS;
+    num_nodes		= DEFAULT_NODES;
+
+    while ((opt = getopt(argc, argv, "n:b:m:o:g:S:w:s:xh")) >= 0) {
+	switch (opt) {
+	case 'n': nthreads	= atoi(optarg); break;
+	case 'b': queue		= optarg; break;
+	case 'm': num_nodes	= atoi(optarg); break;
+	case 'o': offset	= atoi(optarg); break;
+	case 'g': gen		= optarg; break;
+	case 'S': seed		= strtoul(optarg, NULL, 0); break;
+	case 'w': maxw		= atoi(optarg); break;
+	case 's': src		= atoi(optarg); break;
+	case 'x': sweep		= 1; break;
+	case 'h': usage(stdout, argv[0]); exit(EXIT_SUCCESS); break;
+	default:  usage(stderr, argv[0]); exit(EXIT_FAILURE);
+	}
+    }
+    for (be = backends; be->name && strcmp(be->name, queue); be++)
+	;
+    if (be->name == NULL || argc - optind != (gen ? 2 : 1) || nthreads < 1 ||
+	maxw < 1 || (gen && graph_sched_parse_gen(gen, &kind) < 0)) {
+	usage(stderr, argv[0]);
+	exit(EXIT_FAILURE);
+    }
+    if (num_nodes < 1) num_nodes = 1;
+    if (num_nodes > MAX_NUMA_NODES) num_nodes = MAX_NUMA_NODES;
+    max_threads = nthreads;
+
+    _init_gc_subsystem();
+
+    if (gen)
+	gs = graph_sched_generate(kind, atoi(argv[optind]), atoi(argv[optind + 1]), seed,
+				  (int)sysconf(_SC_NPROCESSORS_ONLN));
+    else
+	gs = graph_sched_load(argv[optind], (int)sysconf(_SC_NPROCESSORS_ONLN));
+    if (gs == NULL)
+	exit(EXIT_FAILURE);
+    if (src < 0 || src >= gs->n_tasks ||
+	(unsigned long)maxw * gs->n_tasks >= 1UL << 31) {
+	fprintf(stderr, "Error: source out of range or weights too large\n");
+	exit(EXIT_FAILURE);
+    }
+
+    E_NULL(weights = malloc((gs->n_edges + 1) * sizeof(unsigned long)));
+    for (long e = 0; e < gs->n_edges; e++)
+	weights[e] = edge_weight(seed, e, maxw);
+    E_NULL(dist = malloc(gs->n_tasks * sizeof(unsigned long)));
+    E_NULL(ref = malloc(gs->n_tasks * sizeof(unsigned long)));
+    E_NULL(ts = malloc(max_threads * sizeof(sssp_thread_t)));
+
+    t_seq = solve_seq(src);
+    for (long i = 0; i < gs->n_tasks; i++)
+	reached += ref[i] != INF;
+
+    printf("Graph:\t\t%d vertices, %ld edges, weights 1..%d\n",
+	   gs->n_tasks, gs->n_edges, maxw);
+    printf("Queue:\t\t%s\n", be->name);
+    if (be->init == numa_init)
+	printf("Nodes:\t\t%d\n", num_nodes);
+    printf("Reached:\t%ld from %d\n", reached, src);
+    printf("Sequential:\t%1.8f s\n", t_seq);
+    if (sweep)
+	printf("Threads\tTime (s)\tSpeedup\tWasted\tStale\tRe-expanded\tCheck\n");
+
+    ok = 1;
+    for (nthreads = sweep ? 1 : max_threads; ; nthreads = min(nthreads * 2, max_threads)) {
+	dt = solve(src, offset, ts);
+	pops = stale = expanded = relaxed = 0;
+	for (int i = 0; i < nthreads; i++) {
+	    pops += ts[i].pops;
+	    stale += ts[i].stale;
+	    expanded += ts[i].expanded;
+	    relaxed += ts[i].relaxed;
+	}
+	match = 1;
+	for (long i = 0; i < gs->n_tasks; i++)
+	    match &= dist[i] == ref[i];
+	ok &= match;
+
+	/* The sequential solve expands each reached vertex once, and
+	 * takes seq_relaxed relaxations; anything beyond that is due to
+	 * entries taken out of order */
+	if (sweep) {
+	    printf("%d\t%1.6f\t%.2f\t%ld\t%ld\t%ld\t%s\n", nthreads, dt, t_seq / dt,
+		   relaxed - seq_relaxed, stale, expanded - reached,
+		   match ? "ok" : "WRONG");
+	} else {
+	    printf("Threads:\t%d\n", nthreads);
+	    printf("Total time:\t%1.8f s\n", dt);
+	    printf("Speedup:\t%.2f over sequential\n", t_seq / dt);
+	    printf("Pops:\t\t%ld (%ld stale)\n", pops, stale);
+	    printf("Expanded:\t%ld (%ld re-expanded)\n", expanded, expanded - reached);
+	    printf("Relaxations:\t%ld (%ld sequential)\n", relaxed, seq_relaxed);
+	    printf("Wasted:\t\t%ld (%.2f%%)\n", relaxed - seq_relaxed,
+		   relaxed ? 100.0 * (relaxed - seq_relaxed) / relaxed : 0.0);
+	    printf("Check:\t\t%s\n", match ? "ok" : "WRONG");
+	}
+	if (nthreads == max_threads) break;
+    }
+
+    free(ts);
+    free(ref);
+    free((void *)dist);
+    free(weights);
+    graph_sched_destroy(gs);
+    _destroy_gc_subsystem();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
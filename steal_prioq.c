@@ -0,0 +1,175 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "steal_prioq.h"
+#include "common.h"
+
+static __thread unsigned int steal_seed;
+
+/* The calling thread's deque, by its thread slot. A deque left behind
+ * by an exited thread passes on with the slot, and can be stolen from
+ * meanwhile. */
+static steal_deque_t *my_deque(steal_prioq_t *q) {
+    int slot = thread_slot();
+    steal_deque_t *d;
+
+    if (steal_seed == 0)
+        steal_seed = slot * 2654435761u + 1;
+    d = &q->deques[slot];
+    /* only the owner allocates; thieves see an empty deque until then */
+    if (d->buf == NULL)
+        E_NULL(d->buf = (steal_entry_t *)malloc(STEAL_DEQUE_CAP * sizeof(steal_entry_t)));
+    return d;
+}
+
+steal_prioq_t *steal_priq_init(int max_offset, pkey_t window) {
+    steal_prioq_t *q;
+
+    E_en(posix_memalign((void **)&q, CACHE_LINE_SIZE, sizeof(steal_prioq_t)));
+    memset(q, 0, sizeof(steal_prioq_t));
+    E_en(posix_memalign((void **)&q->deques, CACHE_LINE_SIZE,
+                        STEAL_MAX_THREADS * sizeof(steal_deque_t)));
+    memset(q->deques, 0, STEAL_MAX_THREADS * sizeof(steal_deque_t));
+
+    q->window = window;
+    q->global = pq_init(max_offset);
+    return q;
+}
+
+void steal_priq_destroy(steal_prioq_t *q) {
+    if (q == NULL) return;
+
+    for (int i = 0; i < STEAL_MAX_THREADS; i++)
+        free(q->deques[i].buf);
+    free(q->deques);
+    pq_destroy(q->global);
+    free(q);
+}
+
+static int deque_push(steal_deque_t *d, pkey_t key, pval_t value) {
+    long b = d->bottom, t = d->top;
+    steal_entry_t *e;
+
+    if (b - t >= STEAL_DEQUE_CAP) return 0;
+    e = &d->buf[b & (STEAL_DEQUE_CAP - 1)];
+    e->key = key;
+    e->val = value;
+    /* publish the entry before the new bottom */
+    CMB();
+    d->bottom = b + 1;
+    return 1;
+}
+
+static int deque_pop(steal_deque_t *d, pkey_t *key, pval_t *value) {
+    long b = d->bottom - 1, t;
+    steal_entry_t *e;
+
+    d->bottom = b;
+    /* the new bottom must be visible before top is read */
+    __sync_synchronize();
+    t = d->top;
+    if (t > b) {
+        d->bottom = b + 1;
+        return 0;
+    }
+    e = &d->buf[b & (STEAL_DEQUE_CAP - 1)];
+    *key = e->key;
+    *value = e->val;
+    if (t == b) {
+        /* last element: race the thieves for it */
+        int won = __sync_bool_compare_and_swap(&d->top, t, t + 1);
+        d->bottom = b + 1;
+        return won;
+    }
+    return 1;
+}
+
+static int deque_steal(steal_deque_t *d, pkey_t *key, pval_t *value) {
+    long t = d->top, b;
+    steal_entry_t *e;
+
+    CMB();
+    b = d->bottom;
+    if (t >= b) return 0;
+    e = &d->buf[t & (STEAL_DEQUE_CAP - 1)];
+    *key = e->key;
+    *value = e->val;
+    return __sync_bool_compare_and_swap(&d->top, t, t + 1);
+}
+
+void steal_priq_insert(steal_prioq_t *q, pkey_t key, pval_t value) {
+    steal_deque_t *d = my_deque(q);
+
+    if ((key <= d->last || key - d->last <= q->window) && deque_push(d, key, value)) {
+        d->n_local++;
+        return;
+    }
+    if (insert(q->global, key, value))
+        __sync_fetch_and_add(&q->global_load.n, 1);
+    d->n_global++;
+}
+
+static pval_t global_delete_min(steal_prioq_t *q, pkey_t *key) {
+    pval_t v;
+
+    if (q->global_load.n <= 0) return NULL;
+    v = deletemin_key(q->global, key);
+    if (v != NULL) __sync_fetch_and_sub(&q->global_load.n, 1);
+    return v;
+}
+
+pval_t steal_priq_delete_min(steal_prioq_t *q) {
+    steal_deque_t *d = my_deque(q), *v;
+    int n = min(thread_slots_used(), STEAL_MAX_THREADS), start;
+    pkey_t key, gk, bk;
+    pval_t val;
+
+    /* bound the drift of the deque from the global order */
+    if (++d->ops % STEAL_CHECK == 0 && q->global_load.n > 0 && d->bottom > d->top) {
+        bk = d->buf[(d->bottom - 1) & (STEAL_DEQUE_CAP - 1)].key;
+        gk = peek_min_key(q->global);
+        if (gk < bk && bk - gk > q->window &&
+            (val = global_delete_min(q, &key)) != NULL) {
+            d->n_drift++;
+            d->last = key;
+            return val;
+        }
+    }
+
+    if (deque_pop(d, &key, &val) || (val = global_delete_min(q, &key)) != NULL) {
+        d->last = key;
+        return val;
+    }
+
+    /* steal the oldest element of another deque, from a random one on */
+    start = n > 1 ? rand_r(&steal_seed) % n : 0;
+    for (int i = 0; i < n; i++) {
+        v = &q->deques[(start + i) % n];
+        if (v != d && deque_steal(v, &key, &val)) {
+            d->n_stolen++;
+            d->last = key;
+            return val;
+        }
+    }
+    return NULL;
+}
+
+pkey_t steal_priq_peek_min(steal_prioq_t *q) {
+    steal_deque_t *d = my_deque(q);
+
+    if (d->bottom > d->top)
+        return d->buf[(d->bottom - 1) & (STEAL_DEQUE_CAP - 1)].key;
+    return q->global_load.n > 0 ? peek_min_key(q->global) : SENTINEL_KEYMAX;
+}
+
+void steal_priq_stats(steal_prioq_t *q, long *local, long *global,
+                      long *stolen, long *drift) {
+    *local = *global = *stolen = *drift = 0;
+    for (int i = 0; i < STEAL_MAX_THREADS; i++) {
+        *local += q->deques[i].n_local;
+        *global += q->deques[i].n_global;
+        *stolen += q->deques[i].n_stolen;
+        *drift += q->deques[i].n_drift;
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef STEAL_PRIOQ_H
+#define STEAL_PRIOQ_H
+
+#include "prioq.h"
+#include "numa_prioq.h"
+
+#define STEAL_MAX_THREADS THREAD_SLOTS
+/* Capacity of a thread's deque; inserts into a full deque go to the
+ * global queue. */
+#define STEAL_DEQUE_CAP   1024
+/* A thread compares the head of its deque with that of the global
+ * queue once every STEAL_CHECK delete_min. */
+#define STEAL_CHECK       8
+
+typedef struct {
+    pkey_t  key;
+    pval_t  val;
+} steal_entry_t;
+
+/* Chase-Lev deque of one thread: the owner pushes and pops at the
+ * bottom, other threads steal from the top. */
+typedef struct {
+    volatile long  top;
+    char           pad[CACHE_LINE_SIZE - sizeof(long)];
+    volatile long  bottom;
+    steal_entry_t *buf;
+    pkey_t         last;        /* key of the last element taken */
+    unsigned long  ops;
+    long           n_local;     /* inserts kept in the deque */
+    long           n_global;    /* inserts that went to the global queue */
+    long           n_stolen;    /* elements taken from other deques */
+    long           n_drift;     /* deque bypassed for a better global head */
+} CACHELINE steal_deque_t;
+
+/* Work-stealing deques in front of a global pq_t. An insert stays in
+ * the caller's deque if its key is within window of the last key the
+ * caller took, and goes to the global queue otherwise. delete_min pops
+ * the caller's deque (most recent first), then takes the global
+ * minimum, then steals the oldest element of another deque.
+ *
+ * Deques are LIFO and only roughly sorted, so their elements drift
+ * from the priority order. Every STEAL_CHECK operations the caller
+ * checks the global head, and takes it instead if it is more than
+ * window below the deque's next element. */
+typedef struct {
+    pkey_t         window;
+    pq_t          *global;
+    numa_load_t    global_load;
+    steal_deque_t *deques;
+} steal_prioq_t;
+
+steal_prioq_t *steal_priq_init(int max_offset, pkey_t window);
+void           steal_priq_destroy(steal_prioq_t *q);
+
+void   steal_priq_insert(steal_prioq_t *q, pkey_t key, pval_t value);
+pval_t steal_priq_delete_min(steal_prioq_t *q);
+/* Key of the caller's next deque element, else the global head;
+ * SENTINEL_KEYMAX if both are empty. */
+pkey_t steal_priq_peek_min(steal_prioq_t *q);
+/* Sum of the counters of all deques. */
+void   steal_priq_stats(steal_prioq_t *q, long *local, long *global,
+                        long *stolen, long *drift);
+
+#endif
@@ -1,11 +1,24 @@
 #define _GNU_SOURCE
 #include <assert.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdlib.h>
 
 #include "gc/gc.h"
 
 #include "prioq.h"
+#include "numa_prioq.h"
+#include "hier_prioq.h"
+#include "range_prioq.h"
+#include "steal_prioq.h"
+#include "bucket_prioq.h"
+#include "lane_prioq.h"
+#include "pdes.h"
+#include "graph_sched.h"
+#include "graph_dyn.h"
+#include "graph_trace.h"
+#include "graph_coarse.h"
+#include "graph_stream.h"
 #include "common.h"
 
 #define PER_THREAD 30
@@ -25,12 +38,44 @@ void *invariant_thread(void *id);
 void test_parallel_add(void);
 void test_parallel_del(void);
 void test_invariants(void);
+void test_numa_steal(void);
+void test_hier_order(void);
+void test_range_slide(void);
+void test_steal_deque(void);
+void test_bucket_order(void);
+void test_lane_order(void);
+void test_pdes_window(void);
+void test_graph_queue(void);
+void test_graph_run(void);
+void test_graph_rank(void);
+void test_graph_gen(void);
+void test_graph_check(void);
+void test_graph_coarse(void);
+void test_graph_dyn(void);
+void test_graph_stream(void);
+void test_graph_trace(void);
 
 typedef void (* test_func_t)(void);
 
 test_func_t tests[] = {
     test_parallel_del,
     test_parallel_add,
+    test_numa_steal,
+    test_hier_order,
+    test_range_slide,
+    test_steal_deque,
+    test_bucket_order,
+    test_lane_order,
+    test_pdes_window,
+    test_graph_queue,
+    test_graph_run,
+    test_graph_rank,
+    test_graph_gen,
+    test_graph_check,
+    test_graph_coarse,
+    test_graph_dyn,
+    test_graph_stream,
+    test_graph_trace,
 //    test_invariants,
     NULL
 };
@@ -74,6 +119,1011 @@ test_parallel_del()
     printf("OK.\n");
 }
 
+/* Fill one shard, drain from another. Every element must come back
+ * exactly once, and the first one must be the global minimum. */
+void
+test_numa_steal()
+{
+    numa_prioq_t *nq;
+    unsigned long v, n = 4 * STEAL_BATCH;
+    char seen[4 * STEAL_BATCH + 1] = {0};
+
+    printf("test numa steal\n");
+
+    nq = numa_priq_init(2, 10);
+    numa_priq_set_local_node(1);
+    for (unsigned long i = n; i > 0; i--)
+	numa_priq_insert(nq, i, (pval_t)i);
+    assert(nq->load[1].n == n);
+
+    numa_priq_set_local_node(0);
+    v = (unsigned long)numa_priq_delete_min(nq);
+    assert(v == 1);
+    seen[v] = 1;
+    assert(nq->steals == 1);
+    for (unsigned long i = 1; i < n; i++) {
+	v = (unsigned long)numa_priq_delete_min(nq);
+	assert(v > 0 && v <= n && !seen[v]);
+	seen[v] = 1;
+    }
+    assert(numa_priq_delete_min(nq) == NULL);
+    assert(nq->load[0].n == 0 && nq->load[1].n == 0 && nq->dropped == 0);
+
+    /* a key the shard already holds is dropped, and not counted */
+    assert(numa_priq_insert(nq, 7, (pval_t)7) == 1);
+    assert(numa_priq_insert(nq, 7, (pval_t)8) == 0);
+    assert(nq->load[0].n == 1);
+    assert((unsigned long)numa_priq_delete_min(nq) == 7);
+    numa_priq_destroy(nq);
+
+    printf("OK.\n");
+}
+
+static hier_prioq_t *hq_seq;
+
+static void *
+hier_insert_thread(void *key)
+{
+    hier_priq_insert(hq_seq, (pkey_t)key, key);
+    return NULL;
+}
+
+static void *
+hier_drain_thread(void *n)
+{
+    while (hier_priq_delete_min(hq_seq) != NULL)
+	(*(long *)n)++;
+    return NULL;
+}
+
+/* Used by a single thread, the hierarchical queue is exact, also when
+ * elements spill from the thread buffer and overflow the node tier.
+ * Threads that exit give their buffer on with their thread slot, so
+ * any number of them can use the queue one after another. */
+void
+test_hier_order()
+{
+    pthread_t t;
+    long drained = 0;
+    hier_prioq_t *hq;
+    unsigned long v, ov = 0, n = 1000;
+
+    printf("test hier order\n");
+
+    hq = hier_priq_init(2, 10, 100);
+    for (unsigned long i = 0; i < n; i++)
+	hier_priq_insert(hq, (i * 7919) % n + 1, (pval_t)((i * 7919) % n + 1));
+    /* interleave deletes with inserts below the buffer bound */
+    for (unsigned long i = 0; i < n / 2; i++) {
+	v = (unsigned long)hier_priq_delete_min(hq);
+	assert(v == ov + 1);
+	ov = v;
+	if (i % 4 == 0) {
+	    hier_priq_insert(hq, n + i + 1, (pval_t)(n + i + 1));
+	}
+    }
+    for (unsigned long i = n / 2; i < n; i++) {
+	v = (unsigned long)hier_priq_delete_min(hq);
+	assert(v == ov + 1);
+	ov = v;
+    }
+    while ((v = (unsigned long)hier_priq_delete_min(hq)) != 0) {
+	assert(v > ov);
+	ov = v;
+    }
+    assert(hq->global_load.n == 0);
+    hier_priq_destroy(hq);
+
+    hq_seq = hier_priq_init(2, 10, 100);
+    for (long i = 1; i <= THREAD_SLOTS + 44; i++) {
+	pthread_create(&t, NULL, hier_insert_thread, (void *)i);
+	pthread_join(t, NULL);
+    }
+    pthread_create(&t, NULL, hier_drain_thread, &drained);
+    pthread_join(t, NULL);
+    assert(drained == THREAD_SLOTS + 44);
+    assert(thread_slots_used() < 2 * nthreads);
+    hier_priq_destroy(hq_seq);
+
+    printf("OK.\n");
+}
+
+/* Thread 0 fills its deque and overflows to the global queue while
+ * the others steal: every element is taken exactly once. Repeated with
+ * new threads each time, which take over the deque slots of the old
+ * ones. */
+static steal_prioq_t *sq;
+static volatile char *steal_seen;
+static volatile long steal_left;
+
+void *
+steal_thread(void *id)
+{
+    unsigned long n = 4 * STEAL_DEQUE_CAP, v;
+
+    if ((long)id == 0) {
+	for (unsigned long i = 1; i <= n; i++)
+	    steal_priq_insert(sq, i, (pval_t)i);
+    }
+    while (steal_left > 0) {
+	v = (unsigned long)steal_priq_delete_min(sq);
+	if (v == 0) continue;
+	assert(v <= n && __sync_lock_test_and_set(&steal_seen[v], 1) == 0);
+	__sync_fetch_and_sub(&steal_left, 1);
+    }
+    return NULL;
+}
+
+void
+test_steal_deque()
+{
+    unsigned long n = 4 * STEAL_DEQUE_CAP;
+    long local, global, stolen, drift;
+
+    printf("test steal deque, %d threads\n", nthreads);
+
+    for (int round = 0; round < 2 * STEAL_MAX_THREADS / nthreads; round++) {
+	sq = steal_priq_init(10, n);
+	steal_seen = calloc(n + 1, 1);
+	steal_left = n;
+	for (long i = 0; i < nthreads; i ++)
+	    pthread_create (&ts[i], NULL, steal_thread, (void *)i);
+	for (long i = 0; i < nthreads; i ++)
+	    (void)pthread_join (ts[i], NULL);
+	assert(steal_priq_delete_min(sq) == NULL);
+	steal_priq_stats(sq, &local, &global, &stolen, &drift);
+	assert(local + global == (long)n && local >= STEAL_DEQUE_CAP);
+	free((void *)steal_seen);
+	steal_priq_destroy(sq);
+    }
+    assert(thread_slots_used() < 2 * nthreads);
+
+    printf("OK.\n");
+}
+
+/* Keys of one aligned window come out in order, across several
+ * levels of the bitmap, and the next window reuses the buckets. */
+void
+test_bucket_order()
+{
+    bucket_prioq_t *bq;
+    unsigned long v, n = 5000, k;
+
+    printf("test bucket order\n");
+
+    bq = bucket_priq_init(n);
+    assert(bq->levels == 3);
+    for (unsigned long w = 0; w < 2; w++) {
+	for (unsigned long i = 0; i < n; i++) {
+	    k = w * n + (i * 7919) % n + 1;
+	    bucket_priq_insert(bq, k, (pval_t)k);
+	}
+	for (unsigned long i = 1; i <= n; i++) {
+	    if (i % 100 == 0)
+		assert(bucket_priq_peek_min(bq) == w * n + i);
+	    v = (unsigned long)bucket_priq_delete_min(bq);
+	    assert(v == w * n + i);
+	}
+	assert(bucket_priq_delete_min(bq) == NULL);
+	assert(bucket_priq_peek_min(bq) == SENTINEL_KEYMAX);
+	assert(bq->bits[2][0] == 0);
+    }
+    bucket_priq_destroy(bq);
+
+    printf("OK.\n");
+}
+
+/* Every event sends one on, every other one to the next LP. The LP
+ * must never see time go backwards: a straggler rolls it back first. */
+static void
+pdes_hop(pdes_t *sim, pdes_lp_t *lp, pdes_event_t *ev)
+{
+    assert(ev->ts >= lp->state[1]);
+    lp->state[0]++;
+    lp->state[1] = ev->ts;
+    pdes_send(sim, ev, (lp->id + (lp->state[0] & 1)) % sim->n_lps,
+	      ev->ts + 5 + lp->state[0] % 7);
+}
+
+/* Windowed optimistic runs: each executed event is either committed
+ * or undone, the population stays constant and the LP counters agree
+ * with the commits, also when a run is continued. */
+void
+test_pdes_window()
+{
+    const char *queues[2] = { "pq", "numa" };
+    int threads[2] = { 1, nthreads };
+    pdes_t *sim;
+    long counted;
+
+    printf("test pdes window, 1 and %d threads\n", nthreads);
+
+    assert(pdes_init("none", 1, 64, 5, pdes_hop, NULL) == NULL);
+    assert(pdes_init("pq", 1, 64, 0, pdes_hop, NULL) == NULL);
+
+    for (int q = 0; q < 2; q++) {
+	for (int t = 0; t < 2; t++) {
+	    sim = pdes_init(queues[q], 2, 64, 5, pdes_hop, NULL);
+	    for (int i = 0; i < 64; i++)
+		for (int e = 0; e < 4; e++)
+		    pdes_schedule(sim, i, 1 + 3 * e + i % 5);
+	    if (q == 1 && threads[t] < 2) {
+		assert(pdes_run(sim, threads[t], 2000) < 0);
+		pdes_destroy(sim);
+		continue;
+	    }
+	    for (uint64_t end = 2000; end <= 4000; end += 2000) {
+		assert(pdes_run(sim, threads[t], end) == 0);
+		counted = 0;
+		for (int i = 0; i < 64; i++) {
+		    counted += sim->lps[i].state[0];
+		    assert(sim->lps[i].n_log == 0 && sim->lps[i].state[1] < end);
+		}
+		assert(counted == sim->committed && sim->committed > 64 * 4 * (end / 12) / 2);
+		assert(sim->processed == sim->committed + sim->rolled_back);
+		assert(pdes_pending(sim) == 64 * 4);
+		assert(sim->windows > 0 && sim->rounds >= sim->windows);
+	    }
+	    if (threads[t] == 1)
+		assert(sim->rolled_back == 0 && sim->cancelled == 0);
+	    pdes_destroy(sim);
+	}
+    }
+
+    printf("OK.\n");
+}
+
+/* EDF inside a lane, FIFO among equal deadlines, stride sharing
+ * between lanes by weight, and dequeue-time deadline misses. */
+void
+test_lane_order()
+{
+    lane_prioq_t *lq;
+    int weights[2] = { 3, 1 }, lane, got[2] = { 0, 0 };
+    uint64_t e, far;
+    long v;
+
+    printf("test lane order\n");
+
+    lq = lane_priq_init(2, weights, 32);
+    e = lq->epoch;
+    far = e + (1UL << 40);
+    assert(lane_priq_delete_min(lq, NULL) == NULL);
+
+    /* deadlines 5, 3, 9, then three ties at 7 */
+    lane_priq_insert(lq, 0, far + 5, (pval_t)1);
+    lane_priq_insert(lq, 0, far + 3, (pval_t)2);
+    lane_priq_insert(lq, 0, far + 9, (pval_t)3);
+    for (long i = 4; i <= 6; i++)
+	lane_priq_insert(lq, 0, far + 7, (pval_t)i);
+    assert(lane_priq_peek_deadline(lq, 0) == far + 3);
+    assert(lane_priq_peek_deadline(lq, 1) == 0);
+    assert(lq->nonempty == 1);
+    assert((long)lane_priq_delete_min(lq, &lane) == 2 && lane == 0);
+    assert((long)lane_priq_delete_min(lq, NULL) == 1);
+    for (long i = 4; i <= 6; i++)
+	assert((long)lane_priq_delete_min(lq, NULL) == i);
+    assert((long)lane_priq_delete_min(lq, NULL) == 3);
+    assert(lane_priq_delete_min(lq, NULL) == NULL);
+    assert(lq->nonempty == 0 && lq->lanes[0].missed == 0);
+
+    /* both lanes backlogged: 3 of every 4 from lane 0. Lane 1 is due
+     * in the past, so each of its elements counts as missed. */
+    for (long i = 1; i <= 60; i++) {
+	lane_priq_insert(lq, 0, far + i, (pval_t)i);
+	lane_priq_insert(lq, 1, 1, (pval_t)i);
+    }
+    assert(lq->nonempty == 3);
+    for (int i = 0; i < 40; i++) {
+	v = (long)lane_priq_delete_min(lq, &lane);
+	assert(v == ++got[lane]);
+    }
+    assert(got[0] >= 29 && got[0] <= 31);
+    while (lane_priq_delete_min(lq, &lane) != NULL)
+	got[lane]++;
+    assert(got[0] == 60 && got[1] == 60 && lq->nonempty == 0);
+    assert(lq->lanes[0].taken == 66 && lq->lanes[0].missed == 0);
+    assert(lq->lanes[1].taken == 60 && lq->lanes[1].missed == 60);
+    assert(lq->lanes[1].max_late > 0);
+
+    /* more overdue elements than sequence numbers: none is dropped */
+    for (v = 0; v < (1L << LANE_SEQ_BITS) + 100; v++)
+	lane_priq_insert(lq, 1, 1, (pval_t)1);
+    while (lane_priq_delete_min(lq, NULL) != NULL)
+	v--;
+    assert(v == 0 && lq->nonempty == 0);
+    lane_priq_destroy(lq);
+
+    printf("OK.\n");
+}
+
+/* A window sliding over the key space: deletes return keys in order
+ * as long as nothing is inserted below the minimum, and the ranges
+ * follow the keys upwards. */
+void
+test_graph_queue()
+{
+    graph_queue_opts_t opts = { 2, 16, 256 };
+    graph_queue_iface_t qi;
+    pkey_t keys[200];
+    pval_t vals[200];
+    char seen[201];
+    long hint;
+    int got, n;
+
+    printf("test graph queue registry\n");
+
+    assert(graph_queue_find("nosuch") == NULL);
+    assert(graph_queue_init_by_name(&qi, "nosuch", &opts) < 0);
+    for (const graph_queue_backend_t *b = graph_queue_backends; b->name; b++) {
+	assert(graph_queue_find(b->name) == b);
+	assert(graph_queue_init_by_name(&qi, b->name, &opts) >= 1);
+	for (int i = 0; i < 200; i++) {
+	    keys[i] = (i * 73) % 200 + 1;
+	    vals[i] = (pval_t)keys[i];
+	}
+	/* one batch into shard 1, the other wherever the queue puts it */
+	qi.insert_batch(qi.q, keys, vals, 100, 1);
+	qi.insert_batch(qi.q, keys + 100, vals + 100, 100, -1);
+	hint = qi.size_hint(qi.q);
+	assert(hint == -1 || (hint >= 0 && hint <= 200));
+	if (strcmp(b->name, "hier") != 0)
+	    assert(hint == -1 || hint == 200);
+
+	memset(seen, 0, sizeof(seen));
+	n = 0;
+	while ((got = qi.delete_min_batch(qi.q, vals, 32)) > 0) {
+	    assert(got <= 32);
+	    for (int i = 0; i < got; i++) {
+		unsigned long k = (unsigned long)vals[i];
+		assert(k >= 1 && k <= 200 && !seen[k]);
+		seen[k] = 1;
+		/* unsharded exact queues keep the order */
+		if (strcmp(b->name, "pq") == 0 || strcmp(b->name, "bucket") == 0)
+		    assert(k == (unsigned long)n + i + 1);
+	    }
+	    n += got;
+	}
+	assert(n == 200);
+	assert(qi.peek_min(qi.q) == SENTINEL_KEYMAX);
+	hint = qi.size_hint(qi.q);
+	assert(hint == -1 || hint == 0);
+	graph_queue_destroy(&qi);
+	assert(qi.q == NULL);
+    }
+    /* the bucket queue needs a key range */
+    opts.nbuckets = 0;
+    assert(graph_queue_init_by_name(&qi, "bucket", &opts) < 0);
+
+    printf("OK.\n");
+}
+
+void
+test_range_slide()
+{
+    range_prioq_t *rq;
+    unsigned long v, next = 1, ov = 0, n = 100;
+
+    printf("test range slide\n");
+
+    rq = range_priq_init(4, 10, 1, n);
+    for (; next <= n; next++)
+	range_priq_insert(rq, next, (pval_t)next);
+    for (int i = 0; i < 10 * n; i++) {
+	v = (unsigned long)range_priq_delete_min(rq);
+	assert(v == ov + 1);
+	ov = v;
+	range_priq_insert(rq, next, (pval_t)next);
+	next++;
+    }
+    assert(rq->rotations > 0 && rq->lo > 5 * n);
+    for (unsigned long i = 0; i < n; i++) {
+	v = (unsigned long)range_priq_delete_min(rq);
+	assert(v == ov + 1);
+	ov = v;
+    }
+    assert(range_priq_delete_min(rq) == NULL);
+    range_priq_destroy(rq);
+
+    printf("OK.\n");
+}
+
+static volatile char *graph_started;
+
+/* no child may start before all of its parents have run */
+static void
+check_deps_task(graph_sched_t *gs, int id, void *arg)
+{
+    const int *deps = graph_sched_deps(gs, id);
+
+    assert(!graph_started[id]);
+    graph_started[id] = 1;
+    for (int i = 0; i < graph_sched_n_deps(gs, id); i++)
+	assert(!graph_started[deps[i]]);
+}
+
+void
+test_graph_run()
+{
+    graph_sched_t *gs;
+    int n = 10000;
+
+    printf("test graph run, %d threads\n", nthreads);
+
+    graph_started = calloc(n, 1);
+    gs = graph_sched_create_random_numa(n, 4, 2);
+    assert(graph_sched_run(gs, nthreads, check_deps_task, NULL) == n);
+    for (int i = 0; i < n; i++)
+	assert(graph_started[i]);
+    assert(gs->n_deletes == n && gs->n_inserts == n && gs->n_wasted == 0);
+    for (int i = 0; i < n; i++)
+	assert(gs->tasks[i].state == GRAPH_TASK_DONE);
+
+    /* entries of an earlier run, or of a task that is not ready, are
+     * dropped and counted */
+    graph_sched_reset(gs);
+    gs->qiface.insert(gs->qiface.q, gs->key_base + n + 1,
+		      (pval_t)((uintptr_t)&gs->tasks[gs->roots[0]] |
+			       ((gs->gen - 1) & GRAPH_ENTRY_TAG)));
+    for (int i = 0; i < n; i++) {
+	if (gs->init_indegree[i] > 0) {
+	    gs->qiface.insert(gs->qiface.q, gs->key_base + n + 2,
+			      (pval_t)((uintptr_t)&gs->tasks[i] | (gs->gen & GRAPH_ENTRY_TAG)));
+	    break;
+	}
+    }
+    memset((void *)graph_started, 0, n);
+    assert(graph_sched_run(gs, nthreads, check_deps_task, NULL) == n);
+    /* workers may finish before reaching the entries, keyed last */
+    assert(graph_sched_extract_min_topo(gs) == -1);
+    assert(gs->n_wasted == 2);
+
+    /* explicit reset: indegrees and roots as built */
+    graph_sched_reset(gs);
+    for (int i = 0; i < n; i++)
+	assert(gs->tasks[i].indegree == gs->init_indegree[i]);
+    for (int i = 0; i < gs->n_roots; i++)
+	assert(gs->init_indegree[gs->roots[i]] == 0);
+    memset((void *)graph_started, 0, n);
+    assert(graph_sched_run(gs, nthreads, check_deps_task, NULL) == n);
+    assert(gs->n_deletes == n && gs->n_inserts == n);
+    graph_sched_destroy(gs);
+
+    /* fan-out spread over the node shards of the hierarchical queue */
+    memset((void *)graph_started, 0, n);
+    gs = graph_sched_create_random_hier(n, 4, 4);
+    gs->place = GRAPH_PLACE_SPREAD;
+    assert(graph_sched_run(gs, nthreads, check_deps_task, NULL) == n);
+    for (int i = 0; i < n; i++)
+	assert(graph_started[i]);
+    graph_sched_destroy(gs);
+
+    /* one bucket per task */
+    memset((void *)graph_started, 0, n);
+    gs = graph_sched_create_random(n, 4);
+    graph_sched_attach_bucket(gs);
+    graph_sched_set_policy(gs, GRAPH_PRIO_FIFO, NULL, nthreads);
+    assert(graph_sched_run(gs, nthreads, check_deps_task, NULL) == n);
+    memset((void *)graph_started, 0, n);
+    assert(graph_sched_run(gs, nthreads, check_deps_task, NULL) == n);
+    graph_sched_destroy(gs);
+
+    /* worker deques in front of the skiplist */
+    memset((void *)graph_started, 0, n);
+    gs = graph_sched_create_random(n, 4);
+    graph_sched_attach_steal(gs, 16);
+    assert(graph_sched_run(gs, nthreads, check_deps_task, NULL) == n);
+    graph_sched_destroy(gs);
+    free((void *)graph_started);
+
+    printf("OK.\n");
+}
+
+void
+test_graph_rank()
+{
+    /* 0 -> {1, 2} -> 3 */
+    static const long offsets[] = { 0, 2, 3, 4, 4 };
+    static const int edges[] = { 1, 2, 3, 3 };
+    long cost[] = { 1, 5, 1, 1 }, rank[4], *big;
+    graph_prio_policy_t policies[] = { GRAPH_PRIO_FIFO, GRAPH_PRIO_LIFO,
+				       GRAPH_PRIO_RANK };
+    graph_sched_t *gs;
+    int n = 10000;
+
+    printf("test graph rank, %d threads\n", nthreads);
+
+    gs = calloc(1, sizeof(graph_sched_t));
+    gs->n_tasks = 4;
+    gs->n_edges = 4;
+    gs->tasks = graph_sched_alloc_tasks(4);
+    gs->offsets = malloc(sizeof(offsets));
+    gs->edges = malloc(sizeof(edges));
+    memcpy(gs->offsets, offsets, sizeof(offsets));
+    memcpy(gs->edges, edges, sizeof(edges));
+    assert(graph_sched_upward_rank(gs, cost, rank, nthreads) == 7);
+    assert(rank[0] == 7 && rank[1] == 6 && rank[2] == 2 && rank[3] == 1);
+    assert(graph_sched_set_policy(gs, GRAPH_PRIO_RANK, cost, 1) == 7);
+    assert(gs->tasks[0].priority == 0 && gs->tasks[1].priority == 1 &&
+	   gs->tasks[2].priority == 2 && gs->tasks[3].priority == 3);
+
+    /* 0 -> 1 -> 0: the sweep gives up instead of waiting for a child,
+     * and the priorities stay */
+    gs->edges[2] = 0;
+    assert(graph_sched_upward_rank(gs, cost, rank, nthreads) == -1);
+    assert(rank[2] == 2 && rank[3] == 1);
+    assert(graph_sched_set_policy(gs, GRAPH_PRIO_RANK, cost, nthreads) == -1);
+    assert(gs->tasks[0].priority == 0 && gs->tasks[3].priority == 3);
+    graph_sched_destroy(gs);
+
+    /* every rank is its cost on top of the largest child rank, and
+     * every policy runs the DAG in dependency order */
+    big = malloc(n * sizeof(long));
+    gs = graph_sched_create_random_prioq(n, 4);
+    assert(graph_sched_upward_rank(gs, NULL, big, nthreads) > 0);
+    for (int i = 0; i < n; i++) {
+	long r = 0;
+	for (int j = 0; j < graph_sched_n_deps(gs, i); j++)
+	    r = max(r, big[graph_sched_deps(gs, i)[j]]);
+	assert(big[i] == r + 1);
+    }
+    for (int p = 0; p < 3; p++) {
+	/* each run restarts the same graph */
+	graph_started = calloc(n, 1);
+	graph_sched_set_policy(gs, policies[p], NULL, nthreads);
+	/* LIFO children are never behind the head: exercise the bypass */
+	gs->bypass = policies[p] == GRAPH_PRIO_LIFO;
+	assert(graph_sched_run(gs, nthreads, check_deps_task, NULL) == n);
+	assert(gs->n_deletes + gs->n_bypassed == n);
+	assert(gs->n_inserts + gs->n_bypassed == n);
+	assert(gs->bypass || gs->n_bypassed == 0);
+	free((void *)graph_started);
+    }
+    graph_sched_destroy(gs);
+    free(big);
+
+    printf("OK.\n");
+}
+
+void
+test_graph_gen()
+{
+    graph_sched_t *gs, *ref;
+    graph_check_t chk;
+    int n = 5000;
+
+    printf("test graph generators, %d threads\n", nthreads);
+
+    for (int g = GRAPH_GEN_RANDOM; g <= GRAPH_GEN_POWERLAW; g++) {
+	/* same graph whatever the number of building threads */
+	ref = graph_sched_generate(g, n, 4, GRAPH_GEN_SEED, 1);
+	gs = graph_sched_generate(g, n, 4, GRAPH_GEN_SEED, nthreads);
+	assert(gs->n_tasks == ref->n_tasks && gs->n_edges == ref->n_edges);
+	assert(memcmp(gs->offsets, ref->offsets,
+		      (gs->n_tasks + 1) * sizeof(long)) == 0);
+	assert(memcmp(gs->edges, ref->edges, gs->n_edges * sizeof(int)) == 0);
+	for (int i = 0; i < gs->n_tasks; i++)
+	    assert(gs->tasks[i].indegree == ref->tasks[i].indegree);
+	graph_sched_destroy(ref);
+
+	/* ids are a topological order, adjacency lists are sets */
+	for (int i = 0; i < gs->n_tasks; i++) {
+	    const int *deps = graph_sched_deps(gs, i);
+	    for (int j = 0; j < graph_sched_n_deps(gs, i); j++)
+		assert(deps[j] > i && (j == 0 || deps[j] > deps[j - 1]));
+	}
+
+	assert(graph_sched_check(gs, nthreads, &chk) == 0 && chk.levels > 1);
+
+	graph_started = calloc(gs->n_tasks, 1);
+	graph_sched_attach_prioq(gs);
+	assert(graph_sched_run(gs, nthreads, check_deps_task, NULL) == gs->n_tasks);
+	free((void *)graph_started);
+	graph_sched_destroy(gs);
+    }
+
+    /* tiled Cholesky on 4x4 tiles: 4 POTRF, 6 TRSM, 6 SYRK, 4 GEMM */
+    gs = graph_sched_generate(GRAPH_GEN_CHOLESKY, 20, 0, 0, 1);
+    assert(gs->n_tasks == 20 && gs->n_roots == 1);
+    graph_sched_destroy(gs);
+
+    printf("OK.\n");
+}
+
+void
+test_graph_check()
+{
+    graph_sched_t *gs, *ld;
+    graph_check_t chk;
+    char path[] = "/tmp/graph_check_XXXXXX";
+    FILE *f;
+    int fd, w;
+
+    printf("test graph load and check, %d threads\n", nthreads);
+
+    /* edge list in reverse order, loaded back sorted */
+    gs = graph_sched_generate(GRAPH_GEN_WAVEFRONT, 2500, 0, GRAPH_GEN_SEED, 1);
+    fd = mkstemp(path);
+    assert(fd >= 0 && (f = fdopen(fd, "w")) != NULL);
+    fprintf(f, "# wavefront\n\n");
+    for (int i = gs->n_tasks - 1; i >= 0; i--) {
+	for (int j = graph_sched_n_deps(gs, i) - 1; j >= 0; j--)
+	    fprintf(f, "%d\t%d\n", i, graph_sched_deps(gs, i)[j]);
+    }
+    fclose(f);
+    ld = graph_sched_load_edgelist(path, nthreads);
+    unlink(path);
+    assert(ld->n_tasks == gs->n_tasks && ld->n_edges == gs->n_edges);
+    assert(memcmp(ld->offsets, gs->offsets, (gs->n_tasks + 1) * sizeof(long)) == 0);
+    assert(memcmp(ld->edges, gs->edges, gs->n_edges * sizeof(int)) == 0);
+    for (int i = 0; i < gs->n_tasks; i++)
+	assert(ld->tasks[i].indegree == gs->tasks[i].indegree);
+    graph_sched_destroy(ld);
+
+    /* 50x50 grid: 99 anti-diagonals */
+    assert(graph_sched_check(gs, nthreads, &chk) == 0);
+    assert(chk.levels == 99 && chk.cyclic == 0);
+
+    /* an edge back to the only root, instead of one to a task with
+     * two parents: every task is behind the cycle, and two indegrees
+     * are off */
+    w = graph_sched_deps(gs, 51)[0];
+    graph_sched_deps(gs, 51)[0] = 0;
+    assert(graph_sched_check(gs, nthreads, &chk) < 0);
+    assert(chk.cyclic == gs->n_tasks && chk.bad_indegree == 2);
+    assert(chk.bad_ids == 0 && chk.self_loops == 0 && chk.duplicates == 0);
+
+    /* a self loop, a duplicate and a bad id */
+    graph_sched_deps(gs, 51)[0] = w;
+    graph_sched_deps(gs, 1)[1] = 1;
+    graph_sched_deps(gs, 2)[0] = graph_sched_deps(gs, 2)[1];
+    graph_sched_deps(gs, 3)[0] = gs->n_tasks;
+    assert(graph_sched_check(gs, nthreads, &chk) < 0);
+    assert(chk.self_loops == 1 && chk.duplicates == 1 && chk.bad_ids == 1);
+    graph_sched_destroy(gs);
+
+    printf("OK.\n");
+}
+
+void
+test_graph_coarse()
+{
+    graph_sched_t *gs;
+    graph_coarse_t *c;
+    char *seen;
+    long sum;
+
+    printf("test graph coarsening, %d threads\n", nthreads);
+
+    /* complete binary fork tree of 511 tasks: each of the 256 leaves
+     * continues into its own join, and the two children of each of
+     * the 255 inner forks fit a budget of 4 together */
+    gs = graph_sched_generate(GRAPH_GEN_FORKJOIN, 1022, 2, GRAPH_GEN_SEED, 1);
+    c = graph_coarse_create(gs, NULL, 4, GRAPH_COARSE_CHAINS);
+    assert(c->n_chained == 256 && c->gs->n_tasks == gs->n_tasks - 256);
+    graph_coarse_destroy(c);
+    c = graph_coarse_create(gs, NULL, 4, GRAPH_COARSE_CHAINS | GRAPH_COARSE_SIBLINGS);
+    assert(c->n_chained == 256 && c->n_grouped == 255);
+    assert(c->gs->n_tasks == gs->n_tasks - 256 - 255);
+    assert(graph_sched_check(c->gs, nthreads, NULL) == 0);
+
+    /* every task in exactly one super-task, within the budget */
+    seen = calloc(gs->n_tasks, 1);
+    for (int s = 0; s < c->gs->n_tasks; s++) {
+	assert(c->mstart[s + 1] - c->mstart[s] == c->cost[s] && c->cost[s] <= 4);
+	for (long k = c->mstart[s]; k < c->mstart[s + 1]; k++) {
+	    assert(!seen[c->members[k]] && c->group[c->members[k]] == s);
+	    seen[c->members[k]] = 1;
+	}
+    }
+    for (int i = 0; i < gs->n_tasks; i++)
+	assert(seen[i]);
+    free(seen);
+
+    /* the original edges still hold */
+    graph_started = calloc(gs->n_tasks, 1);
+    graph_sched_attach_prioq(c->gs);
+    assert(graph_coarse_run(c, nthreads, check_deps_task, NULL) == c->gs->n_tasks);
+    for (int i = 0; i < gs->n_tasks; i++)
+	assert(graph_started[i]);
+    free((void *)graph_started);
+    graph_coarse_destroy(c);
+    graph_sched_destroy(gs);
+
+    /* costs: a chain of 10 tasks of cost 3 into super-tasks of 9 */
+    gs = calloc(1, sizeof(graph_sched_t));
+    gs->n_tasks = 10;
+    gs->n_edges = 9;
+    gs->tasks = graph_sched_alloc_tasks(10);
+    gs->offsets = malloc(11 * sizeof(long));
+    gs->edges = malloc(9 * sizeof(int));
+    for (int i = 0; i < 10; i++) {
+	gs->offsets[i] = i;
+	gs->tasks[i].indegree = i > 0;
+	if (i < 9) gs->edges[i] = i + 1;
+    }
+    gs->offsets[10] = 9;
+    graph_sched_snapshot(gs);
+    {
+	long cost[10] = { 3, 3, 3, 3, 3, 3, 3, 3, 3, 3 };
+	c = graph_coarse_create(gs, cost, 9, GRAPH_COARSE_CHAINS);
+    }
+    assert(c->gs->n_tasks == 4 && c->gs->n_edges == 3);
+    sum = 0;
+    for (int s = 0; s < 4; s++)
+	sum += c->cost[s];
+    assert(sum == 30 && c->cost[0] == 9 && c->cost[3] == 3);
+    graph_coarse_destroy(c);
+    graph_sched_destroy(gs);
+
+    printf("OK.\n");
+}
+
+/* fib(n) spawning fib(n-1), fib(n-2) and a join continuation that
+ * adds their results to cont */
+static volatile long dyn_sum[1 << 12], dyn_result;
+
+static void
+dyn_add(int cont, long v)
+{
+    __sync_fetch_and_add(cont < 0 ? &dyn_result : &dyn_sum[cont], v);
+}
+
+static void
+dyn_join_task(graph_dyn_t *d, int id, void *arg)
+{
+    dyn_add((int)(long)arg, dyn_sum[id]);
+}
+
+static void
+dyn_fib_task(graph_dyn_t *d, int id, void *arg)
+{
+    int n = (int)((long)arg >> 16), cont = (int)((long)arg & 0xffff) - 1, j, c;
+
+    if (n < 2) {
+	dyn_add(cont, n);
+	return;
+    }
+    j = graph_dyn_add_task(d, n, dyn_join_task, (void *)(long)cont);
+    if (cont >= 0) assert(graph_dyn_add_edge(d, j, cont));
+    for (int k = 1; k <= 2; k++) {
+	c = graph_dyn_add_task(d, n - k, dyn_fib_task,
+			       (void *)(((long)(n - k) << 16) | (j + 1)));
+	assert(graph_dyn_add_edge(d, c, j));
+	graph_dyn_release(d, c);
+    }
+    graph_dyn_release(d, j);
+}
+
+/* A producer thread that outlives the graphs it adds chains to */
+static graph_dyn_t * volatile dyn_chain_graph;
+static volatile int dyn_chain_done;
+
+static void *
+dyn_chain_thread(void *arg)
+{
+    int prev, t;
+
+    for (int round = 0; round < 2; round++) {
+	while (dyn_chain_graph == NULL)
+	    ;
+	prev = -1;
+	for (int i = 0; i < 2 * GRAPH_DYN_EDGE_SLAB; i++) {
+	    t = graph_dyn_add_task(dyn_chain_graph, i, NULL, NULL);
+	    if (prev >= 0) {
+		assert(graph_dyn_add_edge(dyn_chain_graph, prev, t));
+		graph_dyn_release(dyn_chain_graph, prev);
+	    }
+	    prev = t;
+	}
+	graph_dyn_release(dyn_chain_graph, prev);
+	dyn_chain_graph = NULL;
+	dyn_chain_done = round + 1;
+    }
+    return NULL;
+}
+
+void
+test_graph_dyn()
+{
+    graph_dyn_t *d;
+    pthread_t producer;
+    int root, c;
+
+    printf("test dynamic graph, %d threads\n", nthreads);
+
+    d = graph_dyn_create();
+    d->n_nodes = graph_queue_init_numa(&d->qiface, 2);
+    /* fib(12) = 144, in 3 * fib(13) - 2 = 697 tasks */
+    root = graph_dyn_add_task(d, 12, dyn_fib_task, (void *)(12L << 16));
+    graph_dyn_release(d, root);
+    assert(graph_dyn_run(d, nthreads) == 697);
+    assert(dyn_result == 144 && d->n_tasks == 697);
+
+    /* an edge from a completed task is not added, and the child runs
+     * without waiting for it */
+    c = graph_dyn_add_task(d, 0, NULL, NULL);
+    assert(graph_dyn_add_edge(d, root, c) == 0);
+    graph_dyn_release(d, c);
+    assert(graph_dyn_run(d, nthreads) == 1);
+    assert(d->n_completed == 698 && d->n_late_edges == 1);
+    graph_dyn_destroy(d);
+
+    /* the same under lanes, where plain tasks take the last lane */
+    dyn_result = 0;
+    for (int i = 0; i < 1 << 12; i++)
+	dyn_sum[i] = 0;
+    d = graph_dyn_create();
+    graph_dyn_attach_lanes(d, 2, NULL);
+    root = graph_dyn_add_task(d, 12, dyn_fib_task, (void *)(12L << 16));
+    graph_dyn_release(d, root);
+    assert(graph_dyn_run(d, nthreads) == 697);
+    assert(dyn_result == 144 && d->lanes->lanes[1].taken == 697);
+    graph_dyn_destroy(d);
+
+    /* edges from a thread that added to an earlier, destroyed graph */
+    E_en(pthread_create(&producer, NULL, dyn_chain_thread, NULL));
+    for (int round = 0; round < 2; round++) {
+	d = graph_dyn_create();
+	d->n_nodes = graph_queue_init_numa(&d->qiface, 2);
+	dyn_chain_graph = d;
+	while (dyn_chain_done != round + 1)
+	    ;
+	assert(d->n_edges == 2 * GRAPH_DYN_EDGE_SLAB - 1);
+	assert(graph_dyn_run(d, nthreads) == 2 * GRAPH_DYN_EDGE_SLAB);
+	graph_dyn_destroy(d);
+    }
+    pthread_join(producer, NULL);
+
+    printf("OK.\n");
+}
+
+static graph_stream_t *stream;
+static volatile char *stream_done;
+
+/* a child must not have run before its parent */
+static void
+stream_task(graph_sid_t id, void *arg)
+{
+    for (int64_t k = 0; k < graph_stream_n_deps(stream, id); k++)
+	assert(!stream_done[graph_stream_dep(stream, id, k)]);
+    assert(!stream_done[id]);
+    stream_done[id] = 1;
+}
+
+/* Windows retire in order, with every task run once and after its
+ * parents, from both id widths; a backward edge stops the run. */
+void
+test_graph_stream()
+{
+    char path[] = "/tmp/graph_stream_XXXXXX";
+    graph_sched_t *gs, *gs2;
+    graph_file_hdr_t hdr, bad_hdr;
+    long bad_off;
+    int fd, bad_id;
+
+    printf("test graph streaming, %d threads\n", nthreads);
+
+    fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    assert(graph_stream_write_random(path, 50000, 3, 5000, GRAPH_GEN_SEED) == 0);
+    stream = graph_stream_open(path, 1024, 2, 1);
+    assert(stream != NULL && stream->id_bytes == 8 && stream->n_windows == 49);
+    assert(stream->n_edges == 50000 * 3 - 6);
+    stream_done = (volatile char *)calloc(50000, 1);
+    for (int r = 0; r < 2; r++) {
+	memset((void *)stream_done, 0, 50000);
+	assert(graph_stream_run(stream, nthreads, stream_task, NULL) == 50000);
+	assert(stream->base == 49 && stream->live_counts == 0);
+	assert(stream->max_live_counts >= 1);
+    }
+    for (int i = 0; i < 50000; i++)
+	assert(stream_done[i]);
+    graph_stream_close(stream);
+    free((void *)stream_done);
+
+    /* a 50x50 grid with 4-byte ids, in windows of 100 */
+    gs = graph_sched_generate(GRAPH_GEN_WAVEFRONT, 2500, 0, GRAPH_GEN_SEED, 1);
+    assert(graph_sched_save_csr(gs, path) == 0);
+    stream = graph_stream_open(path, 100, 1, 1);
+    stream_done = (volatile char *)calloc(2500, 1);
+    assert(stream->id_bytes == 4);
+    assert(graph_stream_run(stream, nthreads, stream_task, NULL) == 2500);
+    graph_stream_close(stream);
+
+    /* corrupt sections are rejected by a full load */
+    assert((gs2 = graph_sched_load_csr(path)) != NULL && gs2->n_edges == gs->n_edges);
+    graph_sched_destroy(gs2);
+    fd = open(path, O_RDWR);
+    assert(fd >= 0 && pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr));
+    bad_id = 2500;
+    assert(pwrite(fd, &bad_id, sizeof(int), hdr.edges_pos + 7 * sizeof(int)) == sizeof(int));
+    assert(graph_sched_load_csr(path) == NULL);
+    bad_id = gs->edges[7];
+    assert(pwrite(fd, &bad_id, sizeof(int), hdr.edges_pos + 7 * sizeof(int)) == sizeof(int));
+    bad_off = gs->n_edges + 1;
+    assert(pwrite(fd, &bad_off, sizeof(long), hdr.offsets_pos + 10 * sizeof(long)) == sizeof(long));
+    assert(graph_sched_load_csr(path) == NULL);
+    /* a stream stops at the bad offset instead */
+    stream = graph_stream_open(path, 100, 1, 1);
+    assert(stream != NULL);
+    assert(graph_stream_run(stream, nthreads, NULL, NULL) == -1);
+    graph_stream_close(stream);
+    /* sections that wrap around or are misaligned are not opened */
+    bad_hdr = hdr;
+    bad_hdr.offsets_pos = -16;
+    assert(pwrite(fd, &bad_hdr, sizeof(hdr), 0) == sizeof(hdr));
+    assert(graph_sched_load_csr(path) == NULL);
+    assert(graph_stream_open(path, 100, 1, 1) == NULL);
+    bad_hdr = hdr;
+    bad_hdr.offsets_pos += 4;
+    assert(pwrite(fd, &bad_hdr, sizeof(hdr), 0) == sizeof(hdr));
+    assert(graph_sched_load_csr(path) == NULL);
+    assert(graph_stream_open(path, 100, 1, 1) == NULL);
+    bad_hdr = hdr;
+    bad_hdr.n_tasks = 1UL << 61;
+    bad_hdr.indegree_pos = (1UL << 63) + 128;
+    assert(pwrite(fd, &bad_hdr, sizeof(hdr), 0) == sizeof(hdr));
+    assert(graph_stream_open(path, 100, 1, 1) == NULL);
+    close(fd);
+
+    graph_sched_deps(gs, 51)[0] = 0;
+    assert(graph_sched_save_csr_ids(gs, path, 8) == 0);
+    assert(graph_sched_load_csr(path) == NULL);
+    stream = graph_stream_open(path, 100, 1, 1);
+    assert(graph_stream_run(stream, nthreads, NULL, NULL) == -1);
+    graph_stream_close(stream);
+    free((void *)stream_done);
+    graph_sched_destroy(gs);
+    unlink(path);
+
+    printf("OK.\n");
+}
+
+void
+test_graph_trace()
+{
+    graph_sched_t *gs;
+    graph_trace_t *tr;
+    graph_trace_rec_t **rec;
+    int n = 2000;
+
+    printf("test graph trace, %d threads\n", nthreads);
+
+    gs = graph_sched_create_random_numa(n, 4, 2);
+    tr = graph_trace_create(nthreads, n);
+    gs->trace = tr;
+    assert(graph_sched_run(gs, nthreads, NULL, NULL) == n);
+
+    /* one record per task, ordered within a worker */
+    rec = calloc(n, sizeof(graph_trace_rec_t *));
+    for (int w = 0; w < nthreads; w++) {
+	for (long i = 0; i < tr->rings[w].n; i++) {
+	    graph_trace_rec_t *r = &tr->rings[w].recs[i];
+	    assert(rec[r->task] == NULL);
+	    assert(r->start <= r->end && r->end <= tr->t1);
+	    assert(i == 0 || r->start >= tr->rings[w].recs[i - 1].end);
+	    rec[r->task] = r;
+	}
+    }
+    /* a task becomes ready once its last parent has finished running */
+    for (int i = 0; i < n; i++) {
+	const int *deps = graph_sched_deps(gs, i);
+	assert(rec[i] != NULL);
+	for (int j = 0; j < graph_sched_n_deps(gs, i); j++) {
+	    graph_trace_rec_t *c = rec[deps[j]];
+	    assert(c->ready >= rec[i]->end && c->start >= c->ready);
+	}
+    }
+    free(rec);
+    graph_trace_destroy(tr);
+    gs->trace = NULL;
+    graph_sched_destroy(gs);
+
+    printf("OK.\n");
+}
+
 void
 check_invariants(pq_t *pq) 
 {
@@ -166,7 +1216,6 @@ test_invariants()
 void
 setup (int max_offset) 
 {
-    _init_gc_subsystem();
     pq = pq_init(max_offset);
 }
 
@@ -174,7 +1223,6 @@ void
 teardown ()
 {
     pq_destroy(pq);
-    _destroy_gc_subsystem();
 }
 
 int
@@ -185,11 +1233,15 @@ main(int argc, char **argv)
     ts = malloc(nthreads * sizeof(pthread_t));
     assert(ts);
 
+    /* The gc allocators registered by pq_init outlive a single
+     * queue, so the subsystem is set up once per process. */
+    _init_gc_subsystem();
     for(test_func_t *tf = tests; *tf; tf++) {
         setup(10);
         (*tf)();
         teardown();
     }
+    _destroy_gc_subsystem();
     
     return 0;
 }